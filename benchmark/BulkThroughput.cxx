@@ -0,0 +1,173 @@
+/**
+ * Bulk throughput benchmark: the USBBulkBenchmark device is exported with the USBIPServer and a USB/IP client
+ * thread acts as host, which keeps the indicated number of URBs in flight. We report the payload throughput in
+ * MB/s and the percentiles of the latency per transfer (from the submission of the URB to the reply of the device;
+ * in loopback mode from the submission of the OUT URB to the reply of the IN URB).
+ *
+ *   BulkThroughput [--mode source|sink|loopback] [--packet 64] [--transfer 4096] [--queue 4] [--count 1000]
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBBulkBenchmark.h"
+#include "USBIPClient.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static USBBulkBenchmark *bench = nullptr;
+
+struct Result {
+    bool ok = false;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    std::vector<uint32_t> latencies;
+};
+
+static const char* modeName(USBBenchmarkMode mode){
+    static const char* names[] = {"source", "sink", "loopback"};
+    return names[mode];
+}
+
+// host side: keeps queue URBs in flight until count transfers have been completed
+static void runHost(uint16_t port, USBBulkBenchmarkConfig cfg, int count, Result &result){
+    USBIPClient client;
+    if (!client.begin(port) || !client.control(1, TUSB_REQ_SET_CONFIGURATION, 1)){
+        return;
+    }
+    uint8_t ep_num = tu_edpt_number(cfg.ep_out);
+    std::vector<uint8_t> out_data(cfg.transfer_size);
+    std::vector<uint8_t> in_data(cfg.transfer_size);
+    std::vector<uint64_t> submit_time(count);
+    for (int j=0;j<cfg.transfer_size;j++){
+        out_data[j] = j * 7;
+    }
+    bool loopback = cfg.mode==BenchmarkLoopback;
+    bool in = cfg.mode==BenchmarkSource;
+    int queue = std::min((int)cfg.queue_depth, USBIP_MAX_URBS);
+
+    auto submit = [&](int idx){
+        submit_time[idx] = USBClock::micros();
+        if (loopback){
+            return client.submit(2*idx+1, ep_num, false, cfg.transfer_size, out_data.data())
+                && client.submit(2*idx+2, ep_num, true, cfg.transfer_size);
+        }
+        return client.submit(idx+2, ep_num, in, cfg.transfer_size, out_data.data());
+    };
+
+    uint64_t start = USBClock::micros();
+    int submitted = 0;
+    int completed = 0;
+    while(submitted<queue && submitted<count){
+        if (!submit(submitted++)) return;
+    }
+    while(completed<count){
+        uint32_t seqnum;
+        int32_t status, len;
+        if (!client.receive(seqnum, status, len) || status!=0){
+            return;
+        }
+        // in loopback mode the OUT replies are just acknowledgements
+        if (loopback && seqnum % 2 == 1){
+            continue;
+        }
+        if ((in || loopback) && !client.receiveData(in_data.data(), len)){
+            return;
+        }
+        int idx = loopback ? (seqnum-2) / 2 : seqnum-2;
+        if (loopback && (len!=cfg.transfer_size || memcmp(in_data.data(), out_data.data(), len)!=0)){
+            return;
+        }
+        result.latencies.push_back(USBClock::micros() - submit_time[idx]);
+        result.bytes += len;
+        completed++;
+        if (submitted<count && !submit(submitted++)){
+            return;
+        }
+    }
+    result.seconds = (USBClock::micros() - start) / 1000000.0;
+    result.ok = true;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &values, int percent){
+    if (values.empty()) return 0;
+    size_t idx = (values.size() * percent + 99) / 100;
+    return values[idx>0 ? idx-1 : 0];
+}
+
+int main(int argc, char **argv) {
+    USBBulkBenchmarkConfig cfg;
+    int queue = 4;
+    int count = 1000;
+    for (int j=1;j<argc-1;j+=2){
+        if (strcmp(argv[j],"--mode")==0){
+            cfg.mode = strcmp(argv[j+1],"source")==0 ? BenchmarkSource : strcmp(argv[j+1],"sink")==0 ? BenchmarkSink : BenchmarkLoopback;
+        } else if (strcmp(argv[j],"--packet")==0){
+            cfg.packet_size = atoi(argv[j+1]);
+        } else if (strcmp(argv[j],"--transfer")==0){
+            cfg.transfer_size = atoi(argv[j+1]);
+        } else if (strcmp(argv[j],"--queue")==0){
+            queue = atoi(argv[j+1]);
+        } else if (strcmp(argv[j],"--count")==0){
+            count = atoi(argv[j+1]);
+        }
+    }
+    // the latency percentiles need at least one transfer
+    if (count<1){
+        printf("--count must be at least 1\n");
+        return 1;
+    }
+    // the queue depth is a uint8_t and the server can only keep USBIP_MAX_URBS in flight
+    int max_queue = std::min(255, USBIP_MAX_URBS);
+    if (queue<1 || queue>max_queue){
+        printf("--queue must be between 1 and %d\n", max_queue);
+        return 1;
+    }
+    cfg.queue_depth = queue;
+
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.idVendor(0xCafe).idProduct(0x4010).bcdDevice(0x0100).manufacturer("TinyUSB").product("Bulk Benchmark");
+    bench = new USBBulkBenchmark(cfg);
+    bench->begin(device);
+    USBStubDCD::instance().setTransferCallback([](uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+        bench->transferCompleted(ep_addr, result, xferred_bytes);
+    });
+
+    USBIPServer &server = USBIPServer::instance();
+    if (!server.begin(0, device)){
+        printf("could not start the USB/IP server\n");
+        return 1;
+    }
+
+    Result result;
+    std::atomic<bool> done{false};
+    std::thread host([&](){
+        runHost(server.port(), cfg, count, result);
+        done = true;
+    });
+
+    bool started = false;
+    while(!done){
+        server.poll(1);
+        tud_task();
+        if (!started && tud_mounted()){
+            bench->start();
+            started = true;
+        }
+    }
+    host.join();
+    server.end();
+    delete bench;
+
+    printf("mode: %s, packet: %d, transfer: %d, queue: %d, transfers: %d\n", modeName(cfg.mode), cfg.packet_size, cfg.transfer_size, cfg.queue_depth, count);
+    if (!result.ok){
+        printf("failed after %d transfers\n", (int)result.latencies.size());
+        return 1;
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    printf("throughput: %.2f MB/s (%llu bytes in %.3f s)\n", result.bytes / result.seconds / 1000000.0, (unsigned long long)result.bytes, result.seconds);
+    printf("latency us: p50 %u p90 %u p99 %u max %u\n", percentile(result.latencies, 50), percentile(result.latencies, 90), percentile(result.latencies, 99), result.latencies.back());
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * Descriptor parsing benchmark: measures the throughput of parsing (setConfigurationDescriptor with parse=true),
+ * validating (USBConfiguration::validate) and indexing (endpoint lookup by address and findDescriptor for all
+ * interfaces) over the descriptors of the corpus directory. The view phase builds the allocation free
+ * USBConfigurationView of the host mode and does the same lookups. The corpus which is provided is synthetic: the
+ * dumps were composed from the layouts of typical devices. Configurations which do not pass the validation (e.g. quirky
+ * real devices) are reported and skipped.
+ *
+ *   DescriptorParsing [--corpus benchmark/corpus] [--count 1000]
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBHostView.h"
+#include "USBDescriptorCorpus.h"
+#include <chrono>
+
+#ifndef USB_CORPUS_DIR
+#define USB_CORPUS_DIR "corpus"
+#endif
+
+enum Phase {PhaseParse, PhaseValidate, PhaseIndex, PhaseView, PhaseCount};
+static const char* phase_names[] = {"parse", "validate", "index", "view"};
+
+struct Timing {
+    double ns[PhaseCount] = {0};
+};
+
+static double elapsedNs(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// processes one configuration descriptor: returns false if it is not consistent
+static bool process(USBCorpusConfiguration &config, Timing &timing){
+    USBDevice &device = USBDevice::instance();
+    const uint8_t *data = config.data.data();
+    int len = config.data.size();
+    device.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    device.descriptorTotalSize(len);
+    USBConfiguration *cfg = device.setConfigurationDescriptor(data, len, true);
+    timing.ns[PhaseParse] += elapsedNs(start);
+
+    start = std::chrono::steady_clock::now();
+    const char* error = USBConfiguration::validate(data, len);
+    timing.ns[PhaseValidate] += elapsedNs(start);
+    if (error!=nullptr){
+        fprintf(stderr, "%s: %s\n", config.name.c_str(), error);
+        return false;
+    }
+
+    start = std::chrono::steady_clock::now();
+    int found = 0;
+    for (int j=0;j<cfg->usbInterfaceCount();j++){
+        USBInterface *itf = cfg->usbInterface(j);
+        for (int i=0;i<itf->usbEndpointCount();i++){
+            found += cfg->usbEndpoint(itf->usbEndpoint(i).address())!=nullptr;
+        }
+        found += cfg->findDescriptor(TUSB_DESC_INTERFACE, j)!=nullptr;
+    }
+    timing.ns[PhaseIndex] += elapsedNs(start);
+
+    int expected = cfg->usbInterfaceCount();
+    for (int j=0;j<cfg->usbInterfaceCount();j++){
+        expected += cfg->usbInterface(j)->usbEndpointCount();
+    }
+    if (found!=expected){
+        fprintf(stderr, "%s: index lookup failed\n", config.name.c_str());
+        return false;
+    }
+
+    // the validation has been measured separately
+    static USBConfigurationView view;
+    start = std::chrono::steady_clock::now();
+    int view_found = 0;
+    if (view.begin(data, len, false)){
+        for (int j=0;j<view.usbInterfaceCount();j++){
+            const USBInterfaceView *itf = view.usbInterface(j);
+            for (int i=0;i<itf->usbEndpointCount();i++){
+                view_found += view.usbEndpoint(itf->usbEndpoint(i)->address())!=nullptr;
+            }
+            view_found += view.findInterface(itf->descriptor()->bInterfaceClass)!=nullptr;
+        }
+    }
+    timing.ns[PhaseView] += elapsedNs(start);
+    if (view_found!=expected){
+        fprintf(stderr, "%s: view lookup failed\n", config.name.c_str());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = USB_CORPUS_DIR;
+    int count = 1000;
+    for (int j=1;j<argc-1;j+=2){
+        if (strcmp(argv[j],"--corpus")==0){
+            dir = argv[j+1];
+        } else if (strcmp(argv[j],"--count")==0){
+            count = atoi(argv[j+1]);
+        }
+    }
+
+    USBDescriptorCorpus corpus;
+    if (!corpus.load(dir)){
+        printf("could not load the corpus from %s\n", dir);
+        return 1;
+    }
+
+    printf("%-28s %6s", "configuration", "bytes");
+    for (int p=0;p<PhaseCount;p++) printf(" %10s", phase_names[p]);
+    printf("   (ns per descriptor)\n");
+
+    Timing total;
+    double total_bytes = 0;
+    int skipped = 0;
+    for (int j=0;j<corpus.size();j++){
+        // invalid descriptors are not measured
+        const char *error = USBConfiguration::validate(corpus[j].data.data(), corpus[j].data.size());
+        if (error!=nullptr){
+            printf("%-28s %6d skipped: %s\n", corpus[j].name.c_str(), (int)corpus[j].data.size(), error);
+            skipped++;
+            continue;
+        }
+        Timing timing;
+        for (int i=0;i<count;i++){
+            if (!process(corpus[j], timing)){
+                return 1;
+            }
+        }
+        printf("%-28s %6d", corpus[j].name.c_str(), (int)corpus[j].data.size());
+        for (int p=0;p<PhaseCount;p++){
+            printf(" %10.0f", timing.ns[p] / count);
+            total.ns[p] += timing.ns[p];
+        }
+        printf("\n");
+        total_bytes += corpus[j].data.size();
+    }
+    if (total_bytes==0){
+        printf("no valid configuration in %s\n", dir);
+        return 1;
+    }
+    USBDevice::instance().clear();
+
+    double bytes = total_bytes * count;
+    printf("throughput MB/s:");
+    for (int p=0;p<PhaseCount;p++){
+        printf(" %s %.1f", phase_names[p], bytes / total.ns[p] * 1000.0);
+    }
+    printf("\n");
+    if (skipped>0){
+        printf("skipped invalid configurations: %d\n", skipped);
+    }
+    return 0;
+}
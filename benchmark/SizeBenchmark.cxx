@@ -0,0 +1,197 @@
+/**
+ * Code size benchmark: this file is compiled once per device class and descriptor mode so that we can compare the
+ * flash (.text/.rodata) and RAM (.data/.bss + heap) footprint of the different ways to provide the descriptors.
+ *
+ *   SIZE_CLASS: SIZE_CLASS_MIDI, SIZE_CLASS_CDC or SIZE_CLASS_COMPOSITE (CDC + MIDI)
+ *   SIZE_MODE:  SIZE_MODE_NONE      no descriptors at all: baseline for the startup code and the host port
+ *               SIZE_MODE_DYNAMIC   the descriptors are assembled at runtime with the builder API: the CDC interfaces
+ *                                   and endpoints are objects, the class specific and the MIDI descriptors (with
+ *                                   their audio endpoints) are added as raw descriptors
+ *               SIZE_MODE_FINALIZED a constant descriptor is copied and parsed into USBInterface/USBEndpoint objects
+ *               SIZE_MODE_COPIED    the same constant descriptor is only copied to the descriptor buffer (no parsing)
+ *               SIZE_MODE_FLASH     reference: the TinyUSB callbacks return the constant arrays without this library
+ *
+ * The program requests all descriptors like a host during the enumeration and prints the peak heap.
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#define SIZE_MODE_NONE 0
+#define SIZE_MODE_DYNAMIC 1
+#define SIZE_MODE_FINALIZED 2
+#define SIZE_MODE_COPIED 3
+#define SIZE_MODE_FLASH 4
+
+#define SIZE_CLASS_MIDI 1
+#define SIZE_CLASS_CDC 2
+#define SIZE_CLASS_COMPOSITE 3
+
+#ifndef SIZE_MODE
+#define SIZE_MODE SIZE_MODE_DYNAMIC
+#endif
+
+#ifndef SIZE_CLASS
+#define SIZE_CLASS SIZE_CLASS_MIDI
+#endif
+
+#if SIZE_MODE==SIZE_MODE_NONE || SIZE_MODE==SIZE_MODE_FLASH
+#include "tusb.h"
+#else
+#include "USBDescriptor.h"
+#endif
+#include "USBHeapAccounting.h"
+#include <stdio.h>
+
+#if SIZE_CLASS==SIZE_CLASS_MIDI
+#define ITF_NUM_TOTAL 2
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN)
+#define CLASS_DESCRIPTORS TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64)
+#define MIDI_DESCRIPTORS TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64)
+#elif SIZE_CLASS==SIZE_CLASS_CDC
+#define ITF_NUM_TOTAL 2
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN)
+#define CLASS_DESCRIPTORS TUD_CDC_DESCRIPTOR(0, 0, 0x81, 8, 0x01, 0x82, 64)
+#else
+#define ITF_NUM_TOTAL 4
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MIDI_DESC_LEN)
+#define CLASS_DESCRIPTORS TUD_CDC_DESCRIPTOR(0, 0, 0x81, 8, 0x01, 0x82, 64), TUD_MIDI_DESCRIPTOR(2, 0, 0x03, 0x83, 64)
+#define MIDI_DESCRIPTORS TUD_MIDI_DESCRIPTOR(2, 0, 0x03, 0x83, 64)
+#endif
+
+#define STRING_COUNT 4
+
+#if SIZE_MODE==SIZE_MODE_FLASH
+
+static const tusb_desc_device_t desc_device = {
+    sizeof(tusb_desc_device_t), TUSB_DESC_DEVICE, 0x0200, 0x00, 0x00, 0x00, CFG_TUD_ENDPOINT0_SIZE,
+    0xCafe, 0x4020, 0x0100, 0x01, 0x02, 0x03, 0x01
+};
+
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+    CLASS_DESCRIPTORS
+};
+
+static const char* string_desc_arr[] = {nullptr, "TinyUSB", "TinyUSB Device", "123456"};
+static uint16_t desc_str[32];
+
+uint8_t const* tud_descriptor_device_cb(void){
+    return (uint8_t const*) &desc_device;
+}
+
+uint8_t const* tud_descriptor_configuration_cb(uint8_t index){
+    return desc_configuration;
+}
+
+uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid){
+    uint8_t chr_count;
+    if (index==0){
+        desc_str[1] = 0x0409;
+        chr_count = 1;
+    } else {
+        if (index>=STRING_COUNT) return nullptr;
+        const char* str = string_desc_arr[index];
+        chr_count = strlen(str);
+        if (chr_count>31) chr_count = 31;
+        for (uint8_t i=0; i<chr_count; i++){
+            desc_str[1+i] = str[i];
+        }
+    }
+    desc_str[0] = (TUSB_DESC_STRING << 8) | (2*chr_count + 2);
+    return desc_str;
+}
+
+#elif SIZE_MODE!=SIZE_MODE_NONE
+
+#if SIZE_MODE==SIZE_MODE_FINALIZED || SIZE_MODE==SIZE_MODE_COPIED
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+    CLASS_DESCRIPTORS
+};
+#endif
+
+// defines the device with the API of USBDescriptor.h
+#if SIZE_MODE==SIZE_MODE_DYNAMIC && SIZE_CLASS!=SIZE_CLASS_MIDI
+// the CDC function of CLASS_DESCRIPTORS built with the objects: the builder assigns the same endpoint numbers
+static void buildCdc(USBConfiguration *config) {
+    config->addDescriptor(8, TUSB_DESC_INTERFACE_ASSOCIATION, 0, 2, TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL, CDC_COMM_PROTOCOL_NONE, 0);
+    USBInterface *comm = config->createInterface();
+    comm->bInterfaceClass(TUSB_CLASS_CDC).bInterfaceSubClass(CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL).bInterfaceProtocol(CDC_COMM_PROTOCOL_NONE);
+    config->addDescriptor(5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_HEADER, 0x20, 0x01);
+    config->addDescriptor(5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_CALL_MANAGEMENT, 0, 1);
+    config->addDescriptor(4, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_ABSTRACT_CONTROL_MANAGEMENT, 2);
+    config->addDescriptor(5, TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_UNION, 0, 1);
+    comm->createEndpoint(true, Interrupt).wMaxPacketSize(8).bInterval(16);
+    USBInterface *data = config->createInterface();
+    data->bInterfaceClass(TUSB_CLASS_CDC_DATA);
+    data->createEndpoint(false, Bulk).wMaxPacketSize(64).bInterval(0);
+    data->createEndpoint(true, Bulk).wMaxPacketSize(64).bInterval(0);
+}
+#endif
+
+static void setupDevice() {
+    USBDevice &device = USBDevice::instance();
+    device.descriptorTotalSize(CONFIG_TOTAL_LEN);
+    device.idVendor(0xCafe).idProduct(0x4020).bcdDevice(0x0100).manufacturer("TinyUSB").product("TinyUSB Device").serialNumber("123456");
+#if SIZE_MODE==SIZE_MODE_DYNAMIC
+    USBConfiguration *config = device.createConfiguration();
+    config->bmAttributes(TU_BIT(7) | TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP).bMaxPower(100);
+#if SIZE_CLASS!=SIZE_CLASS_MIDI
+    buildCdc(config);
+#endif
+#if SIZE_CLASS!=SIZE_CLASS_CDC
+    config->addDescriptor(MIDI_DESCRIPTORS);
+    config->bNumInterfaces(ITF_NUM_TOTAL);
+#endif
+#elif SIZE_MODE==SIZE_MODE_FINALIZED
+    device.setConfigurationDescriptor(desc_configuration, sizeof(desc_configuration), true);
+#else
+    device.setConfigurationDescriptor(desc_configuration, sizeof(desc_configuration), false);
+#endif
+}
+
+uint8_t const* tud_descriptor_device_cb(void){
+    return (uint8_t const*) USBDevice::instance().deviceDescriptor();
+}
+
+uint8_t const* tud_descriptor_configuration_cb(uint8_t index){
+    return USBDevice::instance().configurationDescriptor(index);
+}
+
+uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid){
+    if (index>=STRING_COUNT) return nullptr;
+    return USBDevice::instance().string(index);
+}
+
+#endif
+
+int main() {
+    USBHeapAccounting &heap = USBHeapAccounting::instance();
+    heap.resetPeak();
+    size_t heap_start = heap.current();
+    size_t allocations_start = heap.allocations();
+    uint32_t checksum = 0;
+#if SIZE_MODE!=SIZE_MODE_NONE
+#if SIZE_MODE!=SIZE_MODE_FLASH
+    setupDevice();
+#endif
+    // requests the descriptors in the order of an enumeration
+    const uint8_t *device = tud_descriptor_device_cb();
+    const uint8_t *config = tud_descriptor_configuration_cb(0);
+    int config_len = config[2] | (config[3] << 8);
+    for (int j=0;j<device[0];j++) checksum += device[j];
+    for (int j=0;j<config_len;j++) checksum += config[j];
+    for (int idx=0; idx<STRING_COUNT; idx++){
+        const uint8_t *str = (const uint8_t*) tud_descriptor_string_cb(idx, 0x0409);
+        for (int j=0;j<str[0];j++) checksum += str[j];
+    }
+    if (config_len!=CONFIG_TOTAL_LEN){
+        printf("invalid configuration descriptor length: %d\n", config_len);
+        return 1;
+    }
+#endif
+    printf("checksum: %u\n", (unsigned) checksum);
+    printf("peak heap: %u\n", (unsigned) (heap.peak() - heap_start));
+    printf("allocations: %u\n", (unsigned) (heap.allocations() - allocations_start));
+    return 0;
+}
@@ -0,0 +1,95 @@
+# Reports the section sizes and the peak heap of the size benchmark executables
+#
+#   cmake -DSIZE_TOOL=size -DSIZE_BENCHMARKS="class/mode=path|..." [-DSIZE_RUN=OFF] [-DSIZE_REPORT=report.csv] -P SizeReport.cmake
+#
+# The sizes are also reported as difference to the class/none baseline. All modes of a device class must provide
+# identical descriptors: otherwise the script fails. With SIZE_RUN=OFF (cross toolchain) the executables are not
+# run, so the heap and the descriptor check are not available.
+
+function(pad text width result)
+    string(LENGTH "${text}" len)
+    while(len LESS width)
+        string(APPEND text " ")
+        math(EXPR len "${len} + 1")
+    endwhile()
+    set(${result} "${text}" PARENT_SCOPE)
+endfunction()
+
+function(section_size output section result)
+    if (output MATCHES "\n\\${section}[ \t]+([0-9]+)")
+        set(${result} ${CMAKE_MATCH_1} PARENT_SCOPE)
+    else()
+        set(${result} 0 PARENT_SCOPE)
+    endif()
+endfunction()
+
+string(REPLACE "|" ";" SIZE_BENCHMARKS "${SIZE_BENCHMARKS}")
+set(sections .text .rodata .data .bss)
+set(csv "benchmark,text,rodata,data,bss,heap,allocations\n")
+set(table "")
+foreach(entry ${SIZE_BENCHMARKS})
+    string(REGEX MATCH "^([^=]+)=(.*)$" match ${entry})
+    set(name ${CMAKE_MATCH_1})
+    set(path ${CMAKE_MATCH_2})
+    string(REGEX MATCH "^[^/]+" class ${name})
+
+    execute_process(COMMAND ${SIZE_TOOL} -A ${path} OUTPUT_VARIABLE size_output RESULT_VARIABLE rc)
+    if (NOT rc EQUAL 0)
+        message(FATAL_ERROR "${SIZE_TOOL} failed for ${path}")
+    endif()
+    if (NOT DEFINED SIZE_RUN OR SIZE_RUN)
+        execute_process(COMMAND ${path} OUTPUT_VARIABLE run_output RESULT_VARIABLE rc)
+        if (NOT rc EQUAL 0)
+            message(FATAL_ERROR "${name} failed: ${run_output}")
+        endif()
+        string(REGEX MATCH "peak heap: ([0-9]+)" match "${run_output}")
+        set(heap ${CMAKE_MATCH_1})
+        string(REGEX MATCH "allocations: ([0-9]+)" match "${run_output}")
+        set(allocations ${CMAKE_MATCH_1})
+        string(REGEX MATCH "checksum: ([0-9]+)" match "${run_output}")
+        set(checksum ${CMAKE_MATCH_1})
+    else()
+        set(heap "-")
+        set(allocations "-")
+        set(checksum "")
+    endif()
+
+    # all modes of a class must provide the same descriptors
+    if (NOT name MATCHES "/none$" AND NOT checksum STREQUAL "")
+        if (DEFINED checksum_${class} AND NOT checksum_${class} EQUAL checksum)
+            message(FATAL_ERROR "${name} provides different descriptors than the other ${class} devices")
+        endif()
+        set(checksum_${class} ${checksum})
+    endif()
+
+    set(values "")
+    foreach(section ${sections})
+        section_size("${size_output}" ${section} value)
+        list(APPEND values ${value})
+    endforeach()
+    if (name MATCHES "/none$")
+        set(baseline ${values})
+    endif()
+
+    pad("${name}" 24 line)
+    set(idx 0)
+    foreach(value ${values})
+        list(GET baseline ${idx} base)
+        math(EXPR delta "${value} - ${base}")
+        pad("${value} (+${delta})" 18 column)
+        string(APPEND line "${column}")
+        math(EXPR idx "${idx} + 1")
+    endforeach()
+    pad("${heap}" 8 column)
+    string(APPEND line "${column}${allocations}")
+    string(APPEND table "${line}\n")
+    string(REPLACE ";" "," values_csv "${values}")
+    string(APPEND csv "${name},${values_csv},${heap},${allocations}\n")
+endforeach()
+
+message("benchmark               .text             .rodata           .data             .bss              heap    allocations")
+message("${table}")
+if (SIZE_REPORT)
+    file(WRITE ${SIZE_REPORT} "${csv}")
+    message("report: ${SIZE_REPORT}")
+endif()
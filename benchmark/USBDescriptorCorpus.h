@@ -0,0 +1,106 @@
+/**
+ * Loads the descriptor corpus: each file contains the binary dump of a device in the format of
+ * /sys/bus/usb/devices/<device>/descriptors - the device descriptor followed by all configuration descriptors.
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#pragma once
+#include "tusb.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct USBCorpusConfiguration {
+    std::string name;           // file name and configuration index e.g. webcam.bin#1
+    std::vector<uint8_t> data;  // configuration descriptor with all dependent descriptors
+};
+
+class USBDescriptorCorpus {
+    public:
+        // loads all *.bin files of the directory: files which are not a valid dump are skipped; returns false if
+        // there is no configuration
+        bool load(const char *dir){
+            DIR *d = opendir(dir);
+            if (d==nullptr){
+                return false;
+            }
+            std::vector<std::string> files;
+            struct dirent *entry;
+            while((entry = readdir(d))!=nullptr){
+                std::string name = entry->d_name;
+                if (name.size()>4 && name.compare(name.size()-4, 4, ".bin")==0){
+                    files.push_back(name);
+                }
+            }
+            closedir(d);
+            // we want a stable order
+            std::sort(files.begin(), files.end());
+            for (std::string &name : files){
+                // a broken file must not stop the benchmark
+                if (!loadFile(std::string(dir) + "/" + name, name)){
+                    fprintf(stderr, "invalid descriptor dump skipped: %s\n", name.c_str());
+                }
+            }
+            return !configs.empty();
+        }
+
+        int size() {
+            return configs.size();
+        }
+
+        USBCorpusConfiguration &operator[](int idx){
+            return configs[idx];
+        }
+
+        // total size of all configuration descriptors in bytes
+        size_t totalBytes() {
+            size_t result = 0;
+            for (USBCorpusConfiguration &c : configs){
+                result += c.data.size();
+            }
+            return result;
+        }
+
+    protected:
+        std::vector<USBCorpusConfiguration> configs;
+
+        bool loadFile(const std::string &path, const std::string &name){
+            FILE *f = fopen(path.c_str(), "rb");
+            if (f==nullptr){
+                return false;
+            }
+            std::vector<uint8_t> data;
+            uint8_t buffer[512];
+            size_t len;
+            while((len = fread(buffer, 1, sizeof(buffer), f))>0){
+                data.insert(data.end(), buffer, buffer+len);
+            }
+            fclose(f);
+            if (data.size()<sizeof(tusb_desc_device_t) || data[1]!=TUSB_DESC_DEVICE){
+                return false;
+            }
+            // split the configurations with the help of wTotalLength
+            size_t pos = data[0];
+            int idx = 1;
+            std::vector<USBCorpusConfiguration> result;
+            while(pos + sizeof(tusb_desc_configuration_t) <= data.size()){
+                size_t total = data[pos+2] | (data[pos+3] << 8);
+                if (data[pos+1]!=TUSB_DESC_CONFIGURATION || total<sizeof(tusb_desc_configuration_t) || pos+total>data.size()){
+                    return false;
+                }
+                USBCorpusConfiguration config;
+                config.name = name + "#" + std::to_string(idx++);
+                config.data.assign(data.begin()+pos, data.begin()+pos+total);
+                result.push_back(config);
+                pos += total;
+            }
+            if (pos!=data.size()){
+                return false;
+            }
+            configs.insert(configs.end(), result.begin(), result.end());
+            return true;
+        }
+};
@@ -0,0 +1,114 @@
+/**
+ * Minimal blocking USB/IP client which is used by the benchmarks to act as the host of a USBIPServer.
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#pragma once
+#include "USBIPServer.h"
+
+class USBIPClient {
+    public:
+        ~USBIPClient() {
+            end();
+        }
+
+        // connects to the server on localhost and imports the device
+        bool begin(uint16_t port){
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(port);
+            if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))!=0){
+                return false;
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            uint8_t req[40] = {0x01, 0x11, 0x80, 0x03};
+            strcpy((char*)req+8, USBIP_BUS_ID);
+            uint8_t reply[8];
+            USBIPDeviceInfo info;
+            return writeAll(req, sizeof(req)) && readAll(reply, sizeof(reply)) && reply[7]==0 && readAll(&info, sizeof(info));
+        }
+
+        void end() {
+            if (fd>=0){
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        // submits an URB: the OUT data is sent together with the header
+        bool submit(uint32_t seqnum, uint8_t ep_num, bool in, int len, const uint8_t *data=nullptr, const uint8_t setup[8]=nullptr){
+            USBIPHeader cmd;
+            memset(&cmd, 0, sizeof(cmd));
+            cmd.command = htonl(USBIP_CMD_SUBMIT);
+            cmd.seqnum = htonl(seqnum);
+            cmd.direction = htonl(in ? 1 : 0);
+            cmd.ep = htonl(ep_num);
+            cmd.submit.transfer_buffer_length = htonl(len);
+            if (setup!=nullptr){
+                memcpy(cmd.submit.setup, setup, 8);
+            }
+            if (!writeAll(&cmd, sizeof(cmd))){
+                return false;
+            }
+            return in || len==0 || writeAll(data, len);
+        }
+
+        // waits for the header of the next RET_SUBMIT: for IN URBs the data needs to be read with receiveData()
+        bool receive(uint32_t &seqnum, int32_t &status, int32_t &actual_length){
+            USBIPHeader ret;
+            if (!readAll(&ret, sizeof(ret))){
+                return false;
+            }
+            seqnum = ntohl(ret.seqnum);
+            status = ntohl(ret.ret_submit.status);
+            actual_length = ntohl(ret.ret_submit.actual_length);
+            return true;
+        }
+
+        // reads the data of an IN URB
+        bool receiveData(uint8_t *data, int32_t len){
+            return len==0 || readAll(data, len);
+        }
+
+        // standard control request without data stage
+        bool control(uint32_t seqnum, uint8_t request, uint16_t value){
+            const uint8_t setup[8] = {0x00, request, (uint8_t)(value & 0xff), (uint8_t)(value >> 8), 0, 0, 0, 0};
+            int32_t status, len;
+            uint32_t ret_seqnum;
+            return submit(seqnum, 0, false, 0, nullptr, setup) && receive(ret_seqnum, status, len) && status==0;
+        }
+
+    protected:
+        int fd = -1;
+
+        bool readAll(void *data, int len){
+            uint8_t *ptr = (uint8_t*) data;
+            while(len>0){
+                int n = recv(fd, ptr, len, 0);
+                if (n<=0){
+                    return false;
+                }
+                ptr += n;
+                len -= n;
+            }
+            return true;
+        }
+
+        bool writeAll(const void *data, int len){
+            const uint8_t *ptr = (const uint8_t*) data;
+            while(len>0){
+                int n = send(fd, ptr, len, MSG_NOSIGNAL);
+                if (n<=0){
+                    return false;
+                }
+                ptr += n;
+                len -= n;
+            }
+            return true;
+        }
+};
@@ -0,0 +1,22 @@
+/**
+ * TinyUSB configuration of the code size benchmark for the tinyusb platform (e.g. RP2040 full speed device)
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#pragma once
+
+//--------------------------------------------------------------------
+// DEVICE CONFIGURATION
+//--------------------------------------------------------------------
+#define CFG_TUSB_RHPORT0_MODE      (OPT_MODE_DEVICE | OPT_MODE_FULL_SPEED)
+#define CFG_TUD_ENDPOINT0_SIZE    64
+
+//------------- CLASS -------------//
+#define CFG_TUD_CDC               1
+#define CFG_TUD_MIDI              1
+
+#define CFG_TUD_CDC_RX_BUFSIZE    64
+#define CFG_TUD_CDC_TX_BUFSIZE    64
+#define CFG_TUD_MIDI_RX_BUFSIZE   64
+#define CFG_TUD_MIDI_TX_BUFSIZE   64
@@ -0,0 +1,192 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Bulk throughput benchmark function: a vendor interface with one bulk OUT and one bulk IN endpoint.
+ * \li BenchmarkSource: the device sends transfers with a counting pattern on the IN endpoint
+ * \li BenchmarkSink: the device receives and discards the transfers on the OUT endpoint
+ * \li BenchmarkLoopback: the received OUT transfers are sent back on the IN endpoint
+ *
+ * The device keeps queue_depth buffers of transfer_size bytes, so that in loopback mode the next OUT transfer can
+ * be received while the last one is still sent back. The completed transfers need to be reported with
+ * transferCompleted(): e.g. from the USBStubDCD transfer callback or from the xfer_cb of your TinyUSB class driver.
+ * See benchmark/BulkThroughput.cxx for the host side harness.
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+
+enum USBBenchmarkMode {BenchmarkSource, BenchmarkSink, BenchmarkLoopback};
+
+/**
+ * @brief Parameters of the benchmark
+ */
+struct USBBulkBenchmarkConfig {
+    USBBenchmarkMode mode = BenchmarkLoopback;
+    uint16_t packet_size = 64;
+    uint16_t transfer_size = 4096;
+    uint8_t queue_depth = 2;
+    uint8_t itf_num = 0;
+    uint8_t ep_out = 0x01;
+    uint8_t ep_in = 0x81;
+};
+
+/**
+ * @brief Device side of the bulk throughput benchmark
+ */
+class USBBulkBenchmark {
+    public:
+        USBBulkBenchmark(USBBulkBenchmarkConfig cfg = USBBulkBenchmarkConfig()){
+            this->cfg = cfg;
+            if (this->cfg.queue_depth==0){
+                this->cfg.queue_depth = 1;
+            }
+            buffers = new uint8_t*[this->cfg.queue_depth];
+            lengths = new uint16_t[this->cfg.queue_depth];
+            for (int j=0;j<this->cfg.queue_depth;j++){
+                buffers[j] = new uint8_t[this->cfg.transfer_size];
+                lengths[j] = 0;
+            }
+        }
+
+        ~USBBulkBenchmark() {
+            for (int j=0;j<cfg.queue_depth;j++){
+                delete[] buffers[j];
+            }
+            delete[] buffers;
+            delete[] lengths;
+        }
+
+        // defines the vendor interface as configuration of the device
+        USBConfiguration* begin(USBDevice &device = USBDevice::instance()){
+            uint8_t desc[] = {TUD_CONFIG_DESCRIPTOR(1, 1, 0, TUD_CONFIG_DESC_LEN + TUD_VENDOR_DESC_LEN, 0, 100),
+                TUD_VENDOR_DESCRIPTOR(cfg.itf_num, 0, cfg.ep_out, cfg.ep_in, cfg.packet_size)};
+            config = device.setConfigurationDescriptor(desc, sizeof(desc), true);
+            out_ep = config->usbEndpoint(cfg.ep_out);
+            in_ep = config->usbEndpoint(cfg.ep_in);
+            return config;
+        }
+
+        // starts the first transfers: call this when the device has been configured
+        void start() {
+            rx_idx = tx_idx = pending = 0;
+            out_active = in_active = false;
+            bytes_received = bytes_sent = 0;
+            if (cfg.mode==BenchmarkSource){
+                for (int j=0;j<cfg.queue_depth;j++){
+                    for (int i=0;i<cfg.transfer_size;i++){
+                        buffers[j][i] = i + j;
+                    }
+                    lengths[j] = cfg.transfer_size;
+                }
+                pending = cfg.queue_depth;
+            }
+            armIn();
+            armOut();
+        }
+
+        // needs to be called when a transfer on one of our endpoints has been completed
+        void transferCompleted(uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+            if (config!=nullptr){
+                config->transferCompleted(ep_addr, result, xferred_bytes);
+            }
+            if (ep_addr==cfg.ep_out && out_active){
+                out_active = false;
+                if (result==XFER_RESULT_SUCCESS){
+                    bytes_received += xferred_bytes;
+                    if (cfg.mode==BenchmarkLoopback){
+                        lengths[rx_idx] = xferred_bytes;
+                        rx_idx = (rx_idx + 1) % cfg.queue_depth;
+                        pending++;
+                    }
+                }
+            } else if (ep_addr==cfg.ep_in && in_active){
+                in_active = false;
+                if (result==XFER_RESULT_SUCCESS){
+                    bytes_sent += xferred_bytes;
+                    tx_idx = (tx_idx + 1) % cfg.queue_depth;
+                    // the source sends the same buffers over and over again
+                    if (cfg.mode==BenchmarkLoopback){
+                        pending--;
+                    }
+                }
+            }
+            armIn();
+            armOut();
+        }
+
+        uint64_t bytesReceived() {
+            return bytes_received;
+        }
+
+        uint64_t bytesSent() {
+            return bytes_sent;
+        }
+
+        USBEndpoint *outEndpoint() {
+            return out_ep;
+        }
+
+        USBEndpoint *inEndpoint() {
+            return in_ep;
+        }
+
+        USBBulkBenchmarkConfig &settings() {
+            return cfg;
+        }
+
+    protected:
+        USBBulkBenchmarkConfig cfg;
+        USBConfiguration *config = nullptr;
+        USBEndpoint *out_ep = nullptr;
+        USBEndpoint *in_ep = nullptr;
+        uint8_t **buffers;
+        uint16_t *lengths;
+        int rx_idx = 0;
+        int tx_idx = 0;
+        int pending = 0;
+        bool out_active = false;
+        bool in_active = false;
+        uint64_t bytes_received = 0;
+        uint64_t bytes_sent = 0;
+
+        void armOut() {
+            if (cfg.mode==BenchmarkSource || out_active || out_ep==nullptr){
+                return;
+            }
+            int idx = cfg.mode==BenchmarkLoopback ? rx_idx : 0;
+            if (cfg.mode==BenchmarkLoopback && pending>=cfg.queue_depth){
+                return;
+            }
+            out_active = out_ep->xfer(buffers[idx], cfg.transfer_size);
+        }
+
+        void armIn() {
+            if (cfg.mode==BenchmarkSink || in_active || in_ep==nullptr || pending==0){
+                return;
+            }
+            in_active = in_ep->xfer(buffers[tx_idx], lengths[tx_idx]);
+        }
+};
@@ -0,0 +1,63 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Microsecond time stamps for the tracing and measurements. You can provide your own
+ * clock by defining USB_CLOCK_MICROS() e.g. with a DWT cycle counter.
+ */
+
+#pragma once
+#include <stdint.h>
+
+#if defined(USB_CLOCK_MICROS)
+// user defined clock
+#elif defined(__linux__) || defined(TINYUSB_CPP_HOST_PORT)
+#include <time.h>
+#elif defined(LIB_PICO_TIME)
+#include "pico/time.h"
+#elif defined(ARDUINO)
+#include "Arduino.h"
+#endif
+
+class USBClock {
+    public:
+        // current time in microseconds
+        static uint64_t micros() {
+#if defined(USB_CLOCK_MICROS)
+            return USB_CLOCK_MICROS();
+#elif defined(__linux__) || defined(TINYUSB_CPP_HOST_PORT)
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+#elif defined(LIB_PICO_TIME)
+            return time_us_64();
+#elif defined(ARDUINO)
+            return ::micros();
+#else
+            // no clock available: define USB_CLOCK_MICROS()
+            return 0;
+#endif
+        }
+};
@@ -0,0 +1,356 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief C++20 coroutines for the endpoint transfers: a class function can be written as a linear sequence of
+ * transfers instead of a state machine in the transfer callbacks.
+ *
+ *   USBTask echo(USBEndpoint &out, USBEndpoint &in) {
+ *     uint8_t buffer[64];
+ *     while(true){
+ *       USBTransferResult r = co_await out.read(buffer);
+ *       co_await in.write(std::span<const uint8_t>(buffer, r.bytes));
+ *     }
+ *   }
+ *
+ *   USBExecutor::instance().spawn(echo(out, in));
+ *   while(true) USBExecutor::instance().task();   // tud_task() + resume the coroutines
+ *
+ * The transfers are submitted with USBEndpoint::xfer() directly from and into the provided buffers. The completion
+ * is reported with USBEndpoint::completed() (e.g. via USBDevice::transferCompletedCb) in tud_task(), which makes
+ * the coroutine ready: it is resumed by the single threaded USBExecutor. The coroutine frames are allocated from a
+ * fixed pool of USB_COROUTINE_FRAMES frames with USB_COROUTINE_FRAME_SIZE bytes, so there is no heap allocation.
+ *
+ * This file is included by USBDescriptor.h if the compiler supports coroutines (-std=c++20).
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+#include <coroutine>
+#include <stddef.h>
+
+// number of coroutines which can exist at the same time
+#ifndef USB_COROUTINE_FRAMES
+#define USB_COROUTINE_FRAMES 4
+#endif
+
+// maximum size of a coroutine frame (local variables which are used across co_await are stored in the frame)
+#ifndef USB_COROUTINE_FRAME_SIZE
+#define USB_COROUTINE_FRAME_SIZE 512
+#endif
+
+// maximum number of coroutines which are ready to be resumed
+#ifndef USB_EXECUTOR_QUEUE_SIZE
+#define USB_EXECUTOR_QUEUE_SIZE 16
+#endif
+
+// a coroutine is queued at most once: so a completed transfer can always be queued
+static_assert(USB_COROUTINE_FRAMES <= USB_EXECUTOR_QUEUE_SIZE, "USB_EXECUTOR_QUEUE_SIZE must not be smaller than USB_COROUTINE_FRAMES");
+
+/**
+ * @brief Fixed pool for the coroutine frames
+ */
+class USBCoroutinePool {
+    public:
+        static USBCoroutinePool &instance() {
+            static USBCoroutinePool inst;
+            return inst;
+        }
+
+        // provides a free frame: nullptr if the frame is too big or if all frames are used
+        void *allocate(size_t size){
+            if (size>USB_COROUTINE_FRAME_SIZE){
+                failed_count++;
+                return nullptr;
+            }
+            for (int j=0;j<USB_COROUTINE_FRAMES;j++){
+                if (!used[j]){
+                    used[j] = true;
+                    return frames[j].data;
+                }
+            }
+            failed_count++;
+            return nullptr;
+        }
+
+        void release(void *ptr){
+            for (int j=0;j<USB_COROUTINE_FRAMES;j++){
+                if (frames[j].data==ptr){
+                    used[j] = false;
+                }
+            }
+        }
+
+        // number of frames in use
+        int usedCount() {
+            int result = 0;
+            for (int j=0;j<USB_COROUTINE_FRAMES;j++){
+                result += used[j];
+            }
+            return result;
+        }
+
+        // number of allocations which could not be served
+        int failedCount() {
+            return failed_count;
+        }
+
+    protected:
+        struct Frame {
+            alignas(max_align_t) uint8_t data[USB_COROUTINE_FRAME_SIZE];
+        };
+        Frame frames[USB_COROUTINE_FRAMES];
+        bool used[USB_COROUTINE_FRAMES] = {false};
+        int failed_count = 0;
+
+        USBCoroutinePool() = default;
+};
+
+/**
+ * @brief Coroutine which is started and owned by the USBExecutor: the frame is released when it has finished
+ */
+class USBTask {
+    public:
+        struct promise_type {
+            USBTask get_return_object() {
+                return USBTask(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            // no frame available: the USBTask is not valid
+            static USBTask get_return_object_on_allocation_failure() {
+                return USBTask();
+            }
+
+            // the executor starts the coroutine
+            std::suspend_always initial_suspend() noexcept {
+                return {};
+            }
+
+            // the executor releases the frame
+            std::suspend_always final_suspend() noexcept {
+                return {};
+            }
+
+            void return_void() {}
+
+            void unhandled_exception() {}
+
+            static void *operator new(size_t size) noexcept {
+                return USBCoroutinePool::instance().allocate(size);
+            }
+
+            static void operator delete(void *ptr){
+                USBCoroutinePool::instance().release(ptr);
+            }
+        };
+
+        USBTask() = default;
+
+        USBTask(USBTask &&other) : handle(other.handle) {
+            other.handle = nullptr;
+        }
+
+        USBTask(const USBTask&) = delete;
+        USBTask &operator=(const USBTask&) = delete;
+
+        // a task which has not been spawned is released
+        ~USBTask() {
+            if (handle) handle.destroy();
+        }
+
+        // false if there was no frame available
+        explicit operator bool() const {
+            return (bool) handle;
+        }
+
+        // the ownership is passed to the caller (the executor)
+        std::coroutine_handle<> release() {
+            std::coroutine_handle<> result = handle;
+            handle = nullptr;
+            return result;
+        }
+
+    protected:
+        std::coroutine_handle<promise_type> handle;
+
+        explicit USBTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+};
+
+/**
+ * @brief Single threaded executor which resumes the coroutines which are ready: call task() or tud_task() and run()
+ * in your main loop
+ */
+class USBExecutor {
+    public:
+        static USBExecutor &instance() {
+            static USBExecutor inst;
+            return inst;
+        }
+
+        // starts the coroutine with the next run(): returns false if it could not be created or queued
+        bool spawn(USBTask task){
+            if (!task){
+                return false;
+            }
+            std::coroutine_handle<> h = task.release();
+            if (!schedule(h)){
+                h.destroy();
+                return false;
+            }
+            active_count++;
+            return true;
+        }
+
+        // marks the coroutine as ready
+        bool schedule(std::coroutine_handle<> h){
+            if (ready_count>=USB_EXECUTOR_QUEUE_SIZE){
+                return false;
+            }
+            ready[(ready_start + ready_count) % USB_EXECUTOR_QUEUE_SIZE] = h;
+            ready_count++;
+            return true;
+        }
+
+        // resumes the coroutines which were ready when it was called: returns their number
+        int run() {
+            int count = ready_count;
+            for (int j=0;j<count;j++){
+                std::coroutine_handle<> h = ready[ready_start];
+                ready_start = (ready_start + 1) % USB_EXECUTOR_QUEUE_SIZE;
+                ready_count--;
+                h.resume();
+                if (h.done()){
+                    h.destroy();
+                    active_count--;
+                }
+            }
+            return count;
+        }
+
+        // processes the USB events and resumes the coroutines of the completed transfers
+        int task() {
+            tud_task();
+            return run();
+        }
+
+        // number of coroutines which have not finished yet
+        int activeCount() {
+            return active_count;
+        }
+
+        // number of coroutines which are ready to be resumed
+        int readyCount() {
+            return ready_count;
+        }
+
+        // awaitable which resumes the coroutine in the next run(): co_await USBExecutor::instance().yield()
+        auto yield() {
+            struct Yield {
+                bool await_ready() { return false; }
+                bool await_suspend(std::coroutine_handle<> h) { return USBExecutor::instance().schedule(h); }
+                void await_resume() {}
+            };
+            return Yield();
+        }
+
+    protected:
+        std::coroutine_handle<> ready[USB_EXECUTOR_QUEUE_SIZE];
+        int ready_start = 0;
+        int ready_count = 0;
+        int active_count = 0;
+
+        USBExecutor() = default;
+};
+
+/**
+ * @brief Result of an awaited transfer
+ */
+struct USBTransferResult {
+    xfer_result_t result;
+    uint32_t bytes;
+
+    bool ok() {
+        return result==XFER_RESULT_SUCCESS;
+    }
+};
+
+/**
+ * @brief Submits the transfer when the coroutine is suspended and resumes it when the endpoint reports the completion
+ */
+class USBTransferAwaitable {
+    public:
+        // a transfer is limited to 65535 bytes: a longer buffer fails without being submitted
+        USBTransferAwaitable(USBEndpoint *ep, uint8_t *buffer, size_t len) : ep(ep), buffer(buffer), len(len) {
+            if (len>0xffff){
+                result.result = XFER_RESULT_FAILED;
+            }
+        }
+
+        // continues immediately with the error if the length is not valid
+        bool await_ready() {
+            return result.result!=XFER_RESULT_SUCCESS;
+        }
+
+        // returns false (continue without suspension) if the transfer could not be submitted
+        bool await_suspend(std::coroutine_handle<> h){
+            handle = h;
+            ep->setTransferListener(completed, this);
+            if (!ep->xfer(buffer, (uint16_t) len)){
+                ep->setTransferListener(nullptr);
+                result.result = XFER_RESULT_FAILED;
+                return false;
+            }
+            return true;
+        }
+
+        USBTransferResult await_resume() {
+            return result;
+        }
+
+    protected:
+        USBEndpoint *ep;
+        uint8_t *buffer;
+        size_t len;
+        std::coroutine_handle<> handle;
+        USBTransferResult result = {XFER_RESULT_SUCCESS, 0};
+
+        static void completed(void *ref, xfer_result_t xfer_result, uint32_t xferred_bytes){
+            USBTransferAwaitable *self = (USBTransferAwaitable*) ref;
+            self->result.result = xfer_result;
+            self->result.bytes = xferred_bytes;
+            // can not fail because of the static_assert on the queue size
+            bool queued = USBExecutor::instance().schedule(self->handle);
+            (void) queued;
+        }
+};
+
+inline USBTransferAwaitable USBEndpoint::read(std::span<uint8_t> data){
+    return USBTransferAwaitable(this, data.data(), data.size());
+}
+
+inline USBTransferAwaitable USBEndpoint::write(std::span<const uint8_t> data){
+    // the data is only read by the controller
+    return USBTransferAwaitable(this, const_cast<uint8_t*>(data.data()), data.size());
+}
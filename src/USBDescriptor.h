@@ -44,7 +44,15 @@
 
 #pragma once
 #include "tusb.h"
-#include <stdarg.h>
+#include "USBTrace.h"
+#include "USBLatency.h"
+#include "USBProfile.h"
+#include "USBTimeline.h"
+#include "USBHash.h"
+#include <atomic>
+#if defined(__cpp_impl_coroutine)
+#include <span>
+#endif
 
 /**
  * @brief Constants
@@ -52,6 +60,21 @@
  */
 #define DEFAULT_LANGUAGE  0x0409
 
+// number of device controllers (rhport) which can present their own device
+#ifndef USB_PORT_COUNT
+#define USB_PORT_COUNT 2
+#endif
+
+// rhport argument which selects the port of the descriptor object
+#define USB_PORT_OWN 0xff
+
+// one-shot notification about the next completed transfer of an endpoint
+typedef void (*USBTransferListener)(void *ref, xfer_result_t result, uint32_t xferred_bytes);
+
+#if defined(__cpp_impl_coroutine)
+class USBTransferAwaitable;
+#endif
+
 // forward declarations  USBDevice -> USBConfiguration -> USBInterface -> USBEndpoint
 class USBConfiguration;
 class USBDevice;
@@ -84,8 +107,26 @@ class Vector {
             grow(initial_size);
         }
 
+        Vector(const Vector &other){
+            copyFrom(other);
+        }
+
+        Vector &operator=(const Vector &other){
+            if (this!=&other){
+                delete[] data_;
+                data_ = nullptr;
+                max_size = 0;
+                copyFrom(other);
+            }
+            return *this;
+        }
+
+        ~Vector() {
+            delete[] data_;
+        }
+
         void append(T value){
-            if (grow(actual_size)){
+            if (grow(actual_size+1)){
                 data_[actual_size] = value;
                 actual_size++;
             }
@@ -114,6 +155,17 @@ class Vector {
             actual_size = 0;
         }
 
+        // removes the entry at the indicated position: the following entries are moved up
+        void remove(int index){
+            if (index<0 || index>=actual_size){
+                return;
+            }
+            for (int j=index;j<actual_size-1;j++){
+                data_[j] = data_[j+1];
+            }
+            actual_size--;
+        }
+
         bool resize(int newSize){
             return grow(newSize);
         }
@@ -129,12 +181,28 @@ class Vector {
         T *data_ = nullptr;
         T empty;
 
+        void copyFrom(const Vector &other){
+            empty = other.empty;
+            increment_by = other.increment_by;
+            actual_size = 0;
+            if (grow(other.max_size)){
+                for (int j=0;j<other.actual_size;j++){
+                    data_[j] = other.data_[j];
+                }
+                actual_size = other.actual_size;
+            }
+        }
+
         bool grow(int newSize){
             bool result = true;
             if (newSize>max_size) {
                 int newSizeCalculated  = newSize;
                 if (increment_by>0){
                     newSizeCalculated = ((newSize / increment_by)+1) * increment_by;
+                    // grow geometrically so that appending stays O(1) on average
+                    if (max_size>0 && newSizeCalculated < 2 * max_size){
+                        newSizeCalculated = 2 * max_size;
+                    }
                 }
                 T* new_data = new T[newSizeCalculated];
                 if (data_!=nullptr && new_data!=nullptr) {
@@ -155,16 +223,48 @@ class Vector {
         }
 };
 
+// Options for the size optimized emission of a configuration descriptor
+enum USBEmitOption {
+    EmitAll = 0,                // copy of the descriptor
+    EmitStripStrings = 1,       // iConfiguration, iInterface and iFunction are set to 0
+    EmitStripRedundant = 2,     // removes single interface IADs and repeated class specific descriptors
+    EmitMinimal = EmitStripStrings | EmitStripRedundant
+};
+
+/**
+ * @brief Result of USBConfiguration::emit(): the byte and EP0 packet savings compared to the full descriptor
+ */
+struct USBEmitReport {
+    int original_bytes = 0;
+    int emitted_bytes = 0;
+    int stripped_descriptors = 0;
+    int stripped_strings = 0;       // distinct string indexes which are no longer referenced
+    int string_bytes = 0;           // size of the string descriptors which the host does not need to request
+
+    int savedBytes() {
+        return original_bytes - emitted_bytes;
+    }
+
+    // number of data packets of the GET_DESCRIPTOR request for the indicated bMaxPacketSize0
+    static int packets(int len, uint8_t packet_size0=CFG_TUD_ENDPOINT0_SIZE){
+        return (len + packet_size0 - 1) / packet_size0;
+    }
+
+    int savedPackets(uint8_t packet_size0=CFG_TUD_ENDPOINT0_SIZE) {
+        return packets(original_bytes, packet_size0) - packets(emitted_bytes, packet_size0);
+    }
+};
+
 /**
  * @brief Data for the USBConfiguration and dependent configurations. We use this separate class to get the dependency
- * restrictions of the header only approach out of the way.
+ * restrictions of the header only approach out of the way. There is one buffer per device controller (rhport).
  * 
  */
 class USBConfigurationDescriptorData {
     public:
-        static USBConfigurationDescriptorData &instance(){
-            static USBConfigurationDescriptorData inst;
-            return inst;
+        static USBConfigurationDescriptorData &instance(uint8_t rhport=0){
+            static USBConfigurationDescriptorData inst[USB_PORT_COUNT];
+            return inst[rhport<USB_PORT_COUNT ? rhport : 0];
         }
 
         void clear() {
@@ -173,6 +273,7 @@ class USBConfigurationDescriptorData {
         }
         // we add some descriptor information to the buffer
         uint8_t* addDescriptor(const uint8_t* ptr, int size_in){
+            USB_PROFILE_SCOPE(ProfileDescriptorBuild);
             int size = size_in;
 
             // if the size is not indicated we use it from the data
@@ -181,7 +282,7 @@ class USBConfigurationDescriptorData {
             }
 
             // make sure we have enough space
-            if (!buffer()->checkSize(totalSize() + size_in)){
+            if (!buffer()->checkSize(totalSize() + size - 1)){
                 return nullptr;
             }
 
@@ -222,18 +323,41 @@ class USBConfigurationDescriptorData {
 };
 
 
+// maximum number of characters of a string descriptor
+#define USB_STRING_MAX_LEN 31
+
+// Writes the value of a dynamic string (e.g. the chip id or a value from flash) to buffer: returns the length
+typedef int (*USBStringProvider)(char *buffer, int max_len);
+
+/**
+ * @brief Dynamic string: the provider is called at most once and the result is kept together with its UTF-16 encoding
+ */
+struct USBStringProviderEntry {
+    uint8_t index;
+    USBStringProvider provider;
+    bool valid;
+    char value[USB_STRING_MAX_LEN+1];
+    uint16_t utf[USB_STRING_MAX_LEN+1];
+};
+
 /**
  * @brief USB String Descriptors are accessed with the help of a index id. The strings are
  * available starting from index 1.
  * 
  * Index 0 is used for the language.
+ *
+ * Each device controller (rhport) has its own string table.
+ *
+ * Dynamic strings are defined with a USBStringProvider: it is called on the first request or by finalize(), so
+ * call finalize() before the enumeration if the provider reads from slow storage. After invalidate() the provider
+ * is called again on the next request.
  */
 
 class USBStrings {
     public:
-        static USBStrings &instance() {
-            static USBStrings inst;
-            return inst;
+        static USBStrings &instance(uint8_t rhport=0) {
+            static USBStrings inst[USB_PORT_COUNT];
+            return inst[rhport<USB_PORT_COUNT ? rhport : 0];
         }
 
         // adds an ascii string and provides the resulting new index id
@@ -242,18 +366,83 @@ class USBStrings {
             return char_array.size();
         }
 
+        // adds a dynamic string and provides the resulting new index id: the provider is not called yet
+        uint8_t add(USBStringProvider provider){
+            char_array.append(nullptr);
+            uint8_t index = char_array.size();
+            set(index, provider);
+            return index;
+        }
+
         // provides the USB string descriptor in UTF
         uint16_t* string(int index){
             if (index==0){
                 return language;
             }
+            USBStringProviderEntry *entry = resolve(index);
+            if (entry!=nullptr){
+                return entry->utf;
+            }
             return toUtf(get(index));
         }
     
+        // replaces the ascii string with the indicated index id
+        bool set(int index, const char* str){
+            if (index<1 || index>char_array.size()){
+                return false;
+            }
+            removeProvider(index);
+            char_array[index-1] = str;
+            return true;
+        }
+
+        // replaces the string with the indicated index id by a dynamic string
+        bool set(int index, USBStringProvider provider){
+            if (index<1 || index>char_array.size() || provider==nullptr){
+                return false;
+            }
+            USBStringProviderEntry *entry = findProvider(index);
+            if (entry==nullptr){
+                entry = new USBStringProviderEntry();
+                entry->index = index;
+                providers.append(entry);
+            }
+            entry->provider = provider;
+            entry->valid = false;
+            char_array[index-1] = nullptr;
+            return true;
+        }
+
         // returns the ascii string 
         const char* get(int index){
+            USBStringProviderEntry *entry = resolve(index);
+            if (entry!=nullptr){
+                return entry->value;
+            }
             return char_array[index-1];
         }
+
+        // calls all providers which have not been called yet: after this the string requests do not call any provider
+        void finalize() {
+            for (int j=0;j<providers.size();j++){
+                resolve(providers[j]->index);
+            }
+        }
+
+        // the provider of the indicated string is called again on the next request: 0 = all dynamic strings
+        void invalidate(int index=0){
+            for (int j=0;j<providers.size();j++){
+                if (index==0 || providers[j]->index==index){
+                    providers[j]->valid = false;
+                    char_array[providers[j]->index-1] = nullptr;
+                }
+            }
+        }
+
+        // checks if the string is provided by a USBStringProvider
+        bool isDynamic(int index){
+            return findProvider(index)!=nullptr;
+        }
     
         int size(){
             return char_array.size();
@@ -266,6 +455,11 @@ class USBStrings {
             language[1] = lang;           
         }
 
+        // returns the language id
+        uint16_t languageId() {
+            return language[1];
+        }
+
         static bool equals(const uint16_t* str1, const uint16_t*str2){
             uint8_t* char_ptr1 = (uint8_t*)str1;
             uint8_t* char_ptr2 = (uint8_t*)str2;
@@ -277,19 +471,68 @@ class USBStrings {
         }
 
         void clear() {
+            for (int j=0;j<providers.size();j++){
+                delete providers[j];
+            }
+            providers.clear();
             char_array.clear();
         }
 
     protected:
         Vector<const char*> char_array = Vector<const char*>(nullptr, 5, 5);
+        Vector<USBStringProviderEntry*> providers = Vector<USBStringProviderEntry*>(nullptr, 0, 2);
         uint16_t result[32];
         uint16_t language[2];
 
+        USBStringProviderEntry *findProvider(int index){
+            for (int j=0;j<providers.size();j++){
+                if (providers[j]->index==index){
+                    return providers[j];
+                }
+            }
+            return nullptr;
+        }
+
+        // calls the provider if the value is not available yet and encodes the result: nullptr for static strings
+        USBStringProviderEntry *resolve(int index){
+            if (providers.size()==0){
+                return nullptr;
+            }
+            USBStringProviderEntry *entry = findProvider(index);
+            if (entry==nullptr || entry->valid){
+                return entry;
+            }
+            int len = entry->provider(entry->value, USB_STRING_MAX_LEN);
+            if (len<0) len = 0;
+            if (len>USB_STRING_MAX_LEN) len = USB_STRING_MAX_LEN;
+            entry->value[len] = 0;
+            for (int i=0; i<len; i++){
+                entry->utf[1+i] = (uint8_t) entry->value[i];
+            }
+            uint8_t *byte_ptr = (uint8_t *) entry->utf;
+            byte_ptr[0] = 2*len + 2;
+            byte_ptr[1] = TUSB_DESC_STRING;
+            entry->valid = true;
+            char_array[index-1] = entry->value;
+            return entry;
+        }
+
+        void removeProvider(int index){
+            for (int j=0;j<providers.size();j++){
+                if (providers[j]->index==index){
+                    delete providers[j];
+                    providers.remove(j);
+                    return;
+                }
+            }
+        }
+
         USBStrings() {
             setLanguage(DEFAULT_LANGUAGE);
         }
 
         uint16_t* toUtf(const char *str){
+            USB_PROFILE_SCOPE(ProfileStringEncoding);
             if (str==nullptr){
                 return nullptr;
             }
@@ -331,31 +574,139 @@ class USBBase {
             return is_done;
         }
 
-        // Add a descriptor define as it is usually used in TinyUSB
-        uint8_t* addDescriptor(uint8_t len, ...){
-            uint8_t tmp[len];
-            tmp[0]=len;
-            va_list ap;
-            va_start(ap, len); 
-            for (int i = 1; i < len; i++){
-                tmp[i] = va_arg(ap, uint8_t);
-            }
-            va_end(ap);
-            return USBConfigurationDescriptorData::instance().addDescriptor(tmp,len);
+        // device controller of the descriptor
+        uint8_t rhport() {
+            return port;
+        }
+
+        // Add a descriptor define as it is usually used in TinyUSB - the define might contain multiple descriptors,
+        // so we take all bytes which have been provided
+        template<typename... Args>
+        uint8_t* addDescriptor(uint8_t len, Args... args){
+            uint8_t tmp[] = {len, (uint8_t)args...};
+            return USBConfigurationDescriptorData::instance(port).addDescriptor(tmp, sizeof(tmp));
         }
 
         // Add a descriptor as array
         uint8_t* addDescriptor(const uint8_t* desc, int len){
-            return USBConfigurationDescriptorData::instance().addDescriptor(desc, len);
+            return USBConfigurationDescriptorData::instance(port).addDescriptor(desc, len);
         }
 
 
     protected:
         bool is_done; // just a single flag to record if we have defined all parameters
+        uint8_t port = 0;
 
 };
 
 
+/**
+ * @brief Snapshot of the transfer statistics of an endpoint. The latencies are measured in microseconds from the
+ * submission to the completion of a transfer.
+ */
+struct USBEndpointStatistics {
+    uint8_t ep_addr;
+    uint32_t bytes;
+    uint32_t transfers;
+    uint32_t short_packets;
+    uint32_t zlps;
+    uint32_t stalls;
+    uint32_t queue_full;    // submissions which failed because the endpoint was still busy
+    uint32_t errors;        // failed submissions and transfers which did not complete successfully
+    uint32_t latency_min_us;
+    uint32_t latency_avg_us;
+    uint32_t latency_max_us;
+};
+
+/**
+ * @brief Transfer counters of an endpoint: they are updated with relaxed atomics, so that they can be updated from
+ * the USB task while they are read by the application.
+ */
+class USBEndpointStats {
+    public:
+        USBEndpointStats() {
+            reset();
+        }
+
+        void submitted(uint16_t len){
+            submit_len.store(len, std::memory_order_relaxed);
+            submit_time.store((uint32_t)USBClock::micros(), std::memory_order_relaxed);
+        }
+
+        void completed(uint32_t xferred_bytes, bool success){
+            uint32_t latency = (uint32_t)USBClock::micros() - submit_time.load(std::memory_order_relaxed);
+            if (!success){
+                errors.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            bytes.fetch_add(xferred_bytes, std::memory_order_relaxed);
+            transfers.fetch_add(1, std::memory_order_relaxed);
+            if (xferred_bytes==0){
+                zlps.fetch_add(1, std::memory_order_relaxed);
+            } else if (xferred_bytes < submit_len.load(std::memory_order_relaxed)){
+                short_packets.fetch_add(1, std::memory_order_relaxed);
+            }
+            latency_sum.fetch_add(latency, std::memory_order_relaxed);
+            uint32_t current = latency_min.load(std::memory_order_relaxed);
+            while(latency<current && !latency_min.compare_exchange_weak(current, latency, std::memory_order_relaxed));
+            current = latency_max.load(std::memory_order_relaxed);
+            while(latency>current && !latency_max.compare_exchange_weak(current, latency, std::memory_order_relaxed));
+        }
+
+        void stalled() {
+            stalls.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void queueFull() {
+            queue_full.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void error() {
+            errors.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void snapshot(USBEndpointStatistics &result){
+            result.bytes = bytes.load(std::memory_order_relaxed);
+            result.transfers = transfers.load(std::memory_order_relaxed);
+            result.short_packets = short_packets.load(std::memory_order_relaxed);
+            result.zlps = zlps.load(std::memory_order_relaxed);
+            result.stalls = stalls.load(std::memory_order_relaxed);
+            result.queue_full = queue_full.load(std::memory_order_relaxed);
+            result.errors = errors.load(std::memory_order_relaxed);
+            result.latency_max_us = latency_max.load(std::memory_order_relaxed);
+            result.latency_min_us = result.transfers>0 ? latency_min.load(std::memory_order_relaxed) : 0;
+            result.latency_avg_us = result.transfers>0 ? (uint32_t)(latency_sum.load(std::memory_order_relaxed) / result.transfers) : 0;
+        }
+
+        void reset() {
+            bytes.store(0, std::memory_order_relaxed);
+            transfers.store(0, std::memory_order_relaxed);
+            short_packets.store(0, std::memory_order_relaxed);
+            zlps.store(0, std::memory_order_relaxed);
+            stalls.store(0, std::memory_order_relaxed);
+            queue_full.store(0, std::memory_order_relaxed);
+            errors.store(0, std::memory_order_relaxed);
+            latency_min.store(UINT32_MAX, std::memory_order_relaxed);
+            latency_max.store(0, std::memory_order_relaxed);
+            latency_sum.store(0, std::memory_order_relaxed);
+        }
+
+    protected:
+        std::atomic<uint32_t> bytes;
+        std::atomic<uint32_t> transfers;
+        std::atomic<uint32_t> short_packets;
+        std::atomic<uint32_t> zlps;
+        std::atomic<uint32_t> stalls;
+        std::atomic<uint32_t> queue_full;
+        std::atomic<uint32_t> errors;
+        std::atomic<uint32_t> latency_min;
+        std::atomic<uint32_t> latency_max;
+        // 32 bits would already overflow after 72 minutes of accumulated latency
+        std::atomic<uint64_t> latency_sum;
+        std::atomic<uint32_t> submit_time{0};
+        std::atomic<uint16_t> submit_len{0};
+};
+
 /**
  * @brief Endpoint descriptors are used to describe endpoints other than endpoint zero. Endpoint zero is always assumed to be a control endpoint and is 
  * configured before any descriptors are even requested. The host will use the information returned from these descriptors to determine the 
@@ -364,9 +715,13 @@ class USBBase {
 
 class USBEndpoint : public USBBase {
     public:
+        ~USBEndpoint() {
+            delete stats_ptr;
+        }
+
         // Maximum Packet Size this endpoint is capable of sending or receiving
         USBEndpoint& wMaxPacketSize(uint16_t val){
-            descriptor()->bInterval = val;
+            descriptor()->wMaxPacketSize.size = val;
             return *this;
         }
 
@@ -384,20 +739,100 @@ class USBEndpoint : public USBBase {
             return descriptor_data;
         }
 
+        // endpoint address: bit 7 is set for IN endpoints
+        uint8_t address() {
+            return descriptor()->bEndpointAddress;
+        }
+
+        // starts a transfer: the buffer must be valid until the transfer has been completed
+        bool xfer(uint8_t *buffer, uint16_t len, uint8_t rhport=USB_PORT_OWN){
+            USB_PROFILE_SCOPE(ProfileTransferSubmit);
+            if (rhport==USB_PORT_OWN) rhport = port;
+            if (usbd_edpt_busy(rhport, address())){
+                if (stats_ptr!=nullptr) stats_ptr->queueFull();
+                return false;
+            }
+            if (!usbd_edpt_xfer(rhport, address(), buffer, len)){
+                if (stats_ptr!=nullptr) stats_ptr->error();
+                return false;
+            }
+            if (stats_ptr!=nullptr) stats_ptr->submitted(len);
+            USB_TRACE_SUBMIT(rhport, address(), len);
+            USB_TIMELINE_TRANSFER(address(), len);
+            return true;
+        }
+
+        // stalls the endpoint
+        void stall(uint8_t rhport=USB_PORT_OWN){
+            if (rhport==USB_PORT_OWN) rhport = port;
+            usbd_edpt_stall(rhport, address());
+            if (stats_ptr!=nullptr) stats_ptr->stalled();
+        }
+
+        // needs to be called by the class driver when the transfer has been completed
+        void completed(xfer_result_t result, uint32_t xferred_bytes){
+            USB_PROFILE_SCOPE(ProfileTransferComplete);
+            USB_TRACE_COMPLETE(port, address(), xferred_bytes, result);
+            if (stats_ptr!=nullptr){
+                stats_ptr->completed(xferred_bytes, result==XFER_RESULT_SUCCESS);
+                if (result==XFER_RESULT_STALLED) stats_ptr->stalled();
+            }
+            if (listener!=nullptr){
+                // the listener might already submit the next transfer
+                USBTransferListener cb = listener;
+                listener = nullptr;
+                cb(listener_ref, result, xferred_bytes);
+            }
+        }
+
+        // the listener is informed once about the next completed transfer: nullptr to remove it
+        void setTransferListener(USBTransferListener cb, void *ref=nullptr){
+            listener = cb;
+            listener_ref = ref;
+        }
+
+#if defined(__cpp_impl_coroutine)
+        // awaitable transfer into the buffer for the coroutines of USBCoroutine.h: fails if it is bigger than 65535 bytes
+        USBTransferAwaitable read(std::span<uint8_t> data);
+
+        // awaitable transfer of the data for the coroutines of USBCoroutine.h: fails if it is bigger than 65535 bytes
+        USBTransferAwaitable write(std::span<const uint8_t> data);
+#endif
+
+        // activates the collection of the transfer statistics
+        USBEndpoint &enableStats(bool active=true){
+            if (active && stats_ptr==nullptr){
+                stats_ptr = new USBEndpointStats();
+            } else if (!active && stats_ptr!=nullptr){
+                delete stats_ptr;
+                stats_ptr = nullptr;
+            }
+            return *this;
+        }
+
+        // provides the transfer statistics: nullptr if they are not active
+        USBEndpointStats *stats() {
+            return stats_ptr;
+        }
+
 
     protected:
         USBInterface *parent;
         tusb_desc_endpoint_t* descriptor_data; // if assigned direcly 
+        USBEndpointStats *stats_ptr = nullptr;
+        USBTransferListener listener = nullptr;
+        void *listener_ref = nullptr;
 
-        USBEndpoint(USBInterface *parent, int endpointNumber, bool isInput, TransferType xfer ){
+        USBEndpoint(USBInterface *parent, int endpointNumber, bool isInput, TransferType xfer, uint8_t rhport){
             this->parent = parent;
-            descriptor_data =  (tusb_desc_endpoint_t*) USBConfigurationDescriptorData::instance().addDescriptor(nullptr, sizeof(tusb_desc_endpoint_t));
+            this->port = rhport;
+            descriptor_data =  (tusb_desc_endpoint_t*) USBConfigurationDescriptorData::instance(rhport).addDescriptor(nullptr, sizeof(tusb_desc_endpoint_t));
             descriptor_data->bLength = sizeof(tusb_desc_endpoint_t)         ; ///< Size of this descriptor in bytes
             descriptor_data->bDescriptorType = 0x05 ; ///< ENDPOINT Descriptor Type
 
             ///< The address of the endpoint on the USB device described by this descriptor. The address is encoded as follows: \n Bit 3...0: The endpoint number \n Bit 6...4: Reserved, reset to zero \n 
             // Bit 7: Direction, ignored for control endpoints 0 = OUT endpoint 1 = IN endpoint.
-            descriptor_data->bEndpointAddress = endpointNumber & 0b00000111 | isInput<7 ; 
+            descriptor_data->bEndpointAddress = (endpointNumber & 0b00001111) | (isInput ? 0x80 : 0x00); 
             descriptor_data->bmAttributes.xfer = xfer;
             descriptor_data->bmAttributes.sync = 0x00;     // 00 = No Synchonisation
             descriptor_data->bmAttributes.usage = 0x00 ;   // 00 = Data Endpoint
@@ -405,8 +840,9 @@ class USBEndpoint : public USBBase {
             descriptor_data->bInterval  = 1;               // Interval for polling endpoint data transfers.
         }
 
-        USBEndpoint(USBInterface *parent, tusb_desc_endpoint_t *data){
+        USBEndpoint(USBInterface *parent, tusb_desc_endpoint_t *data, uint8_t rhport){
             this->parent = parent;
+            this->port = rhport;
             this->descriptor_data = data;
         }
 
@@ -421,25 +857,21 @@ class USBEndpoint : public USBBase {
  */
 class USBInterface : public USBBase {
     public:
-        // creats a new endpoint
-        USBEndpoint& createEndpoint(bool isInput, TransferType xfer=Isochronous) {
-            USBEndpoint *result = new USBEndpoint(this, usbEndpointCount(), isInput, xfer);
-            descriptor()->bNumEndpoints++;
-            endpoints.append(result);
-            return *result;
+        ~USBInterface() {
+            for (int j=0;j<endpoints.size();j++){
+                delete endpoints[j];
+            }
         }
 
-        // creates a new endpoint from the external data
+        // creats a new endpoint with the next unused endpoint number of the configuration
+        USBEndpoint& createEndpoint(bool isInput, TransferType xfer=Isochronous);
+
+        // creates a new endpoint from the external data: bNumEndpoints of the external interface descriptor is not changed
         USBEndpoint& createEndpoint(tusb_desc_endpoint_t *data) {
-            USBEndpoint *result = new USBEndpoint(this, data);
-            descriptor()->bNumEndpoints++;
+            USBEndpoint *result = new USBEndpoint(this, data, port);
             endpoints.append(result);
             return *result;
         }
-       
-        USBEndpoint& controlEndpoint() {
-            return *endpoints[0];
-        }
 
         USBEndpoint &usbEndpoint(int index){
             return *endpoints[index];
@@ -447,7 +879,7 @@ class USBInterface : public USBBase {
 
         // string descriptor describing this interface
         USBInterface &name(char *name){
-            descriptor()->iInterface = USBStrings::instance().add(name);
+            descriptor()->iInterface = USBStrings::instance(port).add(name);
             return *this;
         }
 
@@ -503,9 +935,10 @@ class USBInterface : public USBBase {
         Vector<USBEndpoint*> endpoints;
         tusb_desc_interface_t *descriptor_data;
 
-        USBInterface(USBConfiguration *parent, int interfaceNumber){
+        USBInterface(USBConfiguration *parent, int interfaceNumber, uint8_t rhport){
             this->parent = parent;
-            descriptor_data = (tusb_desc_interface_t*) USBConfigurationDescriptorData::instance().addDescriptor(nullptr, sizeof(tusb_desc_interface_t));
+            this->port = rhport;
+            descriptor_data = (tusb_desc_interface_t*) USBConfigurationDescriptorData::instance(rhport).addDescriptor(nullptr, sizeof(tusb_desc_interface_t));
 
             descriptor()->bLength = sizeof(tusb_desc_interface_t)           ; ///< Size of this descriptor in bytes
             descriptor()->bDescriptorType = 0x04; ///< INTERFACE Descriptor Type
@@ -516,13 +949,12 @@ class USBInterface : public USBBase {
             descriptor()->bInterfaceSubClass = 0; ///< Subclass code (assigned by the USB-IF). \n These codes are qualified by the value of the bInterfaceClass field. \li If the bInterfaceClass field is reset to zero, this field must also be reset to zero. \li If the bInterfaceClass field is not set to FFH, all values are reserved for assignment by the USB-IF.
             descriptor()->bInterfaceProtocol = 0; ///< Protocol code (assigned by the USB). \n These codes are qualified by the value of the bInterfaceClass and the bInterfaceSubClass fields. If an interface supports class-specific requests, this code identifies the protocols that the device uses as defined by the specification of the device class. \li If this field is reset to zero, the device does not use a class-specific protocol on this interface. \li If this field is set to FFH, the device uses a vendor-specific protocol for this interface.
             descriptor()->iInterface = 0 ; ///< Index of string descriptor describing this interface
-
-            // create the default control interface - the isInput is ignored by control type
-            createEndpoint(true, Control);
+            // endpoint zero is not described by an endpoint descriptor
         } 
 
-        USBInterface(USBConfiguration *parent, tusb_desc_interface_t* data){
+        USBInterface(USBConfiguration *parent, tusb_desc_interface_t* data, uint8_t rhport){
             this->parent = parent;
+            this->port = rhport;
             descriptor_data = data;
         } 
 
@@ -540,28 +972,35 @@ class USBInterface : public USBBase {
 
 class USBConfiguration  : public USBBase {
     public:
+        ~USBConfiguration() {
+            for (int j=0;j<interfaces.size();j++){
+                delete interfaces[j];
+            }
+        }
+
         // creates a new interface with some default values set
         USBInterface *createInterface(){
             descriptor()->bNumInterfaces++;
-            USBInterface* result = new USBInterface(this, usbInterfaceCount());
+            USBInterface* result = new USBInterface(this, usbInterfaceCount(), port);
             interfaces.append(result);
             return result;
         }
 
-        // creats a new interface using the provided external data
+        // creats a new interface using the provided external data: alternate settings are not counted in bNumInterfaces
         USBInterface *createInterface(tusb_desc_interface_t *data){
-            USBInterface* result = new USBInterface(this, data);
+            USBInterface* result = new USBInterface(this, data, port);
             interfaces.append(result);
-            descriptor()->bNumInterfaces = interfaces.size();
+            if (data->bAlternateSetting==0){
+                descriptor()->bNumInterfaces = ++interface_count;
+            }
             return result;
         }
 
 
         // We might already have the descriptors from some examples
         void setConfigurationDescriptor(const uint8_t* desc, int len,  bool parse=false){
-            this->descriptor_data = (tusb_desc_configuration_t*)  USBConfigurationDescriptorData::instance().addDescriptor(desc, len);
-            //this->descriptor_data = (tusb_desc_configuration_t*) USBConfigurationDescriptorData::instance().data();
-            if (parse){
+            this->descriptor_data = (tusb_desc_configuration_t*)  USBConfigurationDescriptorData::instance(port).addDescriptor(desc, len);
+            if (parse && this->descriptor_data!=nullptr){
                 parseDescriptor((uint8_t *) this->descriptor_data, len);
             }
         }
@@ -579,6 +1018,12 @@ class USBConfiguration  : public USBBase {
             return *this;
         }
 
+        // number of interfaces: only needed if interfaces are added as raw descriptors with addDescriptor()
+        USBConfiguration& bNumInterfaces(uint8_t value){
+            descriptor()->bNumInterfaces = value;
+            return *this;
+        }
+
         // size in bytes
         int size() {
             return descriptor()->bLength;
@@ -588,6 +1033,9 @@ class USBConfiguration  : public USBBase {
             return descriptor()->wTotalLength;
         }
 
+        // length of the block of this configuration in the descriptor buffer: up to the next configuration
+        int blockLength();
+
         USBDevice* usbDevice(){
             return parent;
         }
@@ -601,14 +1049,18 @@ class USBConfiguration  : public USBBase {
         }
 
         // provides access to the combined descriptor
+        // the configuration descriptor followed by its dependent descriptors: the configurations which are defined with
+        // the API need to be defined one after the other
         uint8_t* configurationDescriptor() {
-            USBConfigurationDescriptorData data = USBConfigurationDescriptorData::instance();
-            //descriptor()->wTotalLength = data.totalSize();
-            return  data.data();
+            if (is_built){
+                descriptor()->wTotalLength = blockLength();
+            }
+            return (uint8_t*) descriptor();
         }
 
         // provides access to the combined descriptor -adapts the packet size for high speed 
         uint8_t* configurationDescriptorExt(int packetSizeHighSpeed=512) {
+            USB_PROFILE_SCOPE(ProfileFinalize);
             if (tud_speed_get() == TUSB_SPEED_HIGH){
                 for (int j=0;j<interfaces.size();j++){
                     for (int i=0; i< interfaces[j]->endpoints.size();i++){
@@ -616,15 +1068,249 @@ class USBConfiguration  : public USBBase {
                     }
                 }
             }
-            USBConfigurationDescriptorData data = USBConfigurationDescriptorData::instance();
-            descriptor()->wTotalLength = data.totalSize();
-            return  data.data();
+            descriptor()->wTotalLength = blockLength();
+            return (uint8_t*) descriptor();
+        }
+
+        // checks the consistency of a configuration descriptor: returns nullptr if it is valid or the description of the first error
+        static const char* validate(const uint8_t *data, int len){
+            if (len<(int)sizeof(tusb_desc_configuration_t) || data[0]!=sizeof(tusb_desc_configuration_t) || data[1]!=TUSB_DESC_CONFIGURATION){
+                return "invalid configuration descriptor";
+            }
+            const tusb_desc_configuration_t *config = (const tusb_desc_configuration_t*) data;
+            if (config->wTotalLength!=len){
+                return "wTotalLength does not match";
+            }
+            // interface number which uses the endpoint address: 0xff = unused
+            uint8_t ep_owner[2][16];
+            memset(ep_owner, 0xff, sizeof(ep_owner));
+            const tusb_desc_interface_t *itf = nullptr;
+            int ep_count = 0;
+            int itf_count = 0;
+            const uint8_t *ptr = data + data[0];
+            const uint8_t *end = data + len;
+            while(ptr<end){
+                if (end-ptr<2 || ptr[0]<2 || ptr+ptr[0]>end){
+                    return "descriptor exceeds wTotalLength";
+                }
+                if (ptr[1]==TUSB_DESC_INTERFACE){
+                    if (ptr[0]<sizeof(tusb_desc_interface_t)){
+                        return "interface descriptor too short";
+                    }
+                    if (itf!=nullptr && ep_count!=itf->bNumEndpoints){
+                        return "bNumEndpoints does not match";
+                    }
+                    itf = (const tusb_desc_interface_t*) ptr;
+                    ep_count = 0;
+                    if (itf->bAlternateSetting==0){
+                        itf_count++;
+                    }
+                } else if (ptr[1]==TUSB_DESC_ENDPOINT){
+                    if (ptr[0]<sizeof(tusb_desc_endpoint_t)){
+                        return "endpoint descriptor too short";
+                    }
+                    if (itf==nullptr){
+                        return "endpoint outside of an interface";
+                    }
+                    uint8_t ep_addr = ((const tusb_desc_endpoint_t*)ptr)->bEndpointAddress;
+                    if (tu_edpt_number(ep_addr)==0){
+                        return "endpoint 0 in an interface";
+                    }
+                    uint8_t &owner = ep_owner[tu_edpt_dir(ep_addr)][tu_edpt_number(ep_addr) & 0x0f];
+                    if (owner!=0xff && owner!=itf->bInterfaceNumber){
+                        return "endpoint used by multiple interfaces";
+                    }
+                    owner = itf->bInterfaceNumber;
+                    ep_count++;
+                }
+                ptr += ptr[0];
+            }
+            if (itf!=nullptr && ep_count!=itf->bNumEndpoints){
+                return "bNumEndpoints does not match";
+            }
+            if (itf_count!=config->bNumInterfaces){
+                return "bNumInterfaces does not match";
+            }
+            return nullptr;
+        }
+
+        // checks the consistency of this configuration descriptor
+        const char* validate() {
+            const uint8_t *data = configurationDescriptor();
+            return validate(data, totalSize());
+        }
+
+        // next unused endpoint number of the direction for the endpoints which are created with the API
+        uint8_t nextEndpointNumber(bool isInput){
+            uint8_t result = 1;
+            for (int j=0;j<interfaces.size();j++){
+                for (int i=0; i< interfaces[j]->endpoints.size();i++){
+                    uint8_t ep_addr = interfaces[j]->endpoints[i]->address();
+                    if ((tu_edpt_dir(ep_addr)==TUSB_DIR_IN)==isInput && tu_edpt_number(ep_addr)>=result){
+                        result = tu_edpt_number(ep_addr) + 1;
+                    }
+                }
+            }
+            return result;
+        }
+
+        // writes a size optimized copy of a configuration descriptor to out (which must not overlap with data): returns
+        // the emitted length or 0 if max_len is smaller than len. Audio class interfaces are copied unchanged because
+        // their class specific header contains a total length.
+        static int emit(const uint8_t *data, int len, uint8_t *out, int max_len, int options=EmitMinimal, USBEmitReport *report=nullptr, uint8_t rhport=0){
+            USBEmitReport tmp;
+            USBEmitReport &result = report!=nullptr ? *report : tmp;
+            result = USBEmitReport();
+            result.original_bytes = len;
+            if (len<(int)sizeof(tusb_desc_configuration_t) || len>max_len){
+                return 0;
+            }
+            // string indexes which are referenced before (bit 0) and after (bit 1) the stripping
+            uint8_t strings[256] = {0};
+            const uint8_t *itf_start = nullptr; // class specific descriptors of the actual interface
+            const uint8_t *ep_start = nullptr;  // class specific descriptors of the actual endpoint
+            bool is_audio = false;
+            int pos = 0;
+            const uint8_t *ptr = data;
+            const uint8_t *end = data + len;
+            while(ptr+2<=end && ptr[0]>=2 && ptr+ptr[0]<=end){
+                uint8_t desc_len = ptr[0];
+                // position of the string index in the descriptor: 0 = none
+                int str_pos = 0;
+                bool keep = true;
+                switch(ptr[1]){
+                    case TUSB_DESC_CONFIGURATION:
+                        str_pos = 6;
+                        break;
+                    case TUSB_DESC_INTERFACE_ASSOCIATION:
+                        str_pos = 7;
+                        keep = !(options & EmitStripRedundant) || ptr[3]>1;
+                        break;
+                    case TUSB_DESC_INTERFACE:
+                        str_pos = 8;
+                        itf_start = ptr + desc_len;
+                        ep_start = nullptr;
+                        is_audio = ptr[5]==TUSB_CLASS_AUDIO;
+                        break;
+                    case TUSB_DESC_ENDPOINT:
+                        ep_start = ptr + desc_len;
+                        break;
+                    case TUSB_DESC_CS_INTERFACE:
+                        if ((options & EmitStripRedundant) && !is_audio && itf_start!=nullptr){
+                            keep = !isRepeated(itf_start, ptr);
+                        }
+                        break;
+                    case TUSB_DESC_CS_ENDPOINT:
+                        // the same descriptor of an other endpoint is not redundant
+                        if ((options & EmitStripRedundant) && !is_audio && ep_start!=nullptr){
+                            keep = !isRepeated(ep_start, ptr);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                if (str_pos>0 && str_pos<desc_len && ptr[str_pos]!=0){
+                    strings[ptr[str_pos]] |= 1;
+                }
+                if (keep){
+                    memcpy(out+pos, ptr, desc_len);
+                    if (str_pos>0 && str_pos<desc_len){
+                        if (options & EmitStripStrings){
+                            out[pos+str_pos] = 0;
+                        } else if (ptr[str_pos]!=0){
+                            strings[ptr[str_pos]] |= 2;
+                        }
+                    }
+                    pos += desc_len;
+                } else {
+                    result.stripped_descriptors++;
+                }
+                ptr += desc_len;
+            }
+            ((tusb_desc_configuration_t*)out)->wTotalLength = pos;
+            result.emitted_bytes = pos;
+
+            USBStrings &str = USBStrings::instance(rhport);
+            for (int idx=1; idx<256; idx++){
+                if (strings[idx]==1){
+                    result.stripped_strings++;
+                    if (idx<=str.size() && str.get(idx)!=nullptr){
+                        result.string_bytes += 2 + 2 * strlen(str.get(idx));
+                    }
+                }
+            }
+            return pos;
+        }
+
+        // writes a size optimized copy of this configuration descriptor to out
+        int emit(uint8_t *out, int max_len, int options=EmitMinimal, USBEmitReport *report=nullptr){
+            return emit((const uint8_t*)descriptor(), totalSize(), out, max_len, options, report, port);
+        }
+
+        // provides the endpoint with the indicated address: nullptr if it does not exist
+        USBEndpoint* usbEndpoint(uint8_t ep_addr){
+            for (int j=0;j<interfaces.size();j++){
+                for (int i=0; i< interfaces[j]->endpoints.size();i++){
+                    USBEndpoint *ep = interfaces[j]->endpoints[i];
+                    if (ep->address()==ep_addr){
+                        return ep;
+                    }
+                }
+            }
+            return nullptr;
+        }
+
+        // forwards the completion of a transfer to the endpoint: call this from your class driver
+        void transferCompleted(uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+            USBEndpoint *ep = usbEndpoint(ep_addr);
+            if (ep!=nullptr){
+                ep->completed(result, xferred_bytes);
+            }
+        }
+
+        // activates the transfer statistics for all endpoints
+        void enableStats(bool active=true){
+            for (int j=0;j<interfaces.size();j++){
+                for (int i=0; i< interfaces[j]->endpoints.size();i++){
+                    interfaces[j]->endpoints[i]->enableStats(active);
+                }
+            }
+        }
+
+        // provides a snapshot of the transfer statistics of all endpoints which have them activated
+        int stats(Vector<USBEndpointStatistics> &result){
+            result.clear();
+            for (int j=0;j<interfaces.size();j++){
+                for (int i=0; i< interfaces[j]->endpoints.size();i++){
+                    USBEndpoint *ep = interfaces[j]->endpoints[i];
+                    if (ep->stats()!=nullptr){
+                        USBEndpointStatistics snapshot;
+                        snapshot.ep_addr = ep->address();
+                        ep->stats()->snapshot(snapshot);
+                        result.append(snapshot);
+                    }
+                }
+            }
+            return result.size();
+        }
+
+        // resets the transfer statistics of all endpoints
+        void resetStats(){
+            for (int j=0;j<interfaces.size();j++){
+                for (int i=0; i< interfaces[j]->endpoints.size();i++){
+                    USBEndpoint *ep = interfaces[j]->endpoints[i];
+                    if (ep->stats()!=nullptr){
+                        ep->stats()->reset();
+                    }
+                }
+            }
         }
 
         // tries to find a descriptor in the memory buffer by id
         uint8_t * findDescriptor(uint8_t id, uint8_t idx){
-            uint8_t *ptr = USBConfigurationDescriptorData::instance().data();
-            uint8_t *end = ptr + USBConfigurationDescriptorData::instance().totalSize();
+            USB_PROFILE_SCOPE(ProfileFindDescriptor);
+            uint8_t *ptr = USBConfigurationDescriptorData::instance(port).data();
+            uint8_t *end = ptr + USBConfigurationDescriptorData::instance(port).totalSize();
             int find_count=0;
             while(ptr<end){
                 uint8_t len = ptr[0];
@@ -640,17 +1326,30 @@ class USBConfiguration  : public USBBase {
         }
 
     protected:
+        // checks if the descriptor at ptr is a byte identical repetition of a descriptor between start and ptr
+        static bool isRepeated(const uint8_t *start, const uint8_t *ptr){
+            for (const uint8_t *prev = start; prev<ptr; prev += prev[0]){
+                if (prev[0]==ptr[0] && memcmp(prev, ptr, ptr[0])==0){
+                    return true;
+                }
+            }
+            return false;
+        }
+
         USBDevice *parent;
         Vector<USBInterface*> interfaces;
-        tusb_desc_configuration_t *descriptor_data;
+        tusb_desc_configuration_t *descriptor_data = nullptr;
         int id;
+        int interface_count = 0; // parsed interfaces without the alternate settings
+        bool is_built = false;   // the header has been created by the API: we determine wTotalLength
 
         tusb_desc_configuration_t* descriptor() {
             if (descriptor_data==nullptr){
-                descriptor_data = (tusb_desc_configuration_t*) USBConfigurationDescriptorData::instance().addDescriptor(nullptr, sizeof(tusb_desc_configuration_t));
+                descriptor_data = (tusb_desc_configuration_t*) USBConfigurationDescriptorData::instance(port).addDescriptor(nullptr, sizeof(tusb_desc_configuration_t));
+                is_built = true;
                 descriptor_data->bLength = sizeof(tusb_desc_configuration_t); ///< Size of this descriptor in bytes
                 descriptor_data->bDescriptorType = 0x02; ///< CONFIGURATION Descriptor Type
-                descriptor_data->bConfigurationValue = id; //= parent->usbConfigurationCount()-1;   ///< Value to use as an argument to the SetConfiguration() request to select this configuration.
+                descriptor_data->bConfigurationValue = id + 1; // 0 would mean not configured   ///< Value to use as an argument to the SetConfiguration() request to select this configuration.
                 descriptor_data->iConfiguration = 0;     ///< Index of string descriptor describing this configuration
                 descriptor_data->bmAttributes = 0;        ///< Configuration characteristics \n D7: Reserved (set to one)\n D6: Self-powered \n D5: Remote Wakeup \n D4...0: Reserved (reset to zero) \n D7 is reserved and must be set to one for historical reasons. \n A device configuration that uses power from the bus and a local source reports a non-zero value in bMaxPower to indicate the amount of bus power required and sets D6. The actual power source at runtime may be determined using the GetStatus(DEVICE) request (see USB 2.0 spec Section 9.4.5). \n If a device configuration supports remote wakeup, D5 is set to one.
                 descriptor_data->bMaxPower = 50;      
@@ -659,10 +1358,11 @@ class USBConfiguration  : public USBBase {
             return descriptor_data;
         }
 
-        USBConfiguration(USBDevice *parent, int id){
+        USBConfiguration(USBDevice *parent, int id, uint8_t rhport){
             //descriptor_data = new tusb_desc_configuration_t();
             this->parent = parent;
             this->id = id;
+            this->port = rhport;
         }
 
         // we parse the descriptor and allocate the objects so that we can access them with our API
@@ -670,16 +1370,14 @@ class USBConfiguration  : public USBBase {
             uint8_t *ptr = data;
             uint8_t *end = data+data_len;
             USBInterface * actual_itf = nullptr;
-            uint8_t len = ptr[0];
-            while(ptr<end && len>0){
+            while(ptr+2<=end && ptr[0]>=2 && ptr+ptr[0]<=end){
                 switch(ptr[1]){
                     case 0x04: //interface
                         actual_itf = this->createInterface((tusb_desc_interface_t*)ptr);
                         break;
                     case 0x05: //endpoint
                         if (actual_itf!=nullptr){
-                            USBEndpoint ep = actual_itf->createEndpoint((tusb_desc_endpoint_t*) ptr);
-                            ep.descriptor_data = (tusb_desc_endpoint_t*)ptr;
+                            actual_itf->createEndpoint((tusb_desc_endpoint_t*) ptr);
                         }
                         break;
                     default:
@@ -687,8 +1385,7 @@ class USBConfiguration  : public USBBase {
                         break;
                 }
                 // advance to next descriptor
-                ptr += len;
-                len = ptr[0];
+                ptr += ptr[0];
             }
         }
 
@@ -708,14 +1405,42 @@ class USBConfiguration  : public USBBase {
 
 class USBDevice  : public USBBase {
     public:
-        // singleton - provides access to the object
-        static USBDevice &instance(){
-            static USBDevice device_instance;
-            return device_instance;
+        // singleton per device controller - provides access to the object
+        static USBDevice &instance(uint8_t rhport=0){
+            static USBDevice *devices = createDevices();
+            return devices[rhport<USB_PORT_COUNT ? rhport : 0];
+        }
+
+        // device descriptor callback dispatched by the device controller
+        static const uint8_t* deviceDescriptorCb(uint8_t rhport){
+            return (const uint8_t*) instance(rhport).deviceDescriptor();
+        }
+
+        // configuration descriptor callback dispatched by the device controller: nullptr if the index is not valid
+        static const uint8_t* configurationDescriptorCb(uint8_t rhport, uint8_t index){
+            USBDevice &device = instance(rhport);
+            return index<device.usbConfigurationCount() ? device.configurationDescriptor(index) : nullptr;
+        }
+
+        // string descriptor callback dispatched by the device controller
+        static const uint16_t* stringCb(uint8_t rhport, uint8_t index, uint16_t langid){
+            return instance(rhport).string(index);
+        }
+
+        // forwards a completed transfer to the endpoint of the device of the indicated controller
+        static void transferCompletedCb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+            USBDevice &device = instance(rhport);
+            for (int j=0;j<device.usbConfigurationCount();j++){
+                device.usbConfiguration(j)->transferCompleted(ep_addr, result, xferred_bytes);
+            }
         }
 
         // returns the device descriptor required by USB
         const tusb_desc_device_t* deviceDescriptor() {
+            USB_LATENCY_SCOPE(LatencyDeviceDescriptor);
+            USB_PROFILE_SCOPE(ProfileDeviceDescriptor);
+            USB_TRACE_DESCRIPTOR(TUSB_DESC_DEVICE, 0, sizeof(tusb_desc_device_t));
+            USB_TIMELINE_DESCRIPTOR(TUSB_DESC_DEVICE, 0, sizeof(tusb_desc_device_t));
             return (const tusb_desc_device_t*) descriptor_ptr();
         }
 
@@ -731,37 +1456,35 @@ class USBDevice  : public USBBase {
 
         // We can provides the full configuration descriptor for the indicated index
         uint8_t const* configurationDescriptor(int idx) {
+            USB_LATENCY_SCOPE(LatencyConfigurationDescriptor);
+            USB_PROFILE_SCOPE(ProfileConfigurationDescriptor);
             USBConfiguration *conf = configurations[idx];
-            return conf->configurationDescriptor();           
+            uint8_t *result = conf->configurationDescriptor();
+            USB_TRACE_DESCRIPTOR(TUSB_DESC_CONFIGURATION, idx, conf->totalSize());
+            USB_TIMELINE_DESCRIPTOR(TUSB_DESC_CONFIGURATION, idx, conf->totalSize());
+            return result;
         }
 
         // creates a new configuration descriptor
         USBConfiguration* createConfiguration() {
             descriptor_ptr()->bNumConfigurations++;
-            USBConfiguration* result = new USBConfiguration(this, configurations.size());
+            USBConfiguration* result = new USBConfiguration(this, configurations.size(), port);
             configurations.append(result);
             return result;            
         }
 
         // We might already have the configuration descriptors from some examples already
         USBConfiguration* setConfigurationDescriptor(const uint8_t* descriptors, int len=0, bool parse=false){
-            //USBConfigurationDescriptorData::instance().addDescriptor(descriptors, len);
             USBConfiguration* config = singleConfiguration();
             config->setConfigurationDescriptor(descriptors, len, parse);
             return config;
         }
 
         // We might already have the configuration descriptors from some examples already
-        USBConfiguration* setConfigurationDescriptor(uint8_t len ...){
-            uint8_t tmp[len];
-            tmp[0]=len;
-            va_list ap;
-            va_start(ap, len); 
-            for (int i = 1; i < len; i++){
-                tmp[i] = va_arg(ap, uint8_t);
-            }
-            va_end(ap);
-            return setConfigurationDescriptor(tmp, len);
+        template<typename... Args>
+        USBConfiguration* setConfigurationDescriptor(uint8_t len, Args... args){
+            uint8_t tmp[] = {len, (uint8_t)args...};
+            return setConfigurationDescriptor(tmp, sizeof(tmp));
         }
 
 
@@ -819,19 +1542,25 @@ class USBDevice  : public USBBase {
 
         // defines the manufacturer string
         USBDevice &manufacturer(const char* str){
-            descriptor_ptr()->iManufacturer = USBStrings::instance().add(str);
+            descriptor_ptr()->iManufacturer = USBStrings::instance(port).add(str);
             return *this;
         }
 
         // defines the product string
         USBDevice &product(const char* str){
-            descriptor_ptr()->iProduct = USBStrings::instance().add(str);
+            descriptor_ptr()->iProduct = USBStrings::instance(port).add(str);
             return *this;
         }
 
         // defines the chipID string
         USBDevice &serialNumber(const char* str){
-            descriptor_ptr()->iSerialNumber = USBStrings::instance().add(str);
+            descriptor_ptr()->iSerialNumber = USBStrings::instance(port).add(str);
+            return *this;
+        }
+
+        // defines the chipID string which is determined by the provider on the first request
+        USBDevice &serialNumber(USBStringProvider provider){
+            descriptor_ptr()->iSerialNumber = USBStrings::instance(port).add(provider);
             return *this;
         }
 
@@ -844,7 +1573,12 @@ class USBDevice  : public USBBase {
         }
 
         const uint16_t* string(int index){
-            return USBStrings::instance().string(index);
+            USB_LATENCY_SCOPE(LatencyStringDescriptor);
+            USB_PROFILE_SCOPE(ProfileStringDescriptor);
+            const uint16_t* result = USBStrings::instance(port).string(index);
+            USB_TRACE_DESCRIPTOR(TUSB_DESC_STRING, index, result!=nullptr ? ((const uint8_t*)result)[0] : 0);
+            USB_TIMELINE_DESCRIPTOR(TUSB_DESC_STRING, index, result!=nullptr ? ((const uint8_t*)result)[0] : 0);
+            return result;
         }
 
         USBConfiguration* usbConfiguration(int idx){
@@ -852,19 +1586,109 @@ class USBDevice  : public USBBase {
         }
 
         void clear() {
+            for (int j=0;j<configurations.size();j++){
+                delete configurations[j];
+            }
             configurations.clear();
-            USBStrings::instance().clear();
-            USBConfigurationDescriptorData::instance().clear();
+            if (descriptor_data!=nullptr){
+                descriptor_data->bNumConfigurations = 0;
+                // the strings are removed as well
+                descriptor_data->iManufacturer = 0;
+                descriptor_data->iProduct = 0;
+                descriptor_data->iSerialNumber = 0;
+            }
+            USBStrings::instance(port).clear();
+            USBConfigurationDescriptorData::instance(port).clear();
+        }
+
+        // CRC32 over the device descriptor, the configuration descriptors and the strings: bcdDevice and the serial
+        // number are not included, so that the hash can be folded into them. Dynamic strings only count as such:
+        // their providers are not called.
+        uint32_t descriptorHash() {
+            tusb_desc_device_t device = *descriptor_ptr();
+            uint8_t serial_idx = device.iSerialNumber;
+            // the index changes when serialNumberWithHash() defines a missing serial number
+            device.bcdDevice = 0;
+            device.iSerialNumber = 0;
+            uint32_t hash = USBHash::crc32(&device, sizeof(device));
+            for (int j=0;j<usbConfigurationCount();j++){
+                // we hash what the host gets: the wTotalLength of a built configuration is only set on request
+                USBConfiguration *config = usbConfiguration(j);
+                hash = USBHash::crc32(config->configurationDescriptor(), config->blockLength(), hash);
+            }
+            USBStrings &strings = USBStrings::instance(port);
+            for (int j=1;j<=strings.size();j++){
+                if (j==serial_idx){
+                    continue;
+                }
+                if (strings.isDynamic(j)){
+                    static const uint8_t dynamic_marker = 0xff;
+                    hash = USBHash::crc32(&dynamic_marker, 1, hash);
+                    continue;
+                }
+                const char* str = strings.get(j);
+                if (str!=nullptr){
+                    hash = USBHash::crc32(str, strlen(str)+1, hash);
+                }
+            }
+            return hash;
+        }
+
+        // replaces the lower BCD digits of bcdDevice with the hash, so that the host does not use the cached driver
+        // binding of an older version of the descriptors: call it after all descriptors have been defined
+        USBDevice &bcdDeviceFromHash(int digits=2){
+            uint32_t hash = descriptorHash();
+            uint16_t bcd = descriptor_ptr()->bcdDevice;
+            for (int j=0;j<digits && j<4;j++){
+                bcd = (bcd & ~(0xf << (4*j))) | ((hash % 10) << (4*j));
+                hash /= 10;
+            }
+            descriptor_ptr()->bcdDevice = bcd;
+            return *this;
         }
 
-        // defines the total size available for the configuration descriptors and their dependent descriptors
+        // appends the hash as hex suffix to the serial number (or defines it as serial number if there is none):
+        // call it after all descriptors have been defined
+        USBDevice &serialNumberWithHash(){
+            uint32_t hash = descriptorHash();
+            USBStrings &strings = USBStrings::instance(port);
+            uint8_t idx = descriptor_ptr()->iSerialNumber;
+            // we keep a copy of the original serial number: the string (e.g. of a provider) is replaced below
+            if (idx==0 || strings.get(idx)!=hash_serial){
+                const char *base = idx==0 ? nullptr : strings.get(idx);
+                strncpy(serial_base, base==nullptr ? "" : base, sizeof(serial_base)-1);
+                serial_base[sizeof(serial_base)-1] = 0;
+            }
+            // the string descriptors are limited to 31 characters: we keep the suffix complete
+            int len = 0;
+            if (serial_base[0]!=0){
+                while(serial_base[len]!=0){
+                    hash_serial[len] = serial_base[len];
+                    len++;
+                }
+                hash_serial[len++] = '-';
+            }
+            for (int j=7;j>=0;j--){
+                hash_serial[len++] = "0123456789ABCDEF"[(hash >> (4*j)) & 0xf];
+            }
+            hash_serial[len] = 0;
+            if (idx==0){
+                descriptor_ptr()->iSerialNumber = strings.add(hash_serial);
+            } else {
+                strings.set(idx, hash_serial);
+            }
+            return *this;
+        }
+
+        // defines the total size available for the configuration descriptors and their dependent descriptors: call it before you define them
         void descriptorTotalSize(int size){
             this->descriptor_total_size = size;
-            USBConfigurationDescriptorData cd = USBConfigurationDescriptorData::instance();
+            USBConfigurationDescriptorData &cd = USBConfigurationDescriptorData::instance(port);
             if (cd.buffer_ptr!=nullptr){
                 delete cd.buffer_ptr;
             }
             cd.buffer_ptr = new Vector<uint8_t>(cd.EMPTY, size, 0);
+            cd.length = 0;
         }
 
         int getDescriptorTotalSize(){
@@ -876,9 +1700,20 @@ class USBDevice  : public USBBase {
         tusb_desc_device_t *descriptor_data;
         Vector<USBConfiguration*> configurations = Vector<USBConfiguration*>(nullptr,1,1);
         int descriptor_total_size = 225;
+        char serial_base[23] = {0};    // serial number without the hash suffix
+        char hash_serial[32];
 
         USBDevice() {}
 
+        // creates one device per device controller
+        static USBDevice *createDevices() {
+            static USBDevice devices[USB_PORT_COUNT];
+            for (int j=0;j<USB_PORT_COUNT;j++){
+                devices[j].port = j;
+            }
+            return devices;
+        }
+
         // returns access to the data
         tusb_desc_device_t *descriptor_ptr(){
             // make shure that we have some valid data
@@ -890,7 +1725,7 @@ class USBDevice  : public USBBase {
                 descriptor_data->bDeviceClass       = 0x00;
                 descriptor_data->bDeviceSubClass    = 0x00;
                 descriptor_data->bDeviceProtocol    = 0x00;
-                descriptor_data->bMaxPacketSize0    = 64;
+                descriptor_data->bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE;
                 descriptor_data->idVendor           = 0x0000;
                 descriptor_data->idProduct          = 0x0001;
                 descriptor_data->bcdDevice          = 0x0001;
@@ -907,6 +1742,44 @@ class USBDevice  : public USBBase {
         }
 };
 
+inline USBEndpoint& USBInterface::createEndpoint(bool isInput, TransferType xfer) {
+    USBEndpoint *result = new USBEndpoint(this, parent->nextEndpointNumber(isInput), isInput, xfer, port);
+    descriptor()->bNumEndpoints++;
+    endpoints.append(result);
+    return *result;
+}
+
+inline int USBConfiguration::blockLength() {
+    USBConfigurationDescriptorData &data = USBConfigurationDescriptorData::instance(port);
+    uint8_t *start = (uint8_t*) descriptor();
+    uint8_t *end = data.data() + data.totalSize();
+    for (int j=0;j<parent->usbConfigurationCount();j++){
+        uint8_t *other = (uint8_t*) parent->usbConfiguration(j)->descriptor_data;
+        if (other>start && other<end){
+            end = other;
+        }
+    }
+    return end - start;
+}
+
+// the transfer type is taken from the endpoint descriptor of the port
+inline uint8_t USBTrace::usbmonTransferType(uint8_t rhport, uint8_t ep_addr){
+    static const uint8_t usbmon_type[] = {2, 0, 3, 1}; // control, iso, bulk, interrupt
+    if (tu_edpt_number(ep_addr)==0){
+        return usbmon_type[TUSB_XFER_CONTROL];
+    }
+    USBConfigurationDescriptorData &data = USBConfigurationDescriptorData::instance(rhport);
+    uint8_t *ptr = data.data();
+    uint8_t *end = ptr + data.totalSize();
+    while(ptr<end && ptr[0]>0){
+        if (ptr[1]==TUSB_DESC_ENDPOINT && ptr[2]==ep_addr){
+            return usbmon_type[ptr[3] & 0b11];
+        }
+        ptr += ptr[0];
+    }
+    return usbmon_type[TUSB_XFER_BULK];
+}
+
 #ifdef STREAM_SUPPORT
 #include "Stream.h"
 
@@ -917,7 +1790,7 @@ class USBDevice  : public USBBase {
 class USBDump {
     public:
         // dumps the descriptor to the indicated ouput stream
-        static void dump(Stream &out, void ptr, int len){
+        static void dump(Stream &out, void *ptr, int len){
             uint8_t *char_ptr = (uint8_t *)ptr;
             out.print("uint8_t descriptor[] = {");
             out.print("  ");
@@ -928,6 +1801,15 @@ class USBDump {
             out.println(char_ptr[len-1]);
             out.println("};");
         }
+
+        // writes the recorded USBTrace in the pcap (usbmon) format to the indicated stream
+        static int dumpTrace(Stream &out){
+            return USBTrace::instance().writePcap([&out](const uint8_t *data, size_t len){ out.write(data, len); });
+        }
 };
 
 #endif
+
+#if defined(__cpp_impl_coroutine)
+#include "USBCoroutine.h"
+#endif
@@ -0,0 +1,274 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Diff between two finalized descriptor blobs (e.g. the configuration descriptor before and after a runtime
+ * change of bMaxPower or of the packet size of an alternate setting).
+ *
+ * If the layout is unchanged (same sequence of descriptor types and lengths) the difference is described by byte
+ * range patches which can be applied in place: the USBInterface and USBEndpoint objects which point into the
+ * descriptor buffer stay valid, so there is no need for USBDevice::clear(). Otherwise the descriptors are matched by
+ * their identity (interface number and alternate setting, endpoint address, position within the interface) and the
+ * added, removed and resized descriptors are reported as structural changes.
+ *
+ * The host caches the device and configuration descriptors during the enumeration, so any change of them requires
+ * a re-enumeration if the device is already mounted. Strings are requested on demand and only need a re-enumeration
+ * if the host has cached them.
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+
+enum USBDiffKind {DiffModified, DiffAdded, DiffRemoved, DiffResized, DiffString};
+
+/**
+ * @brief Bytes which need to be written at the offset of the old blob: the data points into the new blob
+ */
+struct USBDescriptorPatch {
+    uint16_t offset;
+    uint16_t len;
+    const uint8_t *data;
+};
+
+/**
+ * @brief Change of a single descriptor (or string)
+ */
+struct USBStructuralChange {
+    USBDiffKind kind;
+    uint8_t desc_type;    // descriptor type or TUSB_DESC_STRING
+    int32_t old_offset;   // -1 if the descriptor was added; string index for DiffString
+    int32_t new_offset;   // -1 if the descriptor was removed
+};
+
+class USBDescriptorDiff {
+    public:
+        // compares two descriptor blobs: returns true if they differ
+        bool compare(const uint8_t *old_blob, int old_len, const uint8_t *new_blob, int new_len){
+            clear();
+            Vector<Entry> old_entries = Vector<Entry>(Entry(), 16, 16);
+            Vector<Entry> new_entries = Vector<Entry>(Entry(), 16, 16);
+            scan(old_blob, old_len, old_entries);
+            scan(new_blob, new_len, new_entries);
+            same_layout = old_len==new_len && old_entries.size()==new_entries.size();
+            for (int j=0; same_layout && j<old_entries.size(); j++){
+                same_layout = old_entries[j].len==new_entries[j].len && old_entries[j].type==new_entries[j].type;
+            }
+            if (same_layout){
+                diffBytes(old_blob, new_blob, old_len);
+                // report the modified descriptors
+                for (int j=0;j<old_entries.size();j++){
+                    Entry &e = old_entries[j];
+                    if (memcmp(old_blob+e.offset, new_blob+e.offset, e.len)!=0){
+                        addChange(DiffModified, e.type, e.offset, e.offset);
+                    }
+                }
+            } else {
+                diffStructure(old_blob, old_entries, new_blob, new_entries);
+            }
+            return hasChanges();
+        }
+
+        // compares the strings by index and adds the changes: returns true if they differ
+        bool compareStrings(const char* const *old_strings, int old_count, const char* const *new_strings, int new_count){
+            bool result = false;
+            int count = old_count>new_count ? old_count : new_count;
+            for (int j=0;j<count;j++){
+                const char* o = j<old_count ? old_strings[j] : nullptr;
+                const char* n = j<new_count ? new_strings[j] : nullptr;
+                if ((o==nullptr) != (n==nullptr) || (o!=nullptr && strcmp(o, n)!=0)){
+                    // the string indexes start with 1
+                    addChange(DiffString, TUSB_DESC_STRING, j+1, j+1);
+                    string_changes++;
+                    result = true;
+                }
+            }
+            return result;
+        }
+
+        void clear() {
+            patches.clear();
+            changes.clear();
+            same_layout = true;
+            string_changes = 0;
+        }
+
+        bool hasChanges() {
+            return changes.size()>0;
+        }
+
+        // true if the patches can be applied in place
+        bool sameLayout() {
+            return same_layout;
+        }
+
+        // true if the host needs to enumerate the device again to see the changes of the descriptors
+        bool needsReEnumeration(bool mounted=true) {
+            return mounted && changes.size()>string_changes;
+        }
+
+        int patchCount() {
+            return patches.size();
+        }
+
+        USBDescriptorPatch &patch(int idx){
+            return patches[idx];
+        }
+
+        // number of bytes which are written by the patches
+        int patchBytes() {
+            int result = 0;
+            for (int j=0;j<patches.size();j++){
+                result += patches[j].len;
+            }
+            return result;
+        }
+
+        int changeCount() {
+            return changes.size();
+        }
+
+        USBStructuralChange &change(int idx){
+            return changes[idx];
+        }
+
+        // applies the patches in place: only possible if the layout is unchanged
+        bool apply(uint8_t *target, int len){
+            if (!same_layout){
+                return false;
+            }
+            for (int j=0;j<patches.size();j++){
+                USBDescriptorPatch &p = patches[j];
+                if (p.offset + p.len > len){
+                    return false;
+                }
+            }
+            for (int j=0;j<patches.size();j++){
+                memcpy(target + patches[j].offset, patches[j].data, patches[j].len);
+            }
+            return true;
+        }
+
+        // compares the configuration descriptor of the device with the new one and applies the patches to the
+        // descriptor buffer of the indicated port if possible: returns false if the layout has changed and the tree
+        // needs to be rebuilt
+        bool update(const uint8_t *new_blob, int new_len, uint8_t rhport=0){
+            USBConfigurationDescriptorData &cd = USBConfigurationDescriptorData::instance(rhport);
+            compare(cd.data(), cd.totalSize(), new_blob, new_len);
+            return apply(cd.data(), cd.totalSize());
+        }
+
+    protected:
+        // descriptor with its identity
+        struct Entry {
+            uint16_t offset = 0;
+            uint8_t len = 0;
+            uint8_t type = 0;
+            uint32_t key = 0;
+            bool matched = false;
+        };
+        Vector<USBDescriptorPatch> patches = Vector<USBDescriptorPatch>(USBDescriptorPatch{0, 0, nullptr}, 8, 8);
+        Vector<USBStructuralChange> changes = Vector<USBStructuralChange>(USBStructuralChange{DiffModified, 0, -1, -1}, 8, 8);
+        bool same_layout = true;
+        int string_changes = 0;
+
+        // determines the descriptors and their identity: interface number and alternate setting, endpoint address
+        // or the position of the descriptor type within the interface
+        void scan(const uint8_t *blob, int len, Vector<Entry> &entries){
+            uint8_t itf = 0xff, alt = 0xff;
+            uint8_t ordinal[256];
+            memset(ordinal, 0, sizeof(ordinal));
+            int pos = 0;
+            while(pos+2<=len && blob[pos]>=2 && pos+blob[pos]<=len){
+                Entry e;
+                e.offset = pos;
+                e.len = blob[pos];
+                e.type = blob[pos+1];
+                if (e.type==TUSB_DESC_INTERFACE && e.len>=4){
+                    itf = blob[pos+2];
+                    alt = blob[pos+3];
+                    memset(ordinal, 0, sizeof(ordinal));
+                    e.key = key(e.type, itf, alt, 0);
+                } else if (e.type==TUSB_DESC_ENDPOINT && e.len>=3){
+                    e.key = key(e.type, itf, alt, blob[pos+2]);
+                } else {
+                    e.key = key(e.type, itf, alt, ordinal[e.type]++);
+                }
+                entries.append(e);
+                pos += blob[pos];
+            }
+        }
+
+        static uint32_t key(uint8_t type, uint8_t itf, uint8_t alt, uint8_t id){
+            return ((uint32_t)type << 24) | ((uint32_t)itf << 16) | ((uint32_t)alt << 8) | id;
+        }
+
+        // byte range patches of blobs with the same layout
+        void diffBytes(const uint8_t *old_blob, const uint8_t *new_blob, int len){
+            int j = 0;
+            while(j<len){
+                if (old_blob[j]==new_blob[j]){
+                    j++;
+                    continue;
+                }
+                int start = j;
+                while(j<len && old_blob[j]!=new_blob[j]) j++;
+                USBDescriptorPatch p = {(uint16_t)start, (uint16_t)(j-start), new_blob+start};
+                patches.append(p);
+            }
+        }
+
+        void diffStructure(const uint8_t *old_blob, Vector<Entry> &old_entries, const uint8_t *new_blob, Vector<Entry> &new_entries){
+            for (int j=0;j<old_entries.size();j++){
+                Entry &o = old_entries[j];
+                Entry *n = nullptr;
+                for (int i=0;i<new_entries.size();i++){
+                    if (!new_entries[i].matched && new_entries[i].key==o.key){
+                        n = &new_entries[i];
+                        break;
+                    }
+                }
+                if (n==nullptr){
+                    addChange(DiffRemoved, o.type, o.offset, -1);
+                    continue;
+                }
+                n->matched = true;
+                if (n->len!=o.len){
+                    addChange(DiffResized, o.type, o.offset, n->offset);
+                } else if (memcmp(old_blob+o.offset, new_blob+n->offset, o.len)!=0){
+                    addChange(DiffModified, o.type, o.offset, n->offset);
+                }
+            }
+            for (int i=0;i<new_entries.size();i++){
+                if (!new_entries[i].matched){
+                    addChange(DiffAdded, new_entries[i].type, -1, new_entries[i].offset);
+                }
+            }
+        }
+
+        void addChange(USBDiffKind kind, uint8_t type, int old_offset, int new_offset){
+            USBStructuralChange c = {kind, type, old_offset, new_offset};
+            changes.append(c);
+        }
+};
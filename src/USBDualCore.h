@@ -0,0 +1,422 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Dual core mode: tud_task() and the class layers run on the USB core (core 1 on the RP2040) while the
+ * application (e.g. the DSP) runs on the other core. The cores only exchange buffer descriptors (pointer and
+ * length) through two single producer/single consumer rings - the data itself is never copied:
+ *
+ *   // application core
+ *   USBDualCore &dual = USBDualCore::instance();
+ *   dual.launch(setup);                             // RP2040: starts core 1 which calls setup() and usbRun()
+ *   dual.submit(0x01, rx_buffer, sizeof(rx_buffer)); // the buffer belongs to the USB core until it is returned
+ *   USBBufferDescriptor done;
+ *   if (dual.receive(done, 10)) process(done.data, done.len);
+ *
+ * The submitted buffers are transferred with USBEndpoint::xfer() on the USB core and are returned with the
+ * transferred length when the transfer has completed: the completed transfers need to be reported to the endpoints,
+ * e.g. with USBRunLoop::transferCompletedCb() or USBDevice::transferCompletedCb().
+ *
+ * On the RP2040 (pico_multicore) the other core is notified with the SIO FIFO: the USB core wakes up its USBRunLoop
+ * in the SIO interrupt. Otherwise C++11 atomics are used with a condition variable on Linux, so that the two sides
+ * can be tested with two threads. Define USB_DUALCORE_GENERIC to use the generic variant on the RP2040 as well.
+ */
+
+#pragma once
+#include "USBRunLoop.h"
+#include <atomic>
+
+#if defined(LIB_PICO_MULTICORE) && !defined(USB_DUALCORE_GENERIC)
+#define USB_DUALCORE_SIO
+#include "pico/multicore.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#elif defined(__linux__) || defined(TINYUSB_CPP_HOST_PORT)
+#define USB_DUALCORE_CONDITION_VARIABLE
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#endif
+
+// number of entries of each ring: must be a power of 2
+#ifndef USB_DUALCORE_RING_SIZE
+#define USB_DUALCORE_RING_SIZE 16
+#endif
+
+// maximum number of buffers which are owned by the USB core at the same time
+#ifndef USB_DUALCORE_SLOTS
+#define USB_DUALCORE_SLOTS 8
+#endif
+
+// value which is written to the SIO FIFO
+#define USB_DUALCORE_DOORBELL 0x55534244
+
+/**
+ * @brief Buffer which is exchanged between the cores: the data is owned by the USB core from submit() until it is
+ * returned by receive()
+ */
+struct USBBufferDescriptor {
+    uint8_t *data;
+    uint32_t len;       // requested length and after the completion the transferred length
+    uint8_t ep_addr;
+    uint8_t rhport;
+    uint8_t result;     // xfer_result_t of the completed transfer
+    void *ref;          // for the application
+};
+
+/**
+ * @brief Lock free ring for exactly one producer and one consumer: only C++11 atomics are needed. The producer
+ * owns head and the consumer owns tail.
+ */
+template <class T, uint32_t N>
+class USBSpscRing {
+    static_assert((N & (N-1))==0, "the size must be a power of 2");
+    public:
+        // called by the producer: returns false if the ring is full
+        bool push(const T &value){
+            uint32_t head = head_.load(std::memory_order_relaxed);
+            if (head - tail_.load(std::memory_order_acquire) >= N){
+                return false;
+            }
+            data[head & (N-1)] = value;
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // called by the consumer: returns false if the ring is empty
+        bool pop(T &value){
+            uint32_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail==head_.load(std::memory_order_acquire)){
+                return false;
+            }
+            value = data[tail & (N-1)];
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        uint32_t size() {
+            return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+        }
+
+        bool empty() {
+            return size()==0;
+        }
+
+        static constexpr uint32_t capacity() {
+            return N;
+        }
+
+        // only valid when both sides are idle
+        void clear() {
+            head_.store(0);
+            tail_.store(0);
+        }
+
+    protected:
+        T data[N];
+        std::atomic<uint32_t> head_{0};
+        std::atomic<uint32_t> tail_{0};
+};
+
+class USBDualCore {
+    public:
+        static USBDualCore &instance() {
+            static USBDualCore inst;
+            return inst;
+        }
+
+#if defined(USB_DUALCORE_SIO)
+        // starts the USB core: core 1 calls setup() (e.g. tusb_init()) and processes the USB events until stop()
+        void launch(void (*setup)()=nullptr){
+            setup_cb = setup;
+            multicore_launch_core1(core1Main);
+        }
+#endif
+
+        // --- application core
+
+        // hands the buffer over to the USB core: returns false if the ring is full
+        bool submit(uint8_t ep_addr, uint8_t *data, uint32_t len, void *ref=nullptr, uint8_t rhport=0){
+            USBBufferDescriptor desc = {data, len, ep_addr, rhport, XFER_RESULT_SUCCESS, ref};
+            if (!to_usb.push(desc)){
+                ring_full++;
+                return false;
+            }
+            submitted++;
+            ringUsb();
+            return true;
+        }
+
+        // provides the next buffer which has been returned by the USB core
+        bool receive(USBBufferDescriptor &desc){
+            return to_app.pop(desc);
+        }
+
+        // waits up to timeout_ms for the next returned buffer
+        bool receive(USBBufferDescriptor &desc, uint32_t timeout_ms){
+            if (to_app.pop(desc)){
+                return true;
+            }
+#if defined(USB_DUALCORE_CONDITION_VARIABLE)
+            std::unique_lock<std::mutex> lock(app_mutex);
+            auto available = [this](){ return !to_app.empty(); };
+            if (timeout_ms==USB_RUNLOOP_FOREVER){
+                app_condition.wait(lock, available);
+            } else {
+                app_condition.wait_for(lock, std::chrono::milliseconds(timeout_ms), available);
+            }
+#else
+            uint64_t end = USBClock::micros() + (uint64_t) timeout_ms * 1000;
+            while(to_app.empty()){
+#if defined(USB_DUALCORE_SIO)
+                // the doorbell only wakes us up: the descriptors are in the ring
+                while(multicore_fifo_rvalid()) (void) sio_hw->fifo_rd;
+#endif
+                if (timeout_ms!=USB_RUNLOOP_FOREVER && USBClock::micros()>=end){
+                    break;
+                }
+#if defined(__ARM_ARCH)
+                __asm volatile ("wfe");
+#endif
+            }
+#endif
+            return to_app.pop(desc);
+        }
+
+        // --- USB core
+
+        // starts the submitted transfers, waits for the next event and processes it with tud_task()
+        int usbStep(uint32_t timeout_ms=USB_RUNLOOP_FOREVER){
+            startTransfers();
+            int result = USBRunLoop::instance().step(timeout_ms);
+            startTransfers();
+            return result;
+        }
+
+        // processes the USB events until stop() is called
+        void usbRun() {
+            active = true;
+            while(active){
+                usbStep();
+            }
+        }
+
+        // ends usbRun()
+        void stop() {
+            active = false;
+            USBRunLoop::instance().signal();
+        }
+
+        // moves the submitted buffers into free slots, starts the transfers of the idle endpoints and returns the
+        // completed buffers
+        void startTransfers() {
+            // take over the new buffers
+            for (int j=0;j<USB_DUALCORE_SLOTS;j++){
+                if (slots[j].state==SlotFree){
+                    if (!to_usb.pop(slots[j].desc)){
+                        break;
+                    }
+                    slots[j].state = SlotWaiting;
+                    slots[j].seq = next_seq++;
+                }
+            }
+            for (int j=0;j<USB_DUALCORE_SLOTS;j++){
+                if (slots[j].state==SlotWaiting && isNext(j)){
+                    start(slots[j]);
+                }
+            }
+            // return the completed buffers
+            for (int j=0;j<USB_DUALCORE_SLOTS;j++){
+                if (slots[j].state==SlotDone){
+                    if (!to_app.push(slots[j].desc)){
+                        break;
+                    }
+                    slots[j].state = SlotFree;
+                    completed++;
+                    ringApp();
+                }
+            }
+        }
+
+        // USB core: the transfers of the port have been aborted by a bus reset or unmount (e.g. call it in
+        // tud_umount_cb()), so the active buffers are returned as failed with the next startTransfers()
+        void busReset(uint8_t rhport=0) {
+            for (int j=0;j<USB_DUALCORE_SLOTS;j++){
+                if (slots[j].state==SlotActive && slots[j].desc.rhport==rhport){
+                    USBEndpoint *ep = endpoint(rhport, slots[j].desc.ep_addr);
+                    if (ep!=nullptr) ep->setTransferListener(nullptr, nullptr);
+                    fail(slots[j]);
+                }
+            }
+        }
+
+        // number of buffers which are owned by the USB core
+        int pendingCount() {
+            int result = to_usb.size();
+            for (int j=0;j<USB_DUALCORE_SLOTS;j++){
+                if (slots[j].state!=SlotFree) result++;
+            }
+            return result;
+        }
+
+        uint32_t submittedCount() { return submitted; }
+        uint32_t completedCount() { return completed; }
+        uint32_t ringFullCount() { return ring_full; }
+
+        // resets the rings and slots: only valid when both sides are idle
+        void clear() {
+            to_usb.clear();
+            to_app.clear();
+            for (int j=0;j<USB_DUALCORE_SLOTS;j++){
+                slots[j].state = SlotFree;
+            }
+            submitted = completed = ring_full = 0;
+        }
+
+    protected:
+        enum SlotState {SlotFree, SlotWaiting, SlotActive, SlotDone};
+        struct Slot {
+            USBBufferDescriptor desc;
+            SlotState state = SlotFree;
+            uint32_t seq = 0;
+        };
+        USBSpscRing<USBBufferDescriptor, USB_DUALCORE_RING_SIZE> to_usb;
+        USBSpscRing<USBBufferDescriptor, USB_DUALCORE_RING_SIZE> to_app;
+        // the slots are only used by the USB core
+        Slot slots[USB_DUALCORE_SLOTS];
+        uint32_t next_seq = 0;
+        std::atomic<bool> active{false};
+        // submitted and ring_full are updated by the application core, completed by the USB core
+        std::atomic<uint32_t> submitted{0};
+        std::atomic<uint32_t> completed{0};
+        std::atomic<uint32_t> ring_full{0};
+#if defined(USB_DUALCORE_CONDITION_VARIABLE)
+        std::mutex app_mutex;
+        std::condition_variable app_condition;
+#endif
+#if defined(USB_DUALCORE_SIO)
+        void (*setup_cb)() = nullptr;
+
+        static void core1Main() {
+            USBDualCore &self = instance();
+            multicore_fifo_clear_irq();
+            irq_set_exclusive_handler(SIO_IRQ_PROC1, sioIrq);
+            irq_set_enabled(SIO_IRQ_PROC1, true);
+            if (self.setup_cb!=nullptr) self.setup_cb();
+            self.usbRun();
+        }
+
+        // doorbell of the application core
+        static void sioIrq() {
+            while(multicore_fifo_rvalid()) (void) sio_hw->fifo_rd;
+            multicore_fifo_clear_irq();
+            USBRunLoop::instance().signal(true);
+        }
+#endif
+
+        USBDualCore() = default;
+
+        // wakes up the USB core
+        void ringUsb() {
+#if defined(USB_DUALCORE_SIO)
+            // a full FIFO already contains a doorbell
+            if (multicore_fifo_wready()){
+                sio_hw->fifo_wr = USB_DUALCORE_DOORBELL;
+                __sev();
+            }
+#else
+            USBRunLoop::instance().signal();
+#endif
+        }
+
+        // wakes up the application core
+        void ringApp() {
+#if defined(USB_DUALCORE_SIO)
+            if (multicore_fifo_wready()){
+                sio_hw->fifo_wr = USB_DUALCORE_DOORBELL;
+                __sev();
+            }
+#elif defined(USB_DUALCORE_CONDITION_VARIABLE)
+            // the lock makes sure that the waiting thread does not miss the notification
+            { std::lock_guard<std::mutex> lock(app_mutex); }
+            app_condition.notify_one();
+#elif defined(__ARM_ARCH)
+            __asm volatile ("sev");
+#endif
+        }
+
+        // the buffers of an endpoint are transferred and returned in the submitted order
+        bool isNext(int idx){
+            for (int j=0;j<USB_DUALCORE_SLOTS;j++){
+                if (j!=idx && slots[j].state!=SlotFree
+                && slots[j].desc.ep_addr==slots[idx].desc.ep_addr && slots[j].desc.rhport==slots[idx].desc.rhport
+                && (slots[j].state!=SlotWaiting || (int32_t)(slots[j].seq - slots[idx].seq) < 0)){
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void start(Slot &slot){
+            USBEndpoint *ep = endpoint(slot.desc.rhport, slot.desc.ep_addr);
+            if (ep==nullptr){
+                fail(slot);
+                return;
+            }
+            // the endpoint is still busy: we try again later
+            if (usbd_edpt_busy(slot.desc.rhport, slot.desc.ep_addr)){
+                return;
+            }
+            slot.state = SlotActive;
+            ep->setTransferListener(transferCompleted, &slot);
+            if (!ep->xfer(slot.desc.data, slot.desc.len, slot.desc.rhport)){
+                // e.g. the device is not mounted or the endpoint is closed: retrying would not help
+                ep->setTransferListener(nullptr, nullptr);
+                fail(slot);
+            }
+        }
+
+        void fail(Slot &slot){
+            slot.desc.len = 0;
+            slot.desc.result = XFER_RESULT_FAILED;
+            slot.state = SlotDone;
+        }
+
+        USBEndpoint *endpoint(uint8_t rhport, uint8_t ep_addr){
+            USBDevice &device = USBDevice::instance(rhport);
+            for (int j=0;j<device.usbConfigurationCount();j++){
+                USBEndpoint *ep = device.usbConfiguration(j)->usbEndpoint(ep_addr);
+                if (ep!=nullptr) return ep;
+            }
+            return nullptr;
+        }
+
+        static void transferCompleted(void *ref, xfer_result_t result, uint32_t xferred_bytes){
+            Slot *slot = (Slot*) ref;
+            slot->desc.len = xferred_bytes;
+            slot->desc.result = result;
+            slot->state = SlotDone;
+        }
+};
@@ -0,0 +1,278 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Estimates the control transfers of an enumeration for a given bMaxPacketSize0: every GET_DESCRIPTOR
+ * request costs a SETUP packet, ceil(len / bMaxPacketSize0) data packets, a zero length packet if the descriptor
+ * is a multiple of the packet size but shorter than the requested length, and the status packet.
+ *
+ * A descriptor which ends just past a packet boundary (by at most USB_EP0_BOUNDARY_SLACK bytes) costs a full
+ * additional packet for a few bytes: removing a string or a descriptor might save a transaction. At full speed with
+ * 8 or 16 byte control packets this adds up.
+ *
+ * The sequence follows the Windows and Linux host drivers: the device descriptor is requested with a length of 64
+ * before and with 18 after SET_ADDRESS, the configuration descriptor first with 9 bytes and then with wTotalLength,
+ * and the strings with 255 bytes.
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+
+// a descriptor which exceeds a packet boundary by up to this number of bytes is reported
+#ifndef USB_EP0_BOUNDARY_SLACK
+#define USB_EP0_BOUNDARY_SLACK 4
+#endif
+
+// maximum EP0 packet size of the device controller (e.g. 8 for some low speed capable controllers)
+#ifndef USB_EP0_CONTROLLER_MAX
+#define USB_EP0_CONTROLLER_MAX 64
+#endif
+
+/**
+ * @brief A single control transfer of the enumeration
+ */
+struct USBEnumerationStep {
+    uint8_t request;        // TUSB_REQ_GET_DESCRIPTOR, TUSB_REQ_SET_ADDRESS or TUSB_REQ_SET_CONFIGURATION
+    uint8_t desc_type;      // descriptor type for GET_DESCRIPTOR
+    uint8_t desc_index;
+    uint16_t requested;     // wLength of the request
+    uint16_t len;           // length of the data stage
+    uint16_t packets;       // data packets including the zero length packet
+    bool zlp;               // a zero length packet terminates the data stage
+    bool near_boundary;     // the last data packet only contains a few bytes
+};
+
+class USBEnumerationPlanner {
+    public:
+        // provides the largest valid bMaxPacketSize0 which is supported by the controller and CFG_TUD_ENDPOINT0_SIZE
+        static uint8_t largestPacketSize0(int controller_max=USB_EP0_CONTROLLER_MAX){
+            int limit = controller_max < CFG_TUD_ENDPOINT0_SIZE ? controller_max : CFG_TUD_ENDPOINT0_SIZE;
+            for (int size=64; size>8; size/=2){
+                if (size<=limit) return size;
+            }
+            return 8;
+        }
+
+        // number of data packets (without the zero length packet) for the indicated length
+        static int packets(int len, uint8_t packet_size0){
+            return (len + packet_size0 - 1) / packet_size0;
+        }
+
+        // checks if the descriptor exceeds a packet boundary by at most USB_EP0_BOUNDARY_SLACK bytes
+        static bool nearBoundary(int len, uint8_t packet_size0){
+            int rest = len % packet_size0;
+            return len > packet_size0 && rest>0 && rest<=USB_EP0_BOUNDARY_SLACK;
+        }
+
+        // sets bMaxPacketSize0 of the device to the largest supported value and returns it
+        static uint8_t selectPacketSize0(USBDevice &device, int controller_max=USB_EP0_CONTROLLER_MAX){
+            uint8_t result = largestPacketSize0(controller_max);
+            device.bMaxPacketSize0(result);
+            return result;
+        }
+
+        // determines the control transfers for the device: 0 = use bMaxPacketSize0 of the device descriptor
+        int plan(USBDevice &device, uint8_t packet_size0=0){
+            clear();
+            const tusb_desc_device_t *dev = device.descriptor();
+            packet_size = packet_size0!=0 ? packet_size0 : dev->bMaxPacketSize0;
+            if (packet_size==0){
+                packet_size = CFG_TUD_ENDPOINT0_SIZE;
+            }
+
+            // the device descriptor is requested once before and once after the address has been assigned
+            addDescriptor(TUSB_DESC_DEVICE, 0, 64, dev->bLength);
+            addRequest(TUSB_REQ_SET_ADDRESS);
+            addDescriptor(TUSB_DESC_DEVICE, 0, dev->bLength, dev->bLength);
+
+            // referenced string indexes
+            uint8_t strings[256] = {0};
+            strings[dev->iManufacturer] = 1;
+            strings[dev->iProduct] = 1;
+            strings[dev->iSerialNumber] = 1;
+
+            // the configurations are stored one after the other in the descriptor buffer
+            USBConfigurationDescriptorData &data = USBConfigurationDescriptorData::instance(device.rhport());
+            const uint8_t *start = data.data();
+            const uint8_t *end = start + data.totalSize();
+            const uint8_t *config = nullptr;
+            int config_idx = 0;
+            for (const uint8_t *ptr = start; ptr+2<=end && ptr[0]>=2 && ptr+ptr[0]<=end; ptr += ptr[0]){
+                switch(ptr[1]){
+                    case TUSB_DESC_CONFIGURATION:
+                        if (config!=nullptr){
+                            addConfiguration(config_idx++, ptr - config);
+                        }
+                        config = ptr;
+                        strings[ptr[6]] = 1;
+                        break;
+                    case TUSB_DESC_INTERFACE_ASSOCIATION:
+                        strings[ptr[7]] = 1;
+                        break;
+                    case TUSB_DESC_INTERFACE:
+                        strings[ptr[8]] = 1;
+                        break;
+                    default:
+                        break;
+                }
+            }
+            if (config!=nullptr){
+                addConfiguration(config_idx, end - config);
+            }
+
+            // the language ids are only requested if there are strings
+            strings[0] = 0;
+            bool has_strings = false;
+            for (int idx=1; idx<256; idx++){
+                has_strings |= strings[idx]!=0;
+            }
+            if (has_strings){
+                const uint8_t *lang = (const uint8_t*) USBStrings::instance(device.rhport()).string(0);
+                addDescriptor(TUSB_DESC_STRING, 0, 255, lang[0]);
+            }
+            USBStrings &str = USBStrings::instance(device.rhport());
+            for (int idx=1; idx<256; idx++){
+                if (strings[idx]!=0 && idx<=str.size() && str.get(idx)!=nullptr){
+                    const uint8_t *desc = (const uint8_t*) str.string(idx);
+                    addDescriptor(TUSB_DESC_STRING, idx, 255, desc[0]);
+                }
+            }
+            addRequest(TUSB_REQ_SET_CONFIGURATION);
+            return steps.size();
+        }
+
+        // bMaxPacketSize0 which was used for the plan
+        uint8_t packetSize0() {
+            return packet_size;
+        }
+
+        int stepCount() {
+            return steps.size();
+        }
+
+        USBEnumerationStep &step(int idx){
+            return steps[idx];
+        }
+
+        // number of control transfers for the full enumeration
+        int controlTransfers() {
+            return steps.size();
+        }
+
+        // number of data packets of all control transfers
+        int dataPackets() {
+            int result = 0;
+            for (int j=0;j<steps.size();j++){
+                result += steps[j].packets;
+            }
+            return result;
+        }
+
+        // number of packets including the SETUP and the status stage
+        int totalPackets() {
+            return dataPackets() + 2 * steps.size();
+        }
+
+        // number of descriptors which exceed a packet boundary by a few bytes
+        int warningCount() {
+            int result = 0;
+            for (int j=0;j<steps.size();j++){
+                result += steps[j].near_boundary;
+            }
+            return result;
+        }
+
+        // writes the plan line by line with the help of the printer: void printer(const char* line)
+        template<class Printer>
+        void report(Printer printer){
+            char line[80];
+            snprintf(line, sizeof(line), "bMaxPacketSize0: %d", packet_size);
+            printer(line);
+            for (int j=0;j<steps.size();j++){
+                USBEnumerationStep &s = steps[j];
+                if (s.request!=TUSB_REQ_GET_DESCRIPTOR){
+                    snprintf(line, sizeof(line), "%-24s", s.request==TUSB_REQ_SET_ADDRESS ? "SET_ADDRESS" : "SET_CONFIGURATION");
+                } else {
+                    snprintf(line, sizeof(line), "%-13s %-3d %3d/%-3d %2d packets%s%s", descriptorName(s.desc_type), s.desc_index,
+                        s.len, s.requested, s.packets, s.zlp ? " (zlp)" : "",
+                        s.near_boundary ? " WARNING: just past a packet boundary" : "");
+                }
+                printer(line);
+            }
+            snprintf(line, sizeof(line), "control transfers: %d, data packets: %d, total packets: %d, warnings: %d",
+                controlTransfers(), dataPackets(), totalPackets(), warningCount());
+            printer(line);
+        }
+
+#if defined(__linux__) || defined(TINYUSB_CPP_HOST_PORT)
+        // writes the report to the indicated file (e.g. stdout)
+        void report(FILE *file){
+            report([file](const char* line){ fprintf(file, "%s\n", line); });
+        }
+#endif
+
+        void clear() {
+            steps.clear();
+        }
+
+    protected:
+        Vector<USBEnumerationStep> steps = Vector<USBEnumerationStep>(USBEnumerationStep(), 16, 16);
+        uint8_t packet_size = CFG_TUD_ENDPOINT0_SIZE;
+
+        void addRequest(uint8_t request){
+            USBEnumerationStep s = {request, 0, 0, 0, 0, 0, false, false};
+            steps.append(s);
+        }
+
+        void addDescriptor(uint8_t type, uint8_t idx, uint16_t requested, uint16_t desc_len){
+            USBEnumerationStep s = {TUSB_REQ_GET_DESCRIPTOR, type, idx, requested, 0, 0, false, false};
+            s.len = desc_len < requested ? desc_len : requested;
+            s.packets = packets(s.len, packet_size);
+            // a short transfer which ends on a packet boundary needs a zero length packet
+            s.zlp = s.len < requested && s.len % packet_size == 0;
+            s.packets += s.zlp;
+            // the size of the device descriptor and of partial reads is fixed: only report what could be shortened
+            s.near_boundary = type!=TUSB_DESC_DEVICE && desc_len<=requested && nearBoundary(s.len, packet_size);
+            steps.append(s);
+        }
+
+        void addConfiguration(int idx, int len){
+            addDescriptor(TUSB_DESC_CONFIGURATION, idx, sizeof(tusb_desc_configuration_t), len);
+            addDescriptor(TUSB_DESC_CONFIGURATION, idx, len, len);
+        }
+
+        static const char* descriptorName(uint8_t type){
+            switch(type){
+                case TUSB_DESC_DEVICE:
+                    return "device";
+                case TUSB_DESC_CONFIGURATION:
+                    return "configuration";
+                case TUSB_DESC_STRING:
+                    return "string";
+                default:
+                    return "other";
+            }
+        }
+};
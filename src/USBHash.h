@@ -0,0 +1,51 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief CRC32 (IEEE 802.3, as used by zlib) of descriptor data. We use a table of 16 entries which is processed
+ * per nibble: this is a good compromise between speed and flash size on small microcontrollers.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+class USBHash {
+    public:
+        // calculates the CRC32: pass the result of the previous call as crc to continue over multiple blocks
+        static uint32_t crc32(const void *data, size_t len, uint32_t crc=0){
+            static const uint32_t table[16] = {
+                0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+                0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+            };
+            const uint8_t *ptr = (const uint8_t*) data;
+            crc = ~crc;
+            for (size_t j=0;j<len;j++){
+                crc = table[(crc ^ ptr[j]) & 0x0f] ^ (crc >> 4);
+                crc = table[(crc ^ (ptr[j] >> 4)) & 0x0f] ^ (crc >> 4);
+            }
+            return ~crc;
+        }
+};
@@ -0,0 +1,117 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Heap accounting for the tests and benchmarks: we replace the global operator new and delete and record the
+ * current and the peak number of allocated bytes and the number of allocations. This file defines the global
+ * operators, so include it in exactly one translation unit of an executable - it is not included by the library.
+ */
+
+#pragma once
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+
+class USBHeapAccounting {
+    public:
+        static USBHeapAccounting &instance() {
+            static USBHeapAccounting inst;
+            return inst;
+        }
+
+        void allocated(size_t size){
+            current_bytes += size;
+            allocation_count++;
+            if (current_bytes>peak_bytes) peak_bytes = current_bytes;
+        }
+
+        void released(size_t size){
+            current_bytes -= size;
+        }
+
+        // restarts the peak measurement from the current allocation
+        void resetPeak() {
+            peak_bytes = current_bytes;
+        }
+
+        size_t current() {
+            return current_bytes;
+        }
+
+        size_t peak() {
+            return peak_bytes;
+        }
+
+        size_t allocations() {
+            return allocation_count;
+        }
+
+    protected:
+        size_t current_bytes = 0;
+        size_t peak_bytes = 0;
+        size_t allocation_count = 0;
+};
+
+// we store the size in front of the allocated memory
+static const size_t usb_heap_header = 16;
+
+void* operator new(size_t size){
+    size_t *ptr = (size_t*) malloc(size + usb_heap_header);
+    if (ptr==nullptr){
+#if defined(__cpp_exceptions)
+        throw std::bad_alloc();
+#else
+        abort();
+#endif
+    }
+    ptr[0] = size;
+    USBHeapAccounting::instance().allocated(size);
+    return (uint8_t*)ptr + usb_heap_header;
+}
+
+void operator delete(void *data) noexcept {
+    if (data==nullptr){
+        return;
+    }
+    size_t *ptr = (size_t*)((uint8_t*)data - usb_heap_header);
+    USBHeapAccounting::instance().released(ptr[0]);
+    free(ptr);
+}
+
+void* operator new[](size_t size){
+    return operator new(size);
+}
+
+void operator delete[](void *data) noexcept {
+    operator delete(data);
+}
+
+void operator delete(void *data, size_t) noexcept {
+    operator delete(data);
+}
+
+void operator delete[](void *data, size_t) noexcept {
+    operator delete(data);
+}
@@ -0,0 +1,243 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief LRU cache of host mode descriptor views: devices which are attached again (e.g. after a brownout) are
+ * identified by VID/PID/bcdDevice and the CRC32 of their configuration descriptor, so that we can skip the parsing
+ * and the driver matching. Each entry keeps a copy of the descriptor and the result of the driver matching which is
+ * defined by the application.
+ *
+ * The cache is bounded by a byte budget which includes the descriptor copies and the entries: the least recently
+ * used entries are evicted when a new one does not fit.
+ *
+ *   USBDescriptorCacheEntry *entry = cache.find(vid, pid, bcd, desc_cfg, len);
+ *   if (entry==nullptr){
+ *       entry = cache.insert(vid, pid, bcd, desc_cfg, len);
+ *       entry->drivers = matchDrivers(entry->view());
+ *   }
+ */
+
+#pragma once
+#include "USBHostView.h"
+#include "USBHash.h"
+
+// default byte budget of a USBDescriptorCache
+#ifndef USB_HOST_CACHE_BUDGET
+#define USB_HOST_CACHE_BUDGET 8192
+#endif
+
+/**
+ * @brief Key of a cached descriptor
+ */
+struct USBDescriptorCacheKey {
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t bcd_device;
+    uint32_t hash;  // CRC32 of the configuration descriptor
+
+    bool operator==(const USBDescriptorCacheKey &other) const {
+        return vid==other.vid && pid==other.pid && bcd_device==other.bcd_device && hash==other.hash;
+    }
+};
+
+/**
+ * @brief Cached descriptor with its view
+ */
+class USBDescriptorCacheEntry {
+    public:
+        ~USBDescriptorCacheEntry() {
+            delete[] data;
+        }
+
+        const USBDescriptorCacheKey &key() const {
+            return entry_key;
+        }
+
+        const USBConfigurationView &view() const {
+            return config_view;
+        }
+
+        // bytes used by this entry
+        size_t size() const {
+            return sizeof(USBDescriptorCacheEntry) + len;
+        }
+
+        // result of the driver matching: defined by the application e.g. as bitmap of the class drivers
+        uint32_t drivers = 0;
+
+    protected:
+        USBDescriptorCacheKey entry_key;
+        USBConfigurationView config_view;
+        uint8_t *data = nullptr;
+        uint16_t len = 0;
+        uint32_t last_used = 0;
+
+        friend class USBDescriptorCache;
+};
+
+/**
+ * @brief LRU cache of USBConfigurationView bounded by a byte budget
+ */
+class USBDescriptorCache {
+    public:
+        USBDescriptorCache(size_t budget=USB_HOST_CACHE_BUDGET){
+            byte_budget = budget;
+        }
+
+        ~USBDescriptorCache() {
+            clear();
+        }
+
+        static USBDescriptorCacheKey key(uint16_t vid, uint16_t pid, uint16_t bcd_device, const uint8_t *data, int len){
+            USBDescriptorCacheKey result = {vid, pid, bcd_device, USBHash::crc32(data, len)};
+            return result;
+        }
+
+        // looks up the entry of a device: returns nullptr if it is not available
+        USBDescriptorCacheEntry *find(uint16_t vid, uint16_t pid, uint16_t bcd_device, const uint8_t *data, int len){
+            int idx = indexOf(key(vid, pid, bcd_device, data, len), data, len);
+            if (idx<0){
+                miss_count++;
+                return nullptr;
+            }
+            entries[idx]->last_used = ++tick;
+            hit_count++;
+            return entries[idx];
+        }
+
+        // adds a copy of the descriptor: returns nullptr if it is invalid or bigger than the budget
+        USBDescriptorCacheEntry *insert(uint16_t vid, uint16_t pid, uint16_t bcd_device, const uint8_t *data, int len){
+            if (data==nullptr || len<=0 || len>0xffff || sizeof(USBDescriptorCacheEntry) + len > byte_budget){
+                return nullptr;
+            }
+            USBDescriptorCacheKey entry_key = key(vid, pid, bcd_device, data, len);
+            int idx = indexOf(entry_key, data, len);
+            if (idx>=0){
+                erase(idx);
+            }
+            USBDescriptorCacheEntry *entry = new USBDescriptorCacheEntry();
+            entry->entry_key = entry_key;
+            entry->data = new uint8_t[len];
+            entry->len = len;
+            memcpy(entry->data, data, len);
+            if (!entry->config_view.begin(entry->data, len)){
+                delete entry;
+                return nullptr;
+            }
+            while(used_bytes + entry->size() > byte_budget){
+                evict();
+            }
+            entry->last_used = ++tick;
+            used_bytes += entry->size();
+            entries.append(entry);
+            return entry;
+        }
+
+        // removes the entry with the indicated key
+        bool remove(const USBDescriptorCacheKey &key){
+            for (int j=0;j<entries.size();j++){
+                if (entries[j]->entry_key==key){
+                    erase(j);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void clear() {
+            while(entries.size()>0){
+                erase(entries.size()-1);
+            }
+        }
+
+        int size() {
+            return entries.size();
+        }
+
+        size_t bytes() {
+            return used_bytes;
+        }
+
+        size_t budget() {
+            return byte_budget;
+        }
+
+        uint32_t hits() {
+            return hit_count;
+        }
+
+        uint32_t misses() {
+            return miss_count;
+        }
+
+        uint32_t evictions() {
+            return eviction_count;
+        }
+
+        void resetCounters() {
+            hit_count = 0;
+            miss_count = 0;
+            eviction_count = 0;
+        }
+
+    protected:
+        Vector<USBDescriptorCacheEntry*> entries = Vector<USBDescriptorCacheEntry*>(nullptr, 4, 4);
+        size_t byte_budget;
+        size_t used_bytes = 0;
+        uint32_t tick = 0;
+        uint32_t hit_count = 0;
+        uint32_t miss_count = 0;
+        uint32_t eviction_count = 0;
+
+        // the hash only preselects: the descriptor is compared with the stored copy to rule out collisions
+        int indexOf(const USBDescriptorCacheKey &key, const uint8_t *data, int len){
+            for (int j=0;j<entries.size();j++){
+                USBDescriptorCacheEntry *entry = entries[j];
+                if (entry->entry_key==key && entry->len==len && memcmp(entry->data, data, len)==0){
+                    return j;
+                }
+            }
+            return -1;
+        }
+
+        // removes the least recently used entry
+        void evict() {
+            int lru = 0;
+            for (int j=1;j<entries.size();j++){
+                if (entries[j]->last_used < entries[lru]->last_used){
+                    lru = j;
+                }
+            }
+            erase(lru);
+            eviction_count++;
+        }
+
+        void erase(int idx){
+            USBDescriptorCacheEntry *entry = entries[idx];
+            used_bytes -= entry->size();
+            delete entry;
+            entries.remove(idx);
+        }
+};
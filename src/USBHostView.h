@@ -0,0 +1,345 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Read only views for the configuration descriptors of attached devices in host mode. The descriptor blob is
+ * scanned once and indexed in fixed size tables, so no memory is allocated and the class drivers can be matched with
+ * fast lookups by class/subclass/protocol or endpoint direction/type instead of walking the blob for each driver.
+ *
+ * The views point into the descriptor blob, so the blob must stay valid as long as the view is used:
+ *
+ *   USBConfigurationView view;
+ *   if (view.begin(desc_cfg, len)){
+ *       const USBInterfaceView *cdc = view.findInterface(TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL);
+ *       const USBEndpointView *notif = cdc!=nullptr ? cdc->findEndpoint(TUSB_DIR_IN, TUSB_XFER_INTERRUPT) : nullptr;
+ *   }
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+
+// max number of interface descriptors (including the alternate settings) of a view
+#ifndef USB_HOST_VIEW_MAX_INTERFACES
+#define USB_HOST_VIEW_MAX_INTERFACES 16
+#endif
+
+// max number of endpoint descriptors (including the ones of the alternate settings) of a view
+#ifndef USB_HOST_VIEW_MAX_ENDPOINTS
+#define USB_HOST_VIEW_MAX_ENDPOINTS 32
+#endif
+
+// wildcard for the subclass and protocol in the interface lookup
+#define USB_VIEW_ANY -1
+
+class USBConfigurationView;
+
+/**
+ * @brief Read only view of an endpoint descriptor
+ */
+class USBEndpointView {
+    public:
+        const tusb_desc_endpoint_t* descriptor() const {
+            return desc;
+        }
+
+        uint8_t address() const {
+            return desc->bEndpointAddress;
+        }
+
+        tusb_dir_t direction() const {
+            return tu_edpt_dir(desc->bEndpointAddress);
+        }
+
+        uint8_t transferType() const {
+            return desc->bmAttributes.xfer;
+        }
+
+        uint16_t wMaxPacketSize() const {
+            return desc->wMaxPacketSize.size;
+        }
+
+        uint8_t bInterval() const {
+            return desc->bInterval;
+        }
+
+        bool matches(uint8_t dir, uint8_t xfer) const {
+            return direction()==dir && transferType()==xfer;
+        }
+
+    protected:
+        const tusb_desc_endpoint_t *desc;
+
+        friend class USBConfigurationView;
+};
+
+/**
+ * @brief Read only view of an interface descriptor with its endpoints and class specific descriptors
+ */
+class USBInterfaceView {
+    public:
+        const tusb_desc_interface_t* descriptor() const {
+            return desc;
+        }
+
+        // the interface association which contains this interface: nullptr if there is none
+        const tusb_desc_interface_assoc_t* association() const {
+            return iad;
+        }
+
+        uint8_t bInterfaceNumber() const {
+            return desc->bInterfaceNumber;
+        }
+
+        uint8_t bAlternateSetting() const {
+            return desc->bAlternateSetting;
+        }
+
+        bool matches(uint8_t cls, int subclass=USB_VIEW_ANY, int protocol=USB_VIEW_ANY) const {
+            return desc->bInterfaceClass==cls && (subclass==USB_VIEW_ANY || desc->bInterfaceSubClass==subclass)
+                && (protocol==USB_VIEW_ANY || desc->bInterfaceProtocol==protocol);
+        }
+
+        // number of bytes from the interface descriptor up to the next interface or association: this is what the
+        // TinyUSB class drivers expect in their open callback
+        uint16_t length() const {
+            return len;
+        }
+
+        int usbEndpointCount() const {
+            return ep_count;
+        }
+
+        const USBEndpointView *usbEndpoint(int idx) const {
+            return idx>=0 && idx<ep_count ? endpoints + idx : nullptr;
+        }
+
+        // first endpoint with the indicated direction and transfer type
+        const USBEndpointView *findEndpoint(uint8_t dir, uint8_t xfer) const {
+            for (int j=0;j<ep_count;j++){
+                if (endpoints[j].matches(dir, xfer)){
+                    return endpoints + j;
+                }
+            }
+            return nullptr;
+        }
+
+        // first class specific descriptor of this interface with the indicated type (e.g. TUSB_DESC_CS_INTERFACE) and subtype
+        const uint8_t *findClassDescriptor(uint8_t type, uint8_t subtype) const {
+            const uint8_t *ptr = (const uint8_t*) desc + desc->bLength;
+            const uint8_t *end = (const uint8_t*) desc + len;
+            while(ptr<end){
+                if (ptr[1]==type && ptr[0]>2 && ptr[2]==subtype){
+                    return ptr;
+                }
+                ptr += ptr[0];
+            }
+            return nullptr;
+        }
+
+    protected:
+        const tusb_desc_interface_t *desc;
+        const tusb_desc_interface_assoc_t *iad;
+        const USBEndpointView *endpoints;
+        uint16_t len;
+        uint8_t ep_count;
+
+        friend class USBConfigurationView;
+};
+
+/**
+ * @brief Read only view of a configuration descriptor of an attached device
+ */
+class USBConfigurationView {
+    public:
+        USBConfigurationView() {
+            clear();
+        }
+
+        // the interfaces point into the tables of this object
+        USBConfigurationView(const USBConfigurationView&) = delete;
+        USBConfigurationView &operator=(const USBConfigurationView&) = delete;
+
+        // scans the descriptor blob: returns false if it is not consistent or does not fit into the tables
+        bool begin(const uint8_t *data, int len, bool validate=true){
+            clear();
+            if (data==nullptr || (validate && USBConfiguration::validate(data, len)!=nullptr)){
+                return false;
+            }
+            if (!validate && (len<(int)sizeof(tusb_desc_configuration_t) || data[1]!=TUSB_DESC_CONFIGURATION)){
+                return false;
+            }
+            const tusb_desc_interface_assoc_t *iad = nullptr;
+            USBInterfaceView *itf = nullptr;
+            const uint8_t *ptr = data + data[0];
+            const uint8_t *end = data + len;
+            while(ptr+2<=end && ptr[0]>=2 && ptr+ptr[0]<=end){
+                switch(ptr[1]){
+                    case TUSB_DESC_INTERFACE_ASSOCIATION:
+                        closeInterface(itf, ptr);
+                        itf = nullptr;
+                        // a truncated association is ignored
+                        iad = ptr[0]>=sizeof(tusb_desc_interface_assoc_t) ? (const tusb_desc_interface_assoc_t*) ptr : nullptr;
+                        break;
+                    case TUSB_DESC_INTERFACE: {
+                        closeInterface(itf, ptr);
+                        // a truncated interface is ignored together with its endpoints
+                        if (ptr[0]<sizeof(tusb_desc_interface_t)){
+                            itf = nullptr;
+                            break;
+                        }
+                        if (interface_count>=USB_HOST_VIEW_MAX_INTERFACES){
+                            clear();
+                            return false;
+                        }
+                        const tusb_desc_interface_t *desc = (const tusb_desc_interface_t*) ptr;
+                        // the association only covers its interface numbers
+                        if (iad!=nullptr && (desc->bInterfaceNumber<iad->bFirstInterface || desc->bInterfaceNumber>=iad->bFirstInterface+iad->bInterfaceCount)){
+                            iad = nullptr;
+                        }
+                        itf = interfaces + interface_count++;
+                        itf->desc = desc;
+                        itf->iad = iad;
+                        itf->endpoints = endpoints + endpoint_count;
+                        itf->ep_count = 0;
+                        itf->len = 0;
+                        class_mask[desc->bInterfaceClass >> 5] |= 1u << (desc->bInterfaceClass & 0x1f);
+                        } break;
+                    case TUSB_DESC_ENDPOINT:
+                        if (itf!=nullptr && ptr[0]>=sizeof(tusb_desc_endpoint_t)){
+                            if (endpoint_count>=USB_HOST_VIEW_MAX_ENDPOINTS){
+                                clear();
+                                return false;
+                            }
+                            USBEndpointView &ep = endpoints[endpoint_count++];
+                            ep.desc = (const tusb_desc_endpoint_t*) ptr;
+                            itf->ep_count++;
+                            // the address table refers to the first (default) setting which uses the endpoint
+                            uint8_t &idx = ep_index[tu_edpt_dir(ep.address())][tu_edpt_number(ep.address()) & 0x0f];
+                            if (idx==0xff){
+                                idx = endpoint_count-1;
+                            }
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                ptr += ptr[0];
+            }
+            closeInterface(itf, ptr);
+            config = (const tusb_desc_configuration_t*) data;
+            return true;
+        }
+
+        void clear() {
+            config = nullptr;
+            interface_count = 0;
+            endpoint_count = 0;
+            memset(ep_index, 0xff, sizeof(ep_index));
+            memset(class_mask, 0, sizeof(class_mask));
+        }
+
+        // true if begin() was successful
+        operator bool() const {
+            return config!=nullptr;
+        }
+
+        const tusb_desc_configuration_t* descriptor() const {
+            return config;
+        }
+
+        // interface descriptors including the alternate settings
+        int usbInterfaceCount() const {
+            return interface_count;
+        }
+
+        const USBInterfaceView *usbInterface(int idx) const {
+            return idx>=0 && idx<interface_count ? interfaces + idx : nullptr;
+        }
+
+        // interface by number and alternate setting
+        const USBInterfaceView *usbInterface(uint8_t number, uint8_t alt) const {
+            for (int j=0;j<interface_count;j++){
+                if (interfaces[j].bInterfaceNumber()==number && interfaces[j].bAlternateSetting()==alt){
+                    return interfaces + j;
+                }
+            }
+            return nullptr;
+        }
+
+        // endpoint descriptors including the ones of the alternate settings
+        int usbEndpointCount() const {
+            return endpoint_count;
+        }
+
+        // endpoint by address: if it is used by multiple alternate settings we return the first one
+        const USBEndpointView *usbEndpoint(uint8_t ep_addr) const {
+            uint8_t idx = ep_index[tu_edpt_dir(ep_addr)][tu_edpt_number(ep_addr) & 0x0f];
+            return idx==0xff ? nullptr : endpoints + idx;
+        }
+
+        // checks the class bitmap: no scan needed
+        bool hasClass(uint8_t cls) const {
+            return (class_mask[cls >> 5] >> (cls & 0x1f)) & 1;
+        }
+
+        // finds the next interface (starting after the indicated one) with the indicated class, subclass and protocol
+        const USBInterfaceView *findInterface(uint8_t cls, int subclass=USB_VIEW_ANY, int protocol=USB_VIEW_ANY, const USBInterfaceView *after=nullptr) const {
+            if (!hasClass(cls)){
+                return nullptr;
+            }
+            int start = after==nullptr ? 0 : after - interfaces + 1;
+            for (int j=start;j<interface_count;j++){
+                if (interfaces[j].matches(cls, subclass, protocol)){
+                    return interfaces + j;
+                }
+            }
+            return nullptr;
+        }
+
+        // first endpoint of the whole configuration with the indicated direction and transfer type
+        const USBEndpointView *findEndpoint(uint8_t dir, uint8_t xfer) const {
+            for (int j=0;j<endpoint_count;j++){
+                if (endpoints[j].matches(dir, xfer)){
+                    return endpoints + j;
+                }
+            }
+            return nullptr;
+        }
+
+    protected:
+        const tusb_desc_configuration_t *config;
+        USBInterfaceView interfaces[USB_HOST_VIEW_MAX_INTERFACES];
+        USBEndpointView endpoints[USB_HOST_VIEW_MAX_ENDPOINTS];
+        uint8_t interface_count;
+        uint8_t endpoint_count;
+        uint8_t ep_index[2][16]; // endpoint index by direction and number: 0xff = unused
+        uint32_t class_mask[8];  // bitmap of the interface classes
+
+        void closeInterface(USBInterfaceView *itf, const uint8_t *end){
+            if (itf!=nullptr){
+                itf->len = end - (const uint8_t*) itf->desc;
+            }
+        }
+};
@@ -0,0 +1,223 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Latency measurement of the control requests: the descriptor callbacks of USBDevice and the class and vendor
+ * request handlers are timed and the result is collected in a log scale histogram per request type. Hosts time out the
+ * enumeration if a request takes too long, so you can define a budget per request type and check in your tests that
+ * it has not been exceeded.
+ *
+ * The measurement is only active if USB_LATENCY is defined: otherwise USB_LATENCY_SCOPE compiles to nothing. In your
+ * own class drivers (e.g. tud_vendor_control_xfer_cb) you can use USB_LATENCY_SCOPE(LatencyVendorRequest).
+ */
+
+#pragma once
+#include "USBClock.h"
+#include <atomic>
+
+// number of histogram buckets: bucket 0 counts 0us, bucket i counts [2^(i-1), 2^i) us, the last one all bigger values
+#ifndef USB_LATENCY_BUCKETS
+#define USB_LATENCY_BUCKETS 20
+#endif
+
+#ifdef USB_LATENCY
+#define USB_LATENCY_SCOPE(type) USBLatencyScope usb_latency_scope(type)
+#else
+#define USB_LATENCY_SCOPE(type)
+#endif
+
+enum USBLatencyType {LatencyDeviceDescriptor, LatencyConfigurationDescriptor, LatencyStringDescriptor, LatencyClassRequest, LatencyVendorRequest, LatencyTypeCount};
+
+/**
+ * @brief Log scale histogram of latencies in microseconds
+ */
+class USBLatencyHistogram {
+    public:
+        USBLatencyHistogram() {
+            reset();
+        }
+
+        // adds a measurement
+        void record(uint32_t us){
+            buckets[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+            uint32_t current = max_us.load(std::memory_order_relaxed);
+            while(us>current && !max_us.compare_exchange_weak(current, us, std::memory_order_relaxed));
+        }
+
+        // number of measurements
+        uint32_t count() {
+            uint32_t result = 0;
+            for (int j=0;j<USB_LATENCY_BUCKETS;j++){
+                result += bucket(j);
+            }
+            return result;
+        }
+
+        // number of measurements in the indicated bucket
+        uint32_t bucket(int idx) {
+            return buckets[idx].load(std::memory_order_relaxed);
+        }
+
+        // biggest latency in us which is counted in the indicated bucket
+        static uint32_t bucketLimit(int idx) {
+            if (idx>=USB_LATENCY_BUCKETS-1){
+                return UINT32_MAX;
+            }
+            return idx==0 ? 0 : (1ul << idx) - 1;
+        }
+
+        // determines the bucket for the indicated latency
+        static int bucketIndex(uint32_t us) {
+            int idx = 0;
+            while(us>0 && idx<USB_LATENCY_BUCKETS-1){
+                us >>= 1;
+                idx++;
+            }
+            return idx;
+        }
+
+        // maximum measured latency in us
+        uint32_t max() {
+            return max_us.load(std::memory_order_relaxed);
+        }
+
+        // upper bound of the latency in us below which the indicated percentage (0-100) of the measurements are
+        uint32_t percentile(int percent) {
+            uint32_t total = count();
+            if (total==0){
+                return 0;
+            }
+            uint32_t limit = (total * percent + 99) / 100;
+            uint32_t sum = 0;
+            for (int j=0;j<USB_LATENCY_BUCKETS;j++){
+                sum += bucket(j);
+                if (sum>=limit && sum>0){
+                    uint32_t result = bucketLimit(j);
+                    return result < max() ? result : max();
+                }
+            }
+            return max();
+        }
+
+        void reset() {
+            for (int j=0;j<USB_LATENCY_BUCKETS;j++){
+                buckets[j].store(0, std::memory_order_relaxed);
+            }
+            max_us.store(0, std::memory_order_relaxed);
+        }
+
+    protected:
+        std::atomic<uint32_t> buckets[USB_LATENCY_BUCKETS];
+        std::atomic<uint32_t> max_us;
+};
+
+/**
+ * @brief Latency histograms and budgets for all request types
+ */
+class USBLatency {
+    public:
+        static USBLatency &instance() {
+            static USBLatency inst;
+            return inst;
+        }
+
+        // records a measurement
+        void record(USBLatencyType type, uint32_t us){
+            histograms[type].record(us);
+            if (budgets[type]>0 && us>budgets[type]){
+                violations[type].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        USBLatencyHistogram &histogram(USBLatencyType type){
+            return histograms[type];
+        }
+
+        // defines the maximum allowed latency in us: 0 = no budget
+        void setBudget(USBLatencyType type, uint32_t us){
+            budgets[type] = us;
+        }
+
+        uint32_t budget(USBLatencyType type){
+            return budgets[type];
+        }
+
+        // number of measurements which exceeded the budget
+        uint32_t violationCount(USBLatencyType type){
+            return violations[type].load(std::memory_order_relaxed);
+        }
+
+        // returns true if no measurement has exceeded its budget
+        bool isWithinBudget() {
+            for (int j=0;j<LatencyTypeCount;j++){
+                if (violationCount((USBLatencyType)j)>0){
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // name of the request type for reports
+        static const char* name(USBLatencyType type){
+            static const char* names[] = {"device", "configuration", "string", "class", "vendor"};
+            return type<LatencyTypeCount ? names[type] : "?";
+        }
+
+        // removes all measurements: the budgets are kept
+        void reset() {
+            for (int j=0;j<LatencyTypeCount;j++){
+                histograms[j].reset();
+                violations[j].store(0, std::memory_order_relaxed);
+            }
+        }
+
+    protected:
+        USBLatencyHistogram histograms[LatencyTypeCount];
+        uint32_t budgets[LatencyTypeCount] = {0};
+        std::atomic<uint32_t> violations[LatencyTypeCount];
+
+        USBLatency() {
+            reset();
+        }
+};
+
+/**
+ * @brief Measures the time until the end of the scope
+ */
+class USBLatencyScope {
+    public:
+        USBLatencyScope(USBLatencyType type){
+            this->type = type;
+            start = USBClock::micros();
+        }
+
+        ~USBLatencyScope() {
+            USBLatency::instance().record(type, (uint32_t)(USBClock::micros() - start));
+        }
+
+    protected:
+        USBLatencyType type;
+        uint64_t start;
+};
@@ -0,0 +1,356 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Boot selectable personalities: one firmware can act as one of multiple devices (e.g. MIDI, CDC or MSC
+ * combinations) which is chosen at boot e.g. with a strap pin.
+ *
+ * During the development each personality is defined with the USBDevice API and frozen with
+ * USBPersonalityBuilder::add(). The builder deduplicates identical descriptors (e.g. the device descriptor, the
+ * configurations and the common strings) across all personalities and generates the C++ source of a constant
+ * USBPersonality table which is stored in flash. At boot USBPersonalities::select() just sets a pointer: nothing is
+ * constructed, parsed or converted.
+ *
+ *   extern const USBPersonality usb_personalities[];
+ *   extern const int usb_personalities_count;
+ *
+ *   USBPersonalities::instance().select(usb_personalities, usb_personalities_count, strap_pin);
+ *
+ *   const uint8_t * tud_descriptor_device_cb(void) {
+ *     return USBPersonalities::instance().deviceDescriptor();
+ *   }
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+#include <stdio.h>
+
+/**
+ * @brief Descriptors of a personality: all pointers can be shared with other personalities
+ */
+struct USBPersonality {
+    const uint8_t *device;                  // device descriptor
+    const uint8_t* const *configurations;   // configuration descriptors with all their dependent descriptors
+    uint8_t configuration_count;
+    const uint16_t* const *strings;         // string descriptors (UTF-16 with header) starting with the language at index 0
+    uint8_t string_count;
+};
+
+/**
+ * @brief Provides the descriptors of the selected personality to the TinyUSB callbacks
+ */
+class USBPersonalities {
+    public:
+        static USBPersonalities &instance() {
+            static USBPersonalities inst;
+            return inst;
+        }
+
+        // selects the personality with the indicated index: returns false if it does not exist
+        bool select(const USBPersonality *table, int count, int idx){
+            if (table==nullptr || idx<0 || idx>=count){
+                return false;
+            }
+            active = table + idx;
+            return true;
+        }
+
+        const USBPersonality *selected() {
+            return active;
+        }
+
+        const uint8_t *deviceDescriptor() {
+            return active==nullptr ? nullptr : active->device;
+        }
+
+        const uint8_t *configurationDescriptor(int idx=0) {
+            return active==nullptr || idx<0 || idx>=active->configuration_count ? nullptr : active->configurations[idx];
+        }
+
+        const uint16_t *string(int index) {
+            return active==nullptr || index<0 || index>=active->string_count ? nullptr : active->strings[index];
+        }
+
+    protected:
+        const USBPersonality *active = nullptr;
+
+        USBPersonalities() {}
+};
+
+/**
+ * @brief Collects frozen USBDevice definitions, deduplicates their descriptors and generates the personality table
+ */
+class USBPersonalityBuilder {
+    public:
+        ~USBPersonalityBuilder() {
+            for (int j=0;j<blobs.size();j++){
+                delete[] blobs[j].data;
+            }
+            deleteTables(configuration_tables);
+            deleteTables(string_tables);
+            delete[] table_data;
+        }
+
+        // freezes the current definition of the device: returns the index of the personality
+        int add(USBDevice &device){
+            Personality p;
+            const tusb_desc_device_t *desc = device.descriptor();
+            p.device = addBlob((const uint8_t*)desc, sizeof(tusb_desc_device_t));
+
+            // the descriptor buffer is split at each configuration descriptor: wTotalLength might not have been
+            // updated yet, so we determine it from the buffer
+            USBConfigurationDescriptorData &cd = USBConfigurationDescriptorData::instance(device.rhport());
+            const uint8_t *data = cd.data();
+            const uint8_t *end = data + cd.totalSize();
+            BlobTable<uint8_t> configs;
+            configs.count = 0;
+            for (const uint8_t *ptr=data; ptr+2<=end && ptr[0]>0; ptr+=ptr[0]){
+                configs.count += ptr[1]==TUSB_DESC_CONFIGURATION;
+            }
+            configs.blobs = new int[configs.count];
+            configs.pointers = nullptr;
+            const uint8_t *start = nullptr;
+            int count = 0;
+            for (const uint8_t *ptr=data; ; ptr+=ptr[0]){
+                bool at_end = ptr+2>end || ptr[0]==0;
+                if (start!=nullptr && (at_end || ptr[1]==TUSB_DESC_CONFIGURATION)){
+                    configs.blobs[count++] = addConfiguration(start, (ptr<end ? ptr : end) - start);
+                    start = nullptr;
+                }
+                if (at_end){
+                    break;
+                }
+                if (ptr[1]==TUSB_DESC_CONFIGURATION){
+                    start = ptr;
+                }
+            }
+            p.configurations = addTable(configuration_tables, configs);
+
+            BlobTable<uint16_t> table;
+            table.count = USBStrings::instance(device.rhport()).size() + 1;
+            table.blobs = new int[table.count];
+            table.pointers = nullptr;
+            for (int j=0;j<table.count;j++){
+                const uint16_t *str = device.string(j);
+                static const uint8_t empty[] = {2, TUSB_DESC_STRING};
+                const uint8_t *data = str==nullptr ? empty : (const uint8_t*)str;
+                table.blobs[j] = addBlob(data, data[0]);
+            }
+            p.strings = addTable(string_tables, table);
+            personalities.append(p);
+            delete[] table_data;
+            table_data = nullptr;
+            return personalities.size()-1;
+        }
+
+        int personalityCount() {
+            return personalities.size();
+        }
+
+        // number of distinct descriptors
+        int blobCount() {
+            return blobs.size();
+        }
+
+        // bytes which would be needed without deduplication
+        size_t rawBytes() {
+            return raw_bytes;
+        }
+
+        // bytes of the distinct descriptors
+        size_t storedBytes() {
+            size_t result = 0;
+            for (int j=0;j<blobs.size();j++){
+                result += blobs[j].len;
+            }
+            return result;
+        }
+
+        // the personality table in RAM: e.g. to test the personalities before generating the source code
+        const USBPersonality *table() {
+            if (table_data==nullptr && personalities.size()>0){
+                resolveTables(configuration_tables);
+                resolveTables(string_tables);
+                table_data = new USBPersonality[personalities.size()];
+                for (int j=0;j<personalities.size();j++){
+                    Personality &p = personalities[j];
+                    table_data[j].device = blobs[p.device].data;
+                    table_data[j].configurations = configuration_tables[p.configurations].pointers;
+                    table_data[j].configuration_count = configuration_tables[p.configurations].count;
+                    table_data[j].strings = string_tables[p.strings].pointers;
+                    table_data[j].string_count = string_tables[p.strings].count;
+                }
+            }
+            return table_data;
+        }
+
+        // generates the C++ source of the table line by line with the help of the printer: void printer(const char* line)
+        template<class Printer>
+        void write(Printer printer, const char* name="usb_personalities"){
+            char line[120];
+            printer("// personality table generated by USBPersonalityBuilder");
+            printer("#include \"USBPersonality.h\"");
+            printer("");
+            for (int j=0;j<blobs.size();j++){
+                snprintf(line, sizeof(line), "alignas(4) static const uint8_t %s_desc%d[%d] = {", name, j, blobs[j].len);
+                printer(line);
+                int len = 0;
+                for (int i=0;i<blobs[j].len;i++){
+                    len += snprintf(line+len, sizeof(line)-len, "%s0x%02x,", len==0 ? "    " : " ", blobs[j].data[i]);
+                    if (i % 16 == 15 || i==blobs[j].len-1){
+                        printer(line);
+                        len = 0;
+                    }
+                }
+                printer("};");
+            }
+            printer("");
+            for (int j=0;j<configuration_tables.size();j++){
+                snprintf(line, sizeof(line), "static const uint8_t* const %s_configurations%d[] = {", name, j);
+                printer(line);
+                for (int i=0;i<configuration_tables[j].count;i++){
+                    snprintf(line, sizeof(line), "    %s_desc%d,", name, configuration_tables[j].blobs[i]);
+                    printer(line);
+                }
+                printer("};");
+            }
+            for (int j=0;j<string_tables.size();j++){
+                snprintf(line, sizeof(line), "static const uint16_t* const %s_strings%d[] = {", name, j);
+                printer(line);
+                for (int i=0;i<string_tables[j].count;i++){
+                    snprintf(line, sizeof(line), "    (const uint16_t*) %s_desc%d,", name, string_tables[j].blobs[i]);
+                    printer(line);
+                }
+                printer("};");
+            }
+            printer("");
+            snprintf(line, sizeof(line), "extern const USBPersonality %s[] = {", name);
+            printer(line);
+            for (int j=0;j<personalities.size();j++){
+                Personality &p = personalities[j];
+                snprintf(line, sizeof(line), "    {%s_desc%d, %s_configurations%d, %d, %s_strings%d, %d},", name, p.device, name, p.configurations,
+                    configuration_tables[p.configurations].count, name, p.strings, string_tables[p.strings].count);
+                printer(line);
+            }
+            printer("};");
+            snprintf(line, sizeof(line), "extern const int %s_count = %d;", name, personalities.size());
+            printer(line);
+        }
+
+#if defined(__linux__) || defined(TINYUSB_CPP_HOST_PORT)
+        // writes the source code to the indicated file
+        void write(FILE *file, const char* name="usb_personalities"){
+            write([file](const char* line){ fprintf(file, "%s\n", line); }, name);
+        }
+#endif
+
+    protected:
+        struct Blob {
+            uint8_t *data;
+            int len;
+        };
+        template<class T>
+        struct BlobTable {
+            int *blobs;             // blob index per descriptor
+            const T **pointers;     // resolved pointers for table()
+            int count;
+        };
+        struct Personality {
+            int device;
+            int configurations;
+            int strings;
+        };
+        Vector<Blob> blobs = Vector<Blob>(Blob{nullptr, 0}, 8, 8);
+        Vector<BlobTable<uint8_t>> configuration_tables = Vector<BlobTable<uint8_t>>(BlobTable<uint8_t>{nullptr, nullptr, 0}, 4, 4);
+        Vector<BlobTable<uint16_t>> string_tables = Vector<BlobTable<uint16_t>>(BlobTable<uint16_t>{nullptr, nullptr, 0}, 4, 4);
+        Vector<Personality> personalities = Vector<Personality>(Personality{0, 0, 0}, 4, 4);
+        USBPersonality *table_data = nullptr;
+        size_t raw_bytes = 0;
+
+        // returns the index of an identical blob or adds a copy
+        int addBlob(const uint8_t *data, int len){
+            raw_bytes += len;
+            for (int j=0;j<blobs.size();j++){
+                if (blobs[j].len==len && memcmp(blobs[j].data, data, len)==0){
+                    return j;
+                }
+            }
+            Blob blob;
+            blob.data = new uint8_t[len];
+            blob.len = len;
+            memcpy(blob.data, data, len);
+            blobs.append(blob);
+            return blobs.size()-1;
+        }
+
+        // adds a copy of a single configuration with the length of its block as wTotalLength
+        int addConfiguration(const uint8_t *data, int len){
+            uint8_t *config = new uint8_t[len];
+            memcpy(config, data, len);
+            if (len>=4){
+                config[2] = len & 0xff;
+                config[3] = len >> 8;
+            }
+            int result = addBlob(config, len);
+            delete[] config;
+            return result;
+        }
+
+        // returns the index of an identical table or adds it
+        template<class T>
+        int addTable(Vector<BlobTable<T>> &tables, BlobTable<T> &table){
+            raw_bytes += table.count * sizeof(T*);
+            for (int j=0;j<tables.size();j++){
+                BlobTable<T> &t = tables[j];
+                if (t.count==table.count && memcmp(t.blobs, table.blobs, table.count*sizeof(int))==0){
+                    delete[] table.blobs;
+                    return j;
+                }
+            }
+            tables.append(table);
+            return tables.size()-1;
+        }
+
+        template<class T>
+        void resolveTables(Vector<BlobTable<T>> &tables){
+            for (int j=0;j<tables.size();j++){
+                BlobTable<T> &t = tables[j];
+                if (t.pointers==nullptr){
+                    t.pointers = new const T*[t.count];
+                    for (int i=0;i<t.count;i++){
+                        t.pointers[i] = (const T*) blobs[t.blobs[i]].data;
+                    }
+                }
+            }
+        }
+
+        template<class T>
+        void deleteTables(Vector<BlobTable<T>> &tables){
+            for (int j=0;j<tables.size();j++){
+                delete[] tables[j].blobs;
+                delete[] tables[j].pointers;
+            }
+        }
+};
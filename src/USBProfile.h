@@ -0,0 +1,153 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Profiling hook points: the library marks the building of the descriptors, the finalization of the
+ * configuration, the descriptor callbacks, findDescriptor, the string encoding and the endpoint transfers
+ * with USB_PROFILE_SCOPE(point).
+ *
+ * The hooks are only active if USB_PROFILE is defined: otherwise they compile to nothing. The measurement is done
+ * by the profiler class which is defined with USB_PROFILER. It needs to provide the following static inline methods:
+ * \li uint32_t begin(USBProfilePoint point): returns the start time stamp (e.g. the DWT cycle counter)
+ * \li void end(USBProfilePoint point, uint32_t start): called at the end of the scope
+ *
+ * The default profiler is USBProfileRecorder which records the microsecond durations into a ring buffer with
+ * USB_PROFILE_SIZE entries.
+ */
+
+#pragma once
+#include "USBClock.h"
+#include <atomic>
+
+#ifndef USB_PROFILE_SIZE
+#define USB_PROFILE_SIZE 128
+#endif
+
+#ifdef USB_PROFILE
+#ifndef USB_PROFILER
+#define USB_PROFILER USBProfileRecorder
+#endif
+#define USB_PROFILE_SCOPE(point) USBProfileScope<USB_PROFILER> usb_profile_scope(point)
+#else
+#define USB_PROFILE_SCOPE(point)
+#endif
+
+enum USBProfilePoint {ProfileDescriptorBuild, ProfileFinalize, ProfileDeviceDescriptor, ProfileConfigurationDescriptor, ProfileStringDescriptor,
+    ProfileFindDescriptor, ProfileStringEncoding, ProfileTransferSubmit, ProfileTransferComplete, ProfilePointCount};
+
+/**
+ * @brief Calls the profiler at the start and the end of the scope
+ */
+template <class Profiler>
+class USBProfileScope {
+    public:
+        inline USBProfileScope(USBProfilePoint point){
+            this->point = point;
+            start = Profiler::begin(point);
+        }
+
+        inline ~USBProfileScope() {
+            Profiler::end(point, start);
+        }
+
+    protected:
+        USBProfilePoint point;
+        uint32_t start;
+};
+
+/**
+ * @brief A single profiling measurement
+ */
+struct USBProfileRecord {
+    uint8_t point;
+    uint32_t start;
+    uint32_t duration;
+};
+
+/**
+ * @brief Default profiler which records the measurements into a ring buffer: if the ring buffer is full the oldest
+ * records are overwritten.
+ */
+class USBProfileRecorder {
+    public:
+        static USBProfileRecorder &instance() {
+            static USBProfileRecorder inst;
+            return inst;
+        }
+
+        static inline uint32_t begin(USBProfilePoint point) {
+            return (uint32_t) USBClock::micros();
+        }
+
+        static inline void end(USBProfilePoint point, uint32_t start) {
+            instance().record(point, start, (uint32_t) USBClock::micros() - start);
+        }
+
+        // adds a measurement
+        void record(USBProfilePoint point, uint32_t start, uint32_t duration){
+            uint32_t slot = head.fetch_add(1, std::memory_order_relaxed);
+            USBProfileRecord &rec = records[slot % USB_PROFILE_SIZE];
+            rec.point = point;
+            rec.start = start;
+            rec.duration = duration;
+        }
+
+        // number of recorded measurements since the last clear (including the overwritten ones)
+        uint32_t totalCount() {
+            return head.load(std::memory_order_relaxed);
+        }
+
+        // number of available records
+        int size() {
+            uint32_t total = totalCount();
+            return total < USB_PROFILE_SIZE ? total : USB_PROFILE_SIZE;
+        }
+
+        // provides the indicated record: 0 = oldest available
+        USBProfileRecord &get(int idx) {
+            uint32_t total = totalCount();
+            uint32_t start = total < USB_PROFILE_SIZE ? 0 : total - USB_PROFILE_SIZE;
+            return records[(start + idx) % USB_PROFILE_SIZE];
+        }
+
+        // number of available records for the indicated hook point
+        int count(USBProfilePoint point) {
+            int result = 0;
+            for (int j=0;j<size();j++){
+                if (get(j).point==point) result++;
+            }
+            return result;
+        }
+
+        void clear() {
+            head.store(0, std::memory_order_relaxed);
+        }
+
+    protected:
+        USBProfileRecord records[USB_PROFILE_SIZE];
+        std::atomic<uint32_t> head{0};
+
+        USBProfileRecorder() {}
+};
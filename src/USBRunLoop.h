@@ -0,0 +1,366 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Event driven main loop: instead of polling tud_task() the loop sleeps until the USB interrupt or a class
+ * queue calls signal(). TinyUSB reports new events with tud_event_hook_cb():
+ *
+ *   void tud_event_hook_cb(uint8_t rhport, uint32_t eventid, bool in_isr) {
+ *     USBRunLoop::instance().signal(in_isr);
+ *   }
+ *
+ *   USBRunLoop::instance().bind(ep_out, received);   // callback for the completed transfers of the endpoint
+ *   USBRunLoop::instance().run();                    // or step() in your own loop
+ *
+ * The completed transfers need to be reported with USBRunLoop::transferCompletedCb(): e.g. from the xfer_cb of your
+ * class driver or with USBStubDCD::setTransferCallback() on the host. They are dispatched to the callback which is
+ * bound to the endpoint address, or to USBDevice::transferCompletedCb() if there is none. The USBEndpoint is looked up
+ * at the dispatch, so the bindings stay valid when the device is cleared and defined again.
+ *
+ * The wait depends on the platform: a condition variable on the Linux host port, a task notification with FreeRTOS
+ * (define USB_RUNLOOP_FREERTOS) and WFE on bare metal ARM. The loop counts the wakeups and measures the latency from
+ * the first signal() to the dispatch of the callback with USBClock. signal() only uses atomic loads and stores, which
+ * are also available on ARMv6-M (Cortex-M0) that has no read-modify-write instructions.
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+#include "USBClock.h"
+#include <atomic>
+
+#if defined(USB_RUNLOOP_FREERTOS)
+#include "FreeRTOS.h"
+#include "task.h"
+#elif defined(__linux__) || defined(TINYUSB_CPP_HOST_PORT)
+#define USB_RUNLOOP_CONDITION_VARIABLE
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#endif
+
+// maximum number of endpoints with a bound callback
+#ifndef USB_RUNLOOP_BINDINGS
+#define USB_RUNLOOP_BINDINGS 16
+#endif
+
+// wait without timeout
+#define USB_RUNLOOP_FOREVER 0xffffffff
+
+// Callback for the completed transfers of an endpoint
+typedef void (*USBEndpointCallback)(USBEndpoint &ep, xfer_result_t result, uint32_t xferred_bytes, void *ref);
+
+/**
+ * @brief Counters of the run loop: the latencies are measured in microseconds from the signal to the dispatch
+ */
+struct USBRunLoopStats {
+    uint32_t wakeups;       // the loop was woken up by a signal
+    uint32_t timeouts;      // the wait ended without signal
+    uint32_t spurious;      // wakeups without any dispatched transfer
+    uint32_t dispatched;    // transfers which were dispatched to a bound callback
+    uint32_t unbound;       // transfers which were forwarded to USBDevice
+    uint32_t latency_min_us;
+    uint32_t latency_avg_us;
+    uint32_t latency_max_us;
+};
+
+class USBRunLoop {
+    public:
+        static USBRunLoop &instance() {
+            static USBRunLoop inst;
+            return inst;
+        }
+
+        // wakes up the loop: can be called from an interrupt (in_isr=true) or from any thread or task
+        void signal(bool in_isr=false){
+            // we measure the latency from the first signal after the last wakeup: a concurrent signal might overwrite
+            // the time with a slightly later one
+            if (!signal_timed.load()){
+                signal_time.store((uint32_t) USBClock::micros());
+                signal_timed.store(true);
+            }
+#if defined(USB_RUNLOOP_FREERTOS)
+            // the handle is loaded once: wait() publishes it before it checks pending, so either the flag is seen
+            // there or the notification is sent
+            TaskHandle_t task = task_handle.load();
+            if (task==nullptr){
+                pending.store(true);
+            } else if (in_isr){
+                BaseType_t woken = pdFALSE;
+                vTaskNotifyGiveFromISR(task, &woken);
+                portYIELD_FROM_ISR(woken);
+            } else {
+                xTaskNotifyGive(task);
+            }
+#elif defined(USB_RUNLOOP_CONDITION_VARIABLE)
+            (void) in_isr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.store(true);
+            }
+            condition.notify_one();
+#else
+            (void) in_isr;
+            pending.store(true);
+#if defined(__ARM_ARCH)
+            __asm volatile ("sev");
+#endif
+#endif
+        }
+
+        // defines the calling task as the loop task: call it before the USB interrupt is enabled, otherwise the first
+        // wait() does it. Only needed with FreeRTOS
+        void begin() {
+#if defined(USB_RUNLOOP_FREERTOS)
+            task_handle.store(xTaskGetCurrentTaskHandle());
+#endif
+        }
+
+        // sleeps until signal() is called or the timeout has passed: returns false for a timeout
+        bool wait(uint32_t timeout_ms=USB_RUNLOOP_FOREVER){
+            bool result;
+#if defined(USB_RUNLOOP_FREERTOS)
+            if (task_handle.load()==nullptr){
+                begin();
+            }
+            // pending is checked after the handle has been published: a signal() which has still seen no handle
+            // has set the flag before
+            result = takePending();
+            if (!result){
+                TickType_t ticks = timeout_ms==USB_RUNLOOP_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+                result = ulTaskNotifyTake(pdTRUE, ticks) > 0;
+            }
+#elif defined(USB_RUNLOOP_CONDITION_VARIABLE)
+            std::unique_lock<std::mutex> lock(mutex);
+            auto signalled = [this](){ return pending.load(); };
+            if (timeout_ms==USB_RUNLOOP_FOREVER){
+                condition.wait(lock, signalled);
+                result = true;
+            } else {
+                result = condition.wait_for(lock, std::chrono::milliseconds(timeout_ms), signalled);
+            }
+            pending.store(false);
+#else
+            // WFE also ends with any interrupt, so we check the flag and the timeout again
+            uint64_t end = USBClock::micros() + (uint64_t) timeout_ms * 1000;
+            while(!(result = takePending())){
+                if (timeout_ms!=USB_RUNLOOP_FOREVER && USBClock::micros()>=end){
+                    break;
+                }
+#if defined(__ARM_ARCH)
+                __asm volatile ("wfe");
+#endif
+            }
+#endif
+            if (result) wakeups++; else timeouts++;
+            return result;
+        }
+
+        // waits for the next event and processes it with tud_task(): returns the number of dispatched transfers
+        int step(uint32_t timeout_ms=USB_RUNLOOP_FOREVER){
+            bool signalled = wait(timeout_ms);
+            uint32_t before = dispatched + unbound;
+            // a signal after this point is measured with the next step
+            has_dispatch_start = signal_timed.load();
+            dispatch_start = signal_time.load();
+            signal_timed.store(false);
+            tud_task();
+            int result = dispatched + unbound - before;
+            if (signalled && result==0){
+                spurious++;
+            }
+            return result;
+        }
+
+        // processes the events until stop() is called
+        void run() {
+            begin();
+            active = true;
+            while(active){
+                step();
+            }
+        }
+
+        // ends run(): can be called from a callback or from a different thread
+        void stop() {
+            active = false;
+            signal();
+        }
+
+        // calls the callback for the completed transfers of the endpoint address: nullptr removes the binding
+        bool bind(USBEndpoint &ep, USBEndpointCallback cb, void *ref=nullptr){
+            return bind(ep.rhport(), ep.address(), cb, ref);
+        }
+
+        bool bind(uint8_t rhport, uint8_t ep_addr, USBEndpointCallback cb, void *ref=nullptr){
+            int free_idx = -1;
+            for (int j=0;j<USB_RUNLOOP_BINDINGS;j++){
+                Binding &b = bindings[j];
+                if (b.cb!=nullptr && b.ep_addr==ep_addr && b.rhport==rhport){
+                    b.cb = cb;
+                    b.ref = ref;
+                    return true;
+                }
+                if (b.cb==nullptr && free_idx<0){
+                    free_idx = j;
+                }
+            }
+            if (cb==nullptr){
+                return true;
+            }
+            if (free_idx<0){
+                return false;
+            }
+            bindings[free_idx].rhport = rhport;
+            bindings[free_idx].ep_addr = ep_addr;
+            bindings[free_idx].cb = cb;
+            bindings[free_idx].ref = ref;
+            return true;
+        }
+
+        // removes all bindings
+        void unbindAll() {
+            for (int j=0;j<USB_RUNLOOP_BINDINGS;j++){
+                bindings[j].cb = nullptr;
+            }
+        }
+
+        // forwards a completed transfer to the bound callback: call it from the xfer_cb of your class driver
+        void transferCompleted(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+            for (int j=0;j<USB_RUNLOOP_BINDINGS;j++){
+                Binding &b = bindings[j];
+                if (b.cb!=nullptr && b.ep_addr==ep_addr && b.rhport==rhport){
+                    // the endpoint is not defined in the current descriptors: handled as unbound
+                    USBEndpoint *ep = findEndpoint(rhport, ep_addr);
+                    if (ep==nullptr){
+                        break;
+                    }
+                    recordLatency();
+                    dispatched++;
+                    ep->completed(result, xferred_bytes);
+                    b.cb(*ep, result, xferred_bytes, b.ref);
+                    return;
+                }
+            }
+            unbound++;
+            USBDevice::transferCompletedCb(rhport, ep_addr, result, xferred_bytes);
+        }
+
+        // transfer callback: e.g. for USBStubDCD::setTransferCallback()
+        static void transferCompletedCb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+            instance().transferCompleted(rhport, ep_addr, result, xferred_bytes);
+        }
+
+        // event hook with the signature of tud_event_hook_cb(): e.g. for USBStubDCD::setEventHook()
+        static void eventHook(uint8_t rhport, uint32_t eventid, bool in_isr){
+            instance().signal(in_isr);
+        }
+
+        // provides a snapshot of the counters
+        void stats(USBRunLoopStats &result){
+            result.wakeups = wakeups;
+            result.timeouts = timeouts;
+            result.spurious = spurious;
+            result.dispatched = dispatched;
+            result.unbound = unbound;
+            result.latency_min_us = latency_count>0 ? latency_min : 0;
+            result.latency_avg_us = latency_count>0 ? latency_sum / latency_count : 0;
+            result.latency_max_us = latency_max;
+        }
+
+        void resetStats() {
+            wakeups = timeouts = spurious = dispatched = unbound = 0;
+            latency_min = 0xffffffff;
+            latency_max = 0;
+            latency_sum = 0;
+            latency_count = 0;
+        }
+
+    protected:
+        // a binding is free if there is no callback
+        struct Binding {
+            uint8_t rhport = 0;
+            uint8_t ep_addr = 0;
+            USBEndpointCallback cb = nullptr;
+            void *ref = nullptr;
+        };
+        Binding bindings[USB_RUNLOOP_BINDINGS];
+        std::atomic<bool> pending{false};
+        std::atomic<uint32_t> signal_time{0};
+        std::atomic<bool> signal_timed{false};  // signal_time is valid
+        std::atomic<bool> active{false};
+        uint32_t dispatch_start = 0;
+        bool has_dispatch_start = false;
+#if defined(USB_RUNLOOP_FREERTOS)
+        std::atomic<TaskHandle_t> task_handle{nullptr};
+#elif defined(USB_RUNLOOP_CONDITION_VARIABLE)
+        std::mutex mutex;
+        std::condition_variable condition;
+#endif
+        // the counters are only updated by the loop
+        uint32_t wakeups = 0;
+        uint32_t timeouts = 0;
+        uint32_t spurious = 0;
+        uint32_t dispatched = 0;
+        uint32_t unbound = 0;
+        uint32_t latency_min = 0xffffffff;
+        uint32_t latency_max = 0;
+        uint64_t latency_sum = 0;
+        uint32_t latency_count = 0;
+
+        USBRunLoop() = default;
+
+        // load and store instead of exchange(): a signal() between them is covered by the following tud_task()
+        bool takePending() {
+            if (!pending.load()){
+                return false;
+            }
+            pending.store(false);
+            return true;
+        }
+
+        // the endpoint of the first configuration which defines the address
+        USBEndpoint *findEndpoint(uint8_t rhport, uint8_t ep_addr){
+            USBDevice &device = USBDevice::instance(rhport);
+            for (int j=0;j<device.usbConfigurationCount();j++){
+                USBEndpoint *ep = device.usbConfiguration(j)->usbEndpoint(ep_addr);
+                if (ep!=nullptr){
+                    return ep;
+                }
+            }
+            return nullptr;
+        }
+
+        void recordLatency() {
+            if (!has_dispatch_start){
+                return;
+            }
+            // the 32 bit difference is also correct when the time wraps around
+            uint32_t latency = (uint32_t) USBClock::micros() - dispatch_start;
+            if (latency<latency_min) latency_min = latency;
+            if (latency>latency_max) latency_max = latency;
+            latency_sum += latency;
+            latency_count++;
+        }
+};
@@ -0,0 +1,265 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Immutable copies of the descriptors for the descriptor callbacks (read-copy-update): the application
+ * (e.g. on core 0) changes the USBDevice and publishes a new snapshot with a single atomic pointer store, while the
+ * callbacks in the USB task (e.g. tud_task on core 1) read the current snapshot without any lock.
+ *
+ *   USBSnapshots::instance().publish();            // writer: after the descriptors have been (re)defined
+ *   USBSnapshots::instance().deviceDescriptor();   // reader: in tud_descriptor_device_cb()
+ *   USBSnapshots::instance().busReset();           // USB task: e.g. in tud_umount_cb()
+ *
+ * TinyUSB sends the descriptors in multiple EP0 packets from the returned pointer, so a replaced snapshot must stay
+ * valid until the host can not use it any more. This grace period ends with the next bus reset: busReset() only
+ * records it with an atomic store, and the retired snapshots are deleted by the writer in publish() or reclaim().
+ * So we only need atomic loads and stores which are lock-free on a Cortex-M0+ as well. There must be only one writer
+ * per port.
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+#include <atomic>
+
+/**
+ * @brief All descriptors of a device: device descriptor, configuration descriptors and the encoded strings
+ */
+class USBDescriptorSnapshot {
+    public:
+        ~USBDescriptorSnapshot() {
+            delete[] configuration;
+            delete[] strings;
+            delete[] string_offsets;
+        }
+
+        const tusb_desc_device_t *deviceDescriptor() {
+            return &device;
+        }
+
+        // configuration descriptor with the indicated index: nullptr if it does not exist
+        const uint8_t *configurationDescriptor(int idx=0){
+            const uint8_t *ptr = configuration;
+            const uint8_t *end = configuration + configuration_len;
+            int count = 0;
+            while(ptr<end && ptr[0]>0){
+                if (ptr[1]==TUSB_DESC_CONFIGURATION && count++==idx){
+                    return ptr;
+                }
+                ptr += ptr[0];
+            }
+            return nullptr;
+        }
+
+        // encoded string descriptor: index 0 is the language
+        const uint16_t *string(int idx){
+            if (idx<0 || idx>=string_count || string_offsets[idx]==0xffff){
+                return nullptr;
+            }
+            return strings + string_offsets[idx];
+        }
+
+        int stringCount() {
+            return string_count;
+        }
+
+        // number of the publication: starts with 1
+        uint32_t generation() {
+            return generation_;
+        }
+
+    protected:
+        tusb_desc_device_t device;
+        uint8_t *configuration = nullptr;   // all configurations one after the other
+        uint16_t configuration_len = 0;
+        uint16_t *strings = nullptr;        // encoded string descriptors one after the other
+        uint16_t *string_offsets = nullptr; // in uint16_t units: 0xffff if the string is not defined
+        int string_count = 0;
+        uint32_t generation_ = 0;
+        uint32_t retired_at = 0;            // grace period at which the snapshot was replaced
+
+        friend class USBSnapshots;
+};
+
+/**
+ * @brief Publishes the USBDescriptorSnapshot of the device of a port
+ */
+class USBSnapshots {
+    public:
+        static USBSnapshots &instance(uint8_t rhport=0){
+            static USBSnapshots *snapshots = createSnapshots();
+            return snapshots[rhport<USB_PORT_COUNT ? rhport : 0];
+        }
+
+        ~USBSnapshots() {
+            delete current_snapshot.load();
+            reclaimAll();
+        }
+
+        // writer: copies the descriptors of the device and replaces the current snapshot
+        USBDescriptorSnapshot *publish(USBDevice &device){
+            USBDescriptorSnapshot *snapshot = create(device);
+            snapshot->generation_ = ++generation_count;
+            USBDescriptorSnapshot *old = current_snapshot.load();
+            current_snapshot.store(snapshot);
+            // readers might still use the old snapshot until the next bus reset
+            if (old!=nullptr){
+                old->retired_at = grace_period.load();
+                retired.append(old);
+            }
+            reclaim();
+            return snapshot;
+        }
+
+        // writer: publishes the descriptors of the device of the port
+        USBDescriptorSnapshot *publish(){
+            return publish(USBDevice::instance(port));
+        }
+
+        // reader: the snapshot which is used by the callbacks - nullptr if nothing has been published yet
+        USBDescriptorSnapshot *current() {
+            return current_snapshot.load(std::memory_order_acquire);
+        }
+
+        // reader: device descriptor callback
+        const uint8_t *deviceDescriptor() {
+            USBDescriptorSnapshot *snapshot = current();
+            return snapshot!=nullptr ? (const uint8_t*) snapshot->deviceDescriptor() : nullptr;
+        }
+
+        // reader: configuration descriptor callback
+        const uint8_t *configurationDescriptor(uint8_t index){
+            USBDescriptorSnapshot *snapshot = current();
+            return snapshot!=nullptr ? snapshot->configurationDescriptor(index) : nullptr;
+        }
+
+        // reader: string descriptor callback
+        const uint16_t *string(uint8_t index){
+            USBDescriptorSnapshot *snapshot = current();
+            return snapshot!=nullptr ? snapshot->string(index) : nullptr;
+        }
+
+        // USB task: the host has been reset, so it does not use any replaced snapshot any more
+        void busReset() {
+            // we are the only one which writes the counter, so we do not need a read-modify-write
+            grace_period.store(grace_period.load(std::memory_order_relaxed) + 1);
+        }
+
+        // writer: deletes the snapshots which have been replaced before the last bus reset
+        int reclaim() {
+            uint32_t grace = grace_period.load();
+            int result = 0;
+            for (int j=retired.size()-1;j>=0;j--){
+                if (retired[j]->retired_at != grace){
+                    delete retired[j];
+                    retired.remove(j);
+                    result++;
+                }
+            }
+            return result;
+        }
+
+        // number of replaced snapshots which have not been deleted yet
+        int retiredCount() {
+            return retired.size();
+        }
+
+        // number of publications
+        uint32_t generation() {
+            return generation_count;
+        }
+
+    protected:
+        std::atomic<USBDescriptorSnapshot*> current_snapshot{nullptr};
+        std::atomic<uint32_t> grace_period{0};
+        Vector<USBDescriptorSnapshot*> retired = Vector<USBDescriptorSnapshot*>(nullptr, 0, 2);
+        uint32_t generation_count = 0;
+        uint8_t port = 0;
+
+        USBSnapshots() = default;
+
+        // creates one publisher per device controller
+        static USBSnapshots *createSnapshots() {
+            static USBSnapshots snapshots[USB_PORT_COUNT];
+            for (int j=0;j<USB_PORT_COUNT;j++){
+                snapshots[j].port = j;
+            }
+            return snapshots;
+        }
+
+        void reclaimAll() {
+            for (int j=0;j<retired.size();j++){
+                delete retired[j];
+            }
+            retired.clear();
+        }
+
+        static USBDescriptorSnapshot *create(USBDevice &device){
+            USBDescriptorSnapshot *snapshot = new USBDescriptorSnapshot();
+            snapshot->device = *device.descriptor();
+
+            // each configuration is copied with the length of its block as wTotalLength: it might not have been
+            // updated yet
+            int config_len = 0;
+            for (int j=0;j<device.usbConfigurationCount();j++){
+                config_len += device.usbConfiguration(j)->blockLength();
+            }
+            snapshot->configuration_len = config_len;
+            snapshot->configuration = new uint8_t[config_len > 0 ? config_len : 1];
+            uint8_t *dest = snapshot->configuration;
+            for (int j=0;j<device.usbConfigurationCount();j++){
+                USBConfiguration *config = device.usbConfiguration(j);
+                int len = config->blockLength();
+                memcpy(dest, config->configurationDescriptor(), len);
+                if (len>=(int)sizeof(tusb_desc_configuration_t)){
+                    dest[2] = len & 0xff;
+                    dest[3] = len >> 8;
+                }
+                dest += len;
+            }
+
+            // the strings are encoded once
+            USBStrings &str = USBStrings::instance(device.rhport());
+            snapshot->string_count = str.size() + 1;
+            snapshot->string_offsets = new uint16_t[snapshot->string_count];
+            int total = 0;
+            for (int j=0;j<snapshot->string_count;j++){
+                const uint8_t *desc = (const uint8_t*) str.string(j);
+                total += desc!=nullptr ? (desc[0] + 1) / 2 : 0;
+            }
+            snapshot->strings = new uint16_t[total > 0 ? total : 1];
+            int pos = 0;
+            for (int j=0;j<snapshot->string_count;j++){
+                const uint8_t *desc = (const uint8_t*) str.string(j);
+                if (desc==nullptr){
+                    snapshot->string_offsets[j] = 0xffff;
+                    continue;
+                }
+                snapshot->string_offsets[j] = pos;
+                memcpy(snapshot->strings + pos, desc, desc[0]);
+                pos += (desc[0] + 1) / 2;
+            }
+            return snapshot;
+        }
+};
@@ -0,0 +1,234 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Timeline of the enumeration: we record the time from the bus reset to SET_ADDRESS, each GET_DESCRIPTOR,
+ * SET_CONFIGURATION and the first class transfer, so that the report shows where the enumeration time goes.
+ *
+ * The descriptor requests are recorded by the USBDevice descriptor callbacks and the host port records all other
+ * events. With TinyUSB you can add the missing events in your callbacks: e.g. USB_TIMELINE_SET_CONFIGURATION(1)
+ * in tud_mount_cb().
+ *
+ * The recording is only active if USB_TIMELINE is defined: otherwise the USB_TIMELINE_XXX macros compile to nothing.
+ * The max number of events can be defined with USB_TIMELINE_SIZE.
+ */
+
+#pragma once
+#include "USBClock.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef USB_TIMELINE_SIZE
+#define USB_TIMELINE_SIZE 64
+#endif
+
+#ifdef USB_TIMELINE
+#define USB_TIMELINE_BUS_RESET() USBTimeline::instance().record(TimelineBusReset)
+#define USB_TIMELINE_SET_ADDRESS(addr) USBTimeline::instance().record(TimelineSetAddress, 0, addr)
+#define USB_TIMELINE_DESCRIPTOR(type, index, len) USBTimeline::instance().record(TimelineGetDescriptor, type, index, len)
+#define USB_TIMELINE_SET_CONFIGURATION(config) USBTimeline::instance().record(TimelineSetConfiguration, 0, config)
+#define USB_TIMELINE_TRANSFER(ep_addr, len) USBTimeline::instance().record(TimelineFirstTransfer, 0, ep_addr, len)
+#else
+#define USB_TIMELINE_BUS_RESET()
+#define USB_TIMELINE_SET_ADDRESS(addr)
+#define USB_TIMELINE_DESCRIPTOR(type, index, len)
+#define USB_TIMELINE_SET_CONFIGURATION(config)
+#define USB_TIMELINE_TRANSFER(ep_addr, len)
+#endif
+
+enum USBTimelineType {TimelineBusReset, TimelineSetAddress, TimelineGetDescriptor, TimelineSetConfiguration, TimelineFirstTransfer};
+
+/**
+ * @brief A single enumeration event: index is the descriptor index, the address, the configuration or the endpoint
+ */
+struct USBTimelineEvent {
+    uint32_t time_us; // relative to the bus reset
+    uint16_t len;
+    uint8_t type;
+    uint8_t desc_type;
+    uint8_t index;
+};
+
+/**
+ * @brief Records the enumeration events: a bus reset starts a new timeline and only the first class transfer is recorded.
+ * If there are more than USB_TIMELINE_SIZE events the last ones are dropped.
+ */
+class USBTimeline {
+    public:
+        static USBTimeline &instance() {
+            static USBTimeline inst;
+            return inst;
+        }
+
+        // records an event
+        void record(USBTimelineType type, uint8_t desc_type=0, uint8_t index=0, uint16_t len=0){
+            uint64_t now = USBClock::micros();
+            if (type==TimelineBusReset || count==0){
+                clear();
+                start_us = now;
+            }
+            if (type==TimelineFirstTransfer){
+                if (has_transfer){
+                    return;
+                }
+                has_transfer = true;
+            }
+            if (count>=USB_TIMELINE_SIZE){
+                dropped++;
+                return;
+            }
+            USBTimelineEvent &evt = events[count++];
+            evt.time_us = (uint32_t)(now - start_us);
+            evt.type = type;
+            evt.desc_type = desc_type;
+            evt.index = index;
+            evt.len = len;
+        }
+
+        // number of recorded events
+        int size() {
+            return count;
+        }
+
+        // number of events which did not fit into the timeline
+        int droppedCount() {
+            return dropped;
+        }
+
+        USBTimelineEvent &event(int idx){
+            return events[idx];
+        }
+
+        // time in us of the first event of the indicated type: -1 if it did not happen
+        int32_t time(USBTimelineType type){
+            for (int j=0;j<count;j++){
+                if (events[j].type==type) return events[j].time_us;
+            }
+            return -1;
+        }
+
+        // number of GET_DESCRIPTOR requests for the indicated descriptor type: 0 = all types
+        int descriptorCount(uint8_t desc_type=0){
+            int result = 0;
+            for (int j=0;j<count;j++){
+                if (events[j].type==TimelineGetDescriptor && (desc_type==0 || events[j].desc_type==desc_type)) result++;
+            }
+            return result;
+        }
+
+        // number of GET_DESCRIPTOR requests for a descriptor type and index which had already been requested before: 0 = all types
+        int repeatedCount(uint8_t desc_type=0){
+            int result = 0;
+            for (int j=0;j<count;j++){
+                if (events[j].type==TimelineGetDescriptor && (desc_type==0 || events[j].desc_type==desc_type) && isRepeated(j)) result++;
+            }
+            return result;
+        }
+
+        // writes a compact report line by line with the help of the printer: void printer(const char* line)
+        template<class Printer>
+        void report(Printer printer){
+            char line[80];
+            uint32_t max_gap = 0;
+            int max_gap_idx = -1;
+            for (int j=0;j<count;j++){
+                USBTimelineEvent &evt = events[j];
+                uint32_t gap = j>0 ? evt.time_us - events[j-1].time_us : 0;
+                if (gap>max_gap){
+                    max_gap = gap;
+                    max_gap_idx = j;
+                }
+                int len = snprintf(line, sizeof(line), "%8.3f ms %+8.3f  ", evt.time_us / 1000.0, gap / 1000.0);
+                describe(evt, line+len, sizeof(line)-len);
+                if (isRepeated(j)){
+                    strncat(line, " (repeated)", sizeof(line)-strlen(line)-1);
+                }
+                printer(line);
+            }
+            snprintf(line, sizeof(line), "configured: %.3f ms, first transfer: %.3f ms", time(TimelineSetConfiguration) / 1000.0, time(TimelineFirstTransfer) / 1000.0);
+            printer(line);
+            snprintf(line, sizeof(line), "descriptor requests: %d (%d repeated), dropped events: %d", descriptorCount(), repeatedCount(), dropped);
+            printer(line);
+            if (max_gap_idx>=0){
+                int len = snprintf(line, sizeof(line), "longest gap: %.3f ms before ", max_gap / 1000.0);
+                describe(events[max_gap_idx], line+len, sizeof(line)-len);
+                printer(line);
+            }
+        }
+
+#if defined(__linux__) || defined(TINYUSB_CPP_HOST_PORT)
+        // writes the report to the indicated file (e.g. stdout)
+        void report(FILE *file){
+            report([file](const char* line){ fprintf(file, "%s\n", line); });
+        }
+#endif
+
+        void clear() {
+            count = 0;
+            dropped = 0;
+            has_transfer = false;
+        }
+
+    protected:
+        USBTimelineEvent events[USB_TIMELINE_SIZE];
+        int count = 0;
+        int dropped = 0;
+        bool has_transfer = false;
+        uint64_t start_us = 0;
+
+        USBTimeline() {}
+
+        bool isRepeated(int idx){
+            USBTimelineEvent &evt = events[idx];
+            if (evt.type!=TimelineGetDescriptor){
+                return false;
+            }
+            for (int j=0;j<idx;j++){
+                if (events[j].type==TimelineGetDescriptor && events[j].desc_type==evt.desc_type && events[j].index==evt.index) return true;
+            }
+            return false;
+        }
+
+        static void describe(USBTimelineEvent &evt, char *str, int len){
+            static const char* desc_names[] = {"?", "device", "configuration", "string"};
+            switch(evt.type){
+                case TimelineBusReset:
+                    snprintf(str, len, "bus reset");
+                    break;
+                case TimelineSetAddress:
+                    snprintf(str, len, "SET_ADDRESS %d", evt.index);
+                    break;
+                case TimelineGetDescriptor:
+                    snprintf(str, len, "GET_DESCRIPTOR %s[%d] %d bytes", evt.desc_type<=3 ? desc_names[evt.desc_type] : "?", evt.index, evt.len);
+                    break;
+                case TimelineSetConfiguration:
+                    snprintf(str, len, "SET_CONFIGURATION %d", evt.index);
+                    break;
+                case TimelineFirstTransfer:
+                    snprintf(str, len, "first transfer ep 0x%02x %d bytes", evt.index, evt.len);
+                    break;
+            }
+        }
+};
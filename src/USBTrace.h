@@ -0,0 +1,269 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Tracing of the device side USB traffic: control requests, descriptor callbacks and the submission and
+ * completion of endpoint transfers are recorded with a microsecond time stamp into a fixed size ring buffer.
+ * Recording is just a copy of a few bytes: the records are only formatted when they are written as pcap
+ * (Linux usbmon format), which can be opened with Wireshark.
+ *
+ * The tracing is only active if USB_TRACE is defined: otherwise the USB_TRACE_XXX macros compile to nothing.
+ * The size of the ring buffer (number of records) can be defined with USB_TRACE_SIZE.
+ *
+ * The transfers are recorded by USBEndpoint::xfer() and USBEndpoint::completed(), so they are traced on the device
+ * in the same way as on the host port: transfers which a TinyUSB class driver submits directly with usbd_edpt_xfer()
+ * are not visible. TinyUSB has no common hook for the SETUP packets on the device: call USB_TRACE_SETUP(0, request)
+ * in the control callbacks of your classes (e.g. tud_vendor_control_xfer_cb() in CONTROL_STAGE_SETUP). The
+ * FunctionFS and USB/IP backends of the host port record all SETUP packets.
+ */
+
+#pragma once
+#include "tusb.h"
+#include "USBClock.h"
+#include <atomic>
+#include <errno.h>
+#include <stdio.h>
+
+#ifndef USB_TRACE_SIZE
+#define USB_TRACE_SIZE 256
+#endif
+
+#ifdef USB_TRACE
+#define USB_TRACE_SETUP(ep_addr, request) USBTrace::instance().record(TraceSetup, ep_addr, 8, 0, (const uint8_t*)(request))
+#define USB_TRACE_DESCRIPTOR(type, index, len) USBTrace::instance().record(TraceDescriptor, 0x80, len, 0, nullptr, type, index)
+#define USB_TRACE_SUBMIT(rhport, ep_addr, len) USBTrace::instance().record(TraceSubmit, ep_addr, len, 0, nullptr, 0, 0, rhport)
+#define USB_TRACE_COMPLETE(rhport, ep_addr, len, result) USBTrace::instance().record(TraceComplete, ep_addr, len, result, nullptr, 0, 0, rhport)
+#else
+#define USB_TRACE_SETUP(ep_addr, request)
+#define USB_TRACE_DESCRIPTOR(type, index, len)
+#define USB_TRACE_SUBMIT(rhport, ep_addr, len)
+#define USB_TRACE_COMPLETE(rhport, ep_addr, len, result)
+#endif
+
+enum USBTraceType {TraceSetup, TraceDescriptor, TraceSubmit, TraceComplete};
+
+/**
+ * @brief A single trace record
+ */
+struct USBTraceRecord {
+    uint32_t len;
+    uint64_t timestamp_us;
+    uint8_t type;
+    uint8_t ep_addr;
+    uint8_t status;
+    uint8_t desc_type;
+    uint8_t desc_index;
+    uint8_t rhport;
+    uint8_t setup[8];
+};
+
+/**
+ * @brief Lock free ring buffer of USBTraceRecord: recording is safe from multiple contexts (e.g. interrupt and task).
+ * If the ring buffer is full the oldest records are overwritten. Each slot is a sequence lock: the record is copied
+ * word by word through relaxed atomics, so a reader which overlaps with a writer gets a torn copy which it detects
+ * with the sequence number, but there is no data race.
+ */
+class USBTrace {
+    public:
+        static USBTrace &instance() {
+            static USBTrace inst;
+            return inst;
+        }
+
+        // records an event
+        void record(USBTraceType type, uint8_t ep_addr, uint32_t len, uint8_t status, const uint8_t *setup=nullptr, uint8_t desc_type=0, uint8_t desc_index=0, uint8_t rhport=0){
+            USBTraceRecord rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.timestamp_us = USBClock::micros();
+            rec.type = type;
+            rec.ep_addr = ep_addr;
+            rec.len = len;
+            rec.status = status;
+            rec.desc_type = desc_type;
+            rec.desc_index = desc_index;
+            rec.rhport = rhport;
+            if (setup!=nullptr){
+                memcpy(rec.setup, setup, 8);
+            }
+            uint32_t words[record_words];
+            memcpy(words, &rec, sizeof(rec));
+
+            uint32_t slot = head.fetch_add(1, std::memory_order_relaxed);
+            Slot &target = slots[slot % USB_TRACE_SIZE];
+            target.seq.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (int j=0;j<record_words;j++){
+                target.words[j].store(words[j], std::memory_order_relaxed);
+            }
+            target.seq.store(slot+1, std::memory_order_release);
+        }
+
+        // number of recorded events since the last clear (including the overwritten ones)
+        uint32_t totalCount() {
+            return head.load(std::memory_order_acquire);
+        }
+
+        // number of available records
+        int size() {
+            uint32_t total = totalCount();
+            return total < USB_TRACE_SIZE ? total : USB_TRACE_SIZE;
+        }
+
+        // copies the indicated record (0 = oldest available): returns false if it has been overwritten in the meantime
+        bool get(int idx, USBTraceRecord &result){
+            uint32_t total = totalCount();
+            uint32_t start = total < USB_TRACE_SIZE ? 0 : total - USB_TRACE_SIZE;
+            uint32_t slot = start + idx;
+            Slot &source = slots[slot % USB_TRACE_SIZE];
+            if (source.seq.load(std::memory_order_acquire)!=slot+1){
+                return false;
+            }
+            uint32_t words[record_words];
+            for (int j=0;j<record_words;j++){
+                words[j] = source.words[j].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (source.seq.load(std::memory_order_relaxed)!=slot+1){
+                return false;
+            }
+            memcpy(&result, words, sizeof(result));
+            return true;
+        }
+
+        // removes all records
+        void clear() {
+            for (int j=0;j<USB_TRACE_SIZE;j++){
+                slots[j].seq.store(0, std::memory_order_relaxed);
+            }
+            head.store(0, std::memory_order_release);
+        }
+
+        // writes the records in the pcap format (LINKTYPE_USB_LINUX_MMAPPED) with the help of the writer: void writer(const uint8_t* data, size_t len)
+        template<class Writer>
+        int writePcap(Writer writer, uint8_t devnum=1){
+            uint32_t header[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, 220};
+            writer((const uint8_t*)header, sizeof(header));
+            int count = 0;
+            USBTraceRecord rec;
+            for (int j=0;j<size();j++){
+                if (!get(j, rec)){
+                    continue;
+                }
+                uint8_t packet[16+64];
+                int len = pcapRecord(rec, devnum, packet);
+                writer(packet, len);
+                count++;
+            }
+            return count;
+        }
+
+#if defined(__linux__) || defined(TINYUSB_CPP_HOST_PORT)
+        // writes the records to a pcap file
+        bool writePcap(const char* path, uint8_t devnum=1){
+            FILE *file = fopen(path, "wb");
+            if (file==nullptr){
+                return false;
+            }
+            writePcap([file](const uint8_t *data, size_t len){ fwrite(data, 1, len, file); }, devnum);
+            fclose(file);
+            return true;
+        }
+#endif
+
+    protected:
+        // number of 32 bit words of a USBTraceRecord
+        static const int record_words = (sizeof(USBTraceRecord) + 3) / 4;
+
+        struct Slot {
+            std::atomic<uint32_t> seq{0};   // sequence number + 1 of the record: 0 = not valid
+            std::atomic<uint32_t> words[record_words];
+        };
+        Slot slots[USB_TRACE_SIZE];
+        std::atomic<uint32_t> head{0};
+
+        USBTrace() {}
+
+        static void put16(uint8_t *ptr, uint16_t value){
+            memcpy(ptr, &value, sizeof(value));
+        }
+
+        static void put32(uint8_t *ptr, uint32_t value){
+            memcpy(ptr, &value, sizeof(value));
+        }
+
+        static void put64(uint8_t *ptr, uint64_t value){
+            memcpy(ptr, &value, sizeof(value));
+        }
+
+        // determines the usbmon transfer type (0=iso, 1=interrupt, 2=control, 3=bulk) from the endpoint descriptor of the
+        // indicated port: defined in USBDescriptor.h
+        static uint8_t usbmonTransferType(uint8_t rhport, uint8_t ep_addr);
+
+        // usbmon reports the status of the URB as negative errno
+        static int32_t usbmonStatus(uint8_t result){
+            switch(result){
+                case XFER_RESULT_SUCCESS:
+                    return 0;
+                case XFER_RESULT_STALLED:
+                    return -EPIPE;
+                default:
+                    return -EPROTO;
+            }
+        }
+
+        // converts the record into a pcap record header followed by the 64 byte usbmon header
+        static int pcapRecord(USBTraceRecord &rec, uint8_t devnum, uint8_t *packet){
+            memset(packet, 0, 16+64);
+            uint32_t ts_sec = rec.timestamp_us / 1000000;
+            uint32_t ts_usec = rec.timestamp_us % 1000000;
+            put32(packet, ts_sec);
+            put32(packet+4, ts_usec);
+            put32(packet+8, 64);
+            put32(packet+12, 64);
+
+            uint8_t *mon = packet+16;
+            bool is_setup = rec.type==TraceSetup;
+            bool is_submit = rec.type==TraceSubmit || is_setup;
+            // the id needs to be identical for the submission and the completion
+            put64(mon, rec.ep_addr);
+            mon[8] = is_submit ? 'S' : 'C';
+            mon[9] = usbmonTransferType(rec.rhport, rec.ep_addr);
+            mon[10] = rec.ep_addr;
+            mon[11] = devnum;
+            // each port is reported as its own bus
+            put16(mon+12, rec.rhport + 1);
+            mon[14] = is_setup ? 0 : '-';
+            mon[15] = '<'; // data not captured
+            put64(mon+16, ts_sec);
+            put32(mon+24, ts_usec);
+            put32(mon+28, rec.type==TraceComplete ? usbmonStatus(rec.status) : 0);
+            put32(mon+32, is_setup ? ((tusb_control_request_t*)rec.setup)->wLength : rec.len);
+            put32(mon+36, 0);
+            if (is_setup){
+                memcpy(mon+40, rec.setup, 8);
+            }
+            return 16+64;
+        }
+};
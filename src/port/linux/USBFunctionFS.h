@@ -0,0 +1,407 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Linux FunctionFS backend: we export the descriptors which have been defined with USBDevice and
+ * USBStrings in the FunctionFS format, so that a Linux gadget (or dummy_hcd) presents the same function
+ * as the firmware. The endpoint I/O is done with io_submit() directly on the buffers of the class layers and
+ * the completions are reported with dcd_event_xfer_complete(), so the code on top of usbd_edpt_xfer() does
+ * not need to be changed.
+ *
+ * The device descriptor and the configuration descriptor are not part of a FunctionFS function: they are
+ * defined by the gadget (e.g. via configfs).
+ *
+ * Usage:
+ *   mount -t functionfs midi /dev/usb-ffs/midi
+ *   USBFunctionFS::instance().begin("/dev/usb-ffs/midi");
+ *   while(true) { USBFunctionFS::instance().poll(100); tud_task(); }
+ *
+ * Class specific control requests are forwarded to USBStubDCD::setControlCallback().
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <linux/usb/functionfs.h>
+
+#ifndef USB_FFS_MAX_ENDPOINTS
+#define USB_FFS_MAX_ENDPOINTS 15
+#endif
+
+/**
+ * @brief Converts the descriptors to the FunctionFS format and performs the endpoint I/O
+ */
+class USBFunctionFS : public USBStubBackend {
+    public:
+        static USBFunctionFS &instance() {
+            static USBFunctionFS inst;
+            return inst;
+        }
+
+        // Converts the configuration descriptor into the FunctionFS descriptor blob (v2 format with full and high speed descriptors): Returns the size in bytes
+        static int descriptors(const uint8_t* config, int len, Vector<uint8_t> &out){
+            out.clear();
+            appendLE32(out, FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+            appendLE32(out, 0); // length: updated at the end
+            appendLE32(out, FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC);
+            appendLE32(out, 0); // fs_count
+            appendLE32(out, 0); // hs_count
+            uint32_t fs_count = appendDescriptors(config, len, false, out);
+            uint32_t hs_count = appendDescriptors(config, len, true, out);
+            setLE32(out, 4, out.size());
+            setLE32(out, 12, fs_count);
+            setLE32(out, 16, hs_count);
+            return out.size();
+        }
+
+        // Converts the descriptors of the indicated configuration of the USBDevice: Returns 0 if it does not exist
+        static int descriptors(USBDevice &device, Vector<uint8_t> &out, int configIdx=0){
+            if (configIdx<0 || configIdx>=device.usbConfigurationCount()){
+                out.clear();
+                return 0;
+            }
+            // all configurations share the same buffer: we only use the block of the selected one
+            USBConfiguration *config = device.usbConfiguration(configIdx);
+            return descriptors(config->configurationDescriptor(), config->blockLength(), out);
+        }
+
+        // Converts the strings into the FunctionFS string blob: Returns the size in bytes
+        static int strings(USBStrings &strings, Vector<uint8_t> &out){
+            out.clear();
+            int count = strings.size();
+            appendLE32(out, FUNCTIONFS_STRINGS_MAGIC);
+            appendLE32(out, 0); // length: updated at the end
+            appendLE32(out, count);
+            appendLE32(out, count>0 ? 1 : 0);
+            if (count>0){
+                uint16_t lang = strings.languageId();
+                out.append(TU_U16_LOW(lang));
+                out.append(TU_U16_HIGH(lang));
+                for (int j=1;j<=count;j++){
+                    const char* str = strings.get(j);
+                    if (str!=nullptr){
+                        for (const char* ptr=str; *ptr!=0; ptr++){
+                            out.append(*ptr);
+                        }
+                    }
+                    out.append(0);
+                }
+            }
+            setLE32(out, 4, out.size());
+            return out.size();
+        }
+
+        // Writes the descriptors and strings of the configuration to ep0 of the mounted FunctionFS and opens its endpoints
+        bool begin(const char* path, USBDevice &device = USBDevice::instance(), int configIdx=0){
+            if (configIdx<0 || configIdx>=device.usbConfigurationCount()){
+                return false;
+            }
+            char name[256];
+            snprintf(name, sizeof(name), "%s/ep0", path);
+            ep0_fd = open(name, O_RDWR);
+            if (ep0_fd<0){
+                return false;
+            }
+
+            Vector<uint8_t> blob;
+            int len = descriptors(device, blob, configIdx);
+            if (write(ep0_fd, blob.data(), len)!=len){
+                end();
+                return false;
+            }
+            len = strings(USBStrings::instance(device.rhport()), blob);
+            if (write(ep0_fd, blob.data(), len)!=len){
+                end();
+                return false;
+            }
+
+            // FunctionFS provides the endpoints as ep1...epN in the sequence of the descriptors
+            USBConfiguration *config = device.usbConfiguration(configIdx);
+            const uint8_t *ptr = config->configurationDescriptor();
+            const uint8_t *end_ptr = ptr + config->blockLength();
+            endpoint_count = 0;
+            while(ptr<end_ptr && ptr[0]>0 && endpoint_count<USB_FFS_MAX_ENDPOINTS){
+                if (ptr[1]==TUSB_DESC_ENDPOINT){
+                    Endpoint &ep = endpoints[endpoint_count];
+                    ep.ep_addr = ptr[2];
+                    snprintf(name, sizeof(name), "%s/ep%d", path, endpoint_count+1);
+                    ep.fd = open(name, O_RDWR);
+                    ep.busy = false;
+                    endpoint_count++;
+                }
+                ptr += ptr[0];
+            }
+
+            // completions are signaled with an eventfd which we wait for together with ep0
+            event_fd = eventfd(0, EFD_NONBLOCK);
+            epoll_fd = epoll_create1(0);
+            memset(&aio_ctx, 0, sizeof(aio_ctx));
+            if (event_fd<0 || epoll_fd<0 || syscall(__NR_io_setup, USB_FFS_MAX_ENDPOINTS, &aio_ctx)<0){
+                end();
+                return false;
+            }
+            addEpoll(ep0_fd);
+            addEpoll(event_fd);
+
+            USBStubDCD::instance().setBackend(this);
+            return true;
+        }
+
+        // releases all resources
+        void end() {
+            if (USBStubDCD::instance().backend()==this){
+                USBStubDCD::instance().setBackend(nullptr);
+            }
+            if (aio_ctx!=0){
+                syscall(__NR_io_destroy, aio_ctx);
+                aio_ctx = 0;
+            }
+            for (int j=0;j<endpoint_count;j++){
+                closeFd(endpoints[j].fd);
+            }
+            endpoint_count = 0;
+            closeFd(epoll_fd);
+            closeFd(event_fd);
+            closeFd(ep0_fd);
+        }
+
+        // waits for the indicated time for ep0 events and completed transfers: call tud_task() afterwards to process them
+        int poll(int timeout_ms){
+            struct epoll_event events[2];
+            int count = epoll_wait(epoll_fd, events, 2, timeout_ms);
+            for (int j=0;j<count;j++){
+                if (events[j].data.fd==ep0_fd){
+                    processEp0();
+                } else if (events[j].data.fd==event_fd){
+                    processCompletions();
+                }
+            }
+            return count;
+        }
+
+        // submits the transfer with io_submit() - we use the buffer of the caller directly
+        bool xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes) override {
+            (void) rhport;
+            Endpoint *ep = endpoint(ep_addr);
+            if (ep==nullptr || ep->fd<0 || ep->busy){
+                return false;
+            }
+            memset(&ep->iocb, 0, sizeof(ep->iocb));
+            ep->iocb.aio_fildes = ep->fd;
+            ep->iocb.aio_lio_opcode = tu_edpt_dir(ep_addr)==TUSB_DIR_IN ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+            ep->iocb.aio_buf = (uint64_t)(uintptr_t) buffer;
+            ep->iocb.aio_nbytes = total_bytes;
+            ep->iocb.aio_flags = IOCB_FLAG_RESFD;
+            ep->iocb.aio_resfd = event_fd;
+            ep->iocb.aio_data = ep_addr;
+            struct iocb *list[1] = {&ep->iocb};
+            if (syscall(__NR_io_submit, aio_ctx, 1, list)!=1){
+                return false;
+            }
+            ep->busy = true;
+            return true;
+        }
+
+        // FunctionFS stalls an endpoint if we use it in the wrong direction
+        void stall(uint8_t rhport, uint8_t ep_addr) override {
+            (void) rhport;
+            if (tu_edpt_number(ep_addr)==0){
+                stallEp0(ep_addr);
+            } else {
+                Endpoint *ep = endpoint(ep_addr);
+                if (ep!=nullptr && ep->fd>=0){
+                    halt(ep->fd, ep_addr);
+                }
+            }
+        }
+
+    protected:
+        struct Endpoint {
+            uint8_t ep_addr = 0;
+            int fd = -1;
+            bool busy = false;
+            struct iocb iocb;
+        };
+
+        Endpoint endpoints[USB_FFS_MAX_ENDPOINTS];
+        int endpoint_count = 0;
+        int ep0_fd = -1;
+        int event_fd = -1;
+        int epoll_fd = -1;
+        aio_context_t aio_ctx = 0;
+        uint8_t ep0_buffer[512];
+
+        USBFunctionFS() {}
+
+        static void appendLE32(Vector<uint8_t> &out, uint32_t value){
+            for (int j=0;j<4;j++){
+                out.append((value >> (j*8)) & 0xff);
+            }
+        }
+
+        static void setLE32(Vector<uint8_t> &out, int pos, uint32_t value){
+            uint32_t le = htole32(value);
+            memcpy(out.data()+pos, &le, sizeof(le));
+        }
+
+        // copies all descriptors with the exception of the configuration descriptor: bulk endpoints are adjusted to the speed
+        static uint32_t appendDescriptors(const uint8_t* config, int len, bool highSpeed, Vector<uint8_t> &out){
+            uint32_t count = 0;
+            const uint8_t *ptr = config;
+            const uint8_t *end = config + len;
+            while(ptr<end && ptr[0]>0){
+                uint8_t desc_len = ptr[0];
+                if (ptr[1]!=TUSB_DESC_CONFIGURATION){
+                    int start = out.size();
+                    for (int j=0;j<desc_len;j++){
+                        out.append(ptr[j]);
+                    }
+                    if (ptr[1]==TUSB_DESC_ENDPOINT && (ptr[3] & 0b11)==TUSB_XFER_BULK){
+                        uint16_t size = highSpeed ? 512 : TU_MIN(64, ptr[4] | (ptr[5] << 8));
+                        out.data()[start+4] = TU_U16_LOW(size);
+                        out.data()[start+5] = TU_U16_HIGH(size);
+                    }
+                    count++;
+                }
+                ptr += desc_len;
+            }
+            return count;
+        }
+
+        Endpoint *endpoint(uint8_t ep_addr){
+            for (int j=0;j<endpoint_count;j++){
+                if (endpoints[j].ep_addr==ep_addr){
+                    return &endpoints[j];
+                }
+            }
+            return nullptr;
+        }
+
+        void addEpoll(int fd){
+            struct epoll_event evt;
+            memset(&evt, 0, sizeof(evt));
+            evt.events = EPOLLIN;
+            evt.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &evt);
+        }
+
+        static void closeFd(int &fd){
+            if (fd>=0){
+                close(fd);
+                fd = -1;
+            }
+        }
+
+        static void halt(int fd, uint8_t ep_addr){
+            // reading from an IN endpoint or writing to an OUT endpoint halts it
+            uint8_t dummy;
+            if (tu_edpt_dir(ep_addr)==TUSB_DIR_IN){
+                (void) read(fd, &dummy, 0);
+            } else {
+                (void) write(fd, &dummy, 0);
+            }
+        }
+
+        void stallEp0(uint8_t dir_addr){
+            halt(ep0_fd, dir_addr);
+        }
+
+        // reports the completed transfers to the stack
+        void processCompletions() {
+            uint64_t value;
+            if (read(event_fd, &value, sizeof(value))!=sizeof(value)){
+                return;
+            }
+            struct io_event io_events[USB_FFS_MAX_ENDPOINTS];
+            struct timespec timeout = {0, 0};
+            int count = syscall(__NR_io_getevents, aio_ctx, 1, USB_FFS_MAX_ENDPOINTS, io_events, &timeout);
+            for (int j=0;j<count;j++){
+                uint8_t ep_addr = (uint8_t) io_events[j].data;
+                Endpoint *ep = endpoint(ep_addr);
+                if (ep!=nullptr){
+                    ep->busy = false;
+                }
+                int64_t res = io_events[j].res;
+                if (res>=0){
+                    dcd_event_xfer_complete(0, ep_addr, res, XFER_RESULT_SUCCESS, false);
+                } else {
+                    dcd_event_xfer_complete(0, ep_addr, 0, res==-EPIPE ? XFER_RESULT_STALLED : XFER_RESULT_FAILED, false);
+                }
+            }
+        }
+
+        // processes the FunctionFS events
+        void processEp0() {
+            struct usb_functionfs_event event;
+            if (read(ep0_fd, &event, sizeof(event))!=sizeof(event)){
+                return;
+            }
+            switch(event.type){
+                case FUNCTIONFS_ENABLE:
+                    USBStubDCD::instance().setMounted(true);
+                    USB_TIMELINE_SET_CONFIGURATION(1);
+                    break;
+                case FUNCTIONFS_DISABLE:
+                case FUNCTIONFS_UNBIND:
+                    USBStubDCD::instance().setMounted(false);
+                    break;
+                case FUNCTIONFS_SETUP:
+                    processSetup((const tusb_control_request_t *) &event.u.setup);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // the data stage of a control request is done with read/write on ep0
+        void processSetup(const tusb_control_request_t *request){
+            USB_TRACE_SETUP(0, request);
+            uint16_t len = TU_MIN(request->wLength, sizeof(ep0_buffer));
+            bool is_in = request->bmRequestType_bit.direction==TUSB_DIR_IN;
+            if (!is_in && len>0){
+                if (read(ep0_fd, ep0_buffer, len)!=len){
+                    return;
+                }
+            }
+            if (!USBStubDCD::instance().controlRequest(request, ep0_buffer, len)){
+                stallEp0(is_in ? TUSB_DIR_IN_MASK : 0);
+                return;
+            }
+            if (is_in){
+                (void) write(ep0_fd, ep0_buffer, TU_MIN(len, request->wLength));
+            } else if (request->wLength==0){
+                // status stage
+                (void) read(ep0_fd, ep0_buffer, 0);
+            }
+        }
+};
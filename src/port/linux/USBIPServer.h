@@ -0,0 +1,651 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief USB/IP device server: the device which has been defined with USBDevice is exported over TCP, so that
+ * the Linux vhci_hcd can attach it and the real host class drivers (e.g. cdc_acm, snd-usb-midi) are used:
+ *
+ *   USBIPServer::instance().begin();
+ *   while(true) { USBIPServer::instance().poll(10); tud_task(); }
+ *
+ *   modprobe vhci-hcd
+ *   usbip attach -r 127.0.0.1 -b 1-1
+ *
+ * The standard requests on endpoint 0 are answered from the descriptors of USBDevice and USBStrings. Class
+ * and vendor requests are forwarded to USBStubDCD::setControlCallback(). The URBs of the other endpoints are
+ * matched with the transfers which have been submitted with usbd_edpt_xfer() and completed with
+ * dcd_event_xfer_complete(): an IN transfer which is bigger than the URB is split over multiple URBs, an OUT URB
+ * always completes the transfer. Isochronous transfers are not supported.
+ */
+
+#pragma once
+#include "USBDescriptor.h"
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#ifndef USBIP_MAX_URBS
+#define USBIP_MAX_URBS 16
+#endif
+
+#define USBIP_VERSION         0x0111
+#define USBIP_OP_REQ_DEVLIST  0x8005
+#define USBIP_OP_REP_DEVLIST  0x0005
+#define USBIP_OP_REQ_IMPORT   0x8003
+#define USBIP_OP_REP_IMPORT   0x0003
+#define USBIP_CMD_SUBMIT      0x0001
+#define USBIP_CMD_UNLINK      0x0002
+#define USBIP_RET_SUBMIT      0x0003
+#define USBIP_RET_UNLINK      0x0004
+#define USBIP_BUS_ID          "1-1"
+
+/**
+ * @brief Device information as it is exchanged in the USB/IP operations
+ */
+struct TU_ATTR_PACKED USBIPDeviceInfo {
+    char path[256];
+    char busid[32];
+    uint32_t busnum;
+    uint32_t devnum;
+    uint32_t speed;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t bDeviceClass;
+    uint8_t bDeviceSubClass;
+    uint8_t bDeviceProtocol;
+    uint8_t bConfigurationValue;
+    uint8_t bNumConfigurations;
+    uint8_t bNumInterfaces;
+};
+
+/**
+ * @brief Header of the URB commands and replies
+ */
+struct TU_ATTR_PACKED USBIPHeader {
+    uint32_t command;
+    uint32_t seqnum;
+    uint32_t devid;
+    uint32_t direction;
+    uint32_t ep;
+    union {
+        struct TU_ATTR_PACKED {
+            uint32_t transfer_flags;
+            int32_t transfer_buffer_length;
+            int32_t start_frame;
+            int32_t number_of_packets;
+            int32_t interval;
+            uint8_t setup[8];
+        } submit;
+        struct TU_ATTR_PACKED {
+            int32_t status;
+            int32_t actual_length;
+            int32_t start_frame;
+            int32_t number_of_packets;
+            int32_t error_count;
+            uint8_t padding[8];
+        } ret_submit;
+        struct TU_ATTR_PACKED {
+            uint32_t seqnum;
+            uint8_t padding[24];
+        } unlink;
+        struct TU_ATTR_PACKED {
+            int32_t status;
+            uint8_t padding[24];
+        } ret_unlink;
+    };
+};
+
+/**
+ * @brief Serves the USBDevice over USB/IP
+ */
+class USBIPServer : public USBStubBackend {
+    public:
+        static USBIPServer &instance() {
+            static USBIPServer inst;
+            return inst;
+        }
+
+        // starts to listen on localhost: use port 0 to get a free port
+        bool begin(uint16_t port=3240, USBDevice &device = USBDevice::instance()){
+            this->device = &device;
+            listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (listen_fd<0){
+                return false;
+            }
+            int on = 1;
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(port);
+            socklen_t addr_len = sizeof(addr);
+            if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr))<0
+                || listen(listen_fd, 1)<0
+                || getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len)<0){
+                end();
+                return false;
+            }
+            port_ = ntohs(addr.sin_port);
+            USBStubDCD::instance().setBackend(this);
+            return true;
+        }
+
+        // stops the server
+        void end() {
+            if (USBStubDCD::instance().backend()==this){
+                USBStubDCD::instance().setBackend(nullptr);
+            }
+            closeClient();
+            if (listen_fd>=0){
+                close(listen_fd);
+                listen_fd = -1;
+            }
+        }
+
+        // the port we are listening on
+        uint16_t port() {
+            return port_;
+        }
+
+        // true if a vhci has imported the device
+        bool isAttached() {
+            return attached;
+        }
+
+        // waits for the indicated time for new connections and requests: call tud_task() afterwards to process the completed transfers
+        int poll(int timeout_ms){
+            struct pollfd fds[2];
+            int count = 0;
+            fds[count].fd = listen_fd;
+            fds[count++].events = POLLIN;
+            if (client_fd>=0){
+                fds[count].fd = client_fd;
+                fds[count++].events = POLLIN;
+            }
+            int rc = ::poll(fds, count, timeout_ms);
+            if (rc<=0){
+                return rc;
+            }
+            if (count>1 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))){
+                if (!processClient()){
+                    closeClient();
+                }
+            }
+            if (fds[0].revents & POLLIN){
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd>=0){
+                    if (client_fd>=0){
+                        // we serve only one host
+                        close(fd);
+                    } else {
+                        int on = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                        client_fd = fd;
+                    }
+                }
+            }
+            return rc;
+        }
+
+        // the class layer has submitted a transfer: we complete it with the matching URBs
+        bool xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes) override {
+            (void) rhport;
+            Endpoint &ep = endpoint(ep_addr);
+            if (ep.active){
+                return false;
+            }
+            ep.buffer = buffer;
+            ep.len = total_bytes;
+            ep.done = 0;
+            ep.active = true;
+            process(ep_addr);
+            return true;
+        }
+
+        // the pending URBs are answered with -EPIPE
+        void stall(uint8_t rhport, uint8_t ep_addr) override {
+            (void) rhport;
+            if (tu_edpt_number(ep_addr)!=0){
+                process(ep_addr);
+            }
+        }
+
+    protected:
+        struct Urb {
+            uint32_t seqnum;
+            int32_t length;
+            uint8_t *data; // OUT data
+        };
+
+        struct Endpoint {
+            // transfer submitted by the device
+            uint8_t *buffer = nullptr;
+            uint16_t len = 0;
+            uint16_t done = 0;
+            bool active = false;
+            // URBs submitted by the host
+            Urb urbs[USBIP_MAX_URBS];
+            int urb_count = 0;
+        };
+
+        USBDevice *device = nullptr;
+        int listen_fd = -1;
+        int client_fd = -1;
+        uint16_t port_ = 0;
+        bool attached = false;
+        uint8_t configuration = 0;
+        Endpoint endpoints[2][16];
+        uint8_t ep0_buffer[1024];
+
+        USBIPServer() {}
+
+        Endpoint &endpoint(uint8_t ep_addr){
+            return endpoints[tu_edpt_dir(ep_addr)][tu_edpt_number(ep_addr) & 0x0f];
+        }
+
+        void closeClient() {
+            if (client_fd>=0){
+                close(client_fd);
+                client_fd = -1;
+            }
+            attached = false;
+            for (int dir=0;dir<2;dir++){
+                for (int num=0;num<16;num++){
+                    Endpoint &ep = endpoints[dir][num];
+                    for (int j=0;j<ep.urb_count;j++){
+                        delete[] ep.urbs[j].data;
+                    }
+                    ep.urb_count = 0;
+                }
+            }
+        }
+
+        bool readAll(void *data, int len){
+            uint8_t *ptr = (uint8_t*) data;
+            while(len>0){
+                int n = recv(client_fd, ptr, len, 0);
+                if (n<=0){
+                    return false;
+                }
+                ptr += n;
+                len -= n;
+            }
+            return true;
+        }
+
+        bool writeAll(const void *data, int len){
+            const uint8_t *ptr = (const uint8_t*) data;
+            while(len>0){
+                int n = send(client_fd, ptr, len, MSG_NOSIGNAL);
+                if (n<=0){
+                    return false;
+                }
+                ptr += n;
+                len -= n;
+            }
+            return true;
+        }
+
+        // handles the next request of the client: returns false if the connection needs to be closed
+        bool processClient() {
+            if (!attached){
+                return processOperation();
+            }
+            USBIPHeader header;
+            if (!readAll(&header, sizeof(header))){
+                return false;
+            }
+            switch(ntohl(header.command)){
+                case USBIP_CMD_SUBMIT:
+                    return processSubmit(header);
+                case USBIP_CMD_UNLINK:
+                    return processUnlink(header);
+                default:
+                    return false;
+            }
+        }
+
+        // OP_REQ_DEVLIST and OP_REQ_IMPORT
+        bool processOperation() {
+            uint16_t op[4];
+            if (!readAll(op, sizeof(op))){
+                return false;
+            }
+            uint16_t code = ntohs(op[1]);
+            if (code==USBIP_OP_REQ_DEVLIST){
+                writeOperationHeader(USBIP_OP_REP_DEVLIST, 0);
+                uint32_t count = htonl(1);
+                writeAll(&count, sizeof(count));
+                writeDeviceInfo();
+                writeInterfaceInfo();
+                // the devlist connection is closed by the client
+                return true;
+            } else if (code==USBIP_OP_REQ_IMPORT){
+                char busid[32];
+                if (!readAll(busid, sizeof(busid))){
+                    return false;
+                }
+                bool ok = strncmp(busid, USBIP_BUS_ID, sizeof(busid))==0;
+                writeOperationHeader(USBIP_OP_REP_IMPORT, ok ? 0 : 1);
+                if (ok){
+                    writeDeviceInfo();
+                    attached = true;
+                    // the import corresponds to plugging in the device
+                    dcd_event_bus_reset(0, USBStubDCD::instance().speed(), false);
+                }
+                return ok;
+            }
+            return false;
+        }
+
+        void writeOperationHeader(uint16_t code, uint32_t status){
+            uint16_t header[2] = {htons(USBIP_VERSION), htons(code)};
+            uint32_t status_be = htonl(status);
+            writeAll(header, sizeof(header));
+            writeAll(&status_be, sizeof(status_be));
+        }
+
+        const uint8_t *configurationDescriptor(int idx=0) {
+            return device->configurationDescriptor(idx);
+        }
+
+        // the block of the configuration in the shared buffer: wTotalLength might not have been finalized
+        uint16_t configurationDescriptorLength(int idx=0) {
+            return device->usbConfiguration(idx)->blockLength();
+        }
+
+        void writeDeviceInfo() {
+            const tusb_desc_device_t *desc = device->descriptor();
+            USBIPDeviceInfo info;
+            memset(&info, 0, sizeof(info));
+            strncpy(info.path, "/sys/devices/platform/tinyusb-cpp/usb1/" USBIP_BUS_ID, sizeof(info.path)-1);
+            strncpy(info.busid, USBIP_BUS_ID, sizeof(info.busid)-1);
+            info.busnum = htonl(1);
+            info.devnum = htonl(1);
+            // linux usb_device_speed: 2 = full speed, 3 = high speed
+            info.speed = htonl(tud_speed_get()==TUSB_SPEED_HIGH ? 3 : 2);
+            info.idVendor = htons(desc->idVendor);
+            info.idProduct = htons(desc->idProduct);
+            info.bcdDevice = htons(desc->bcdDevice);
+            info.bDeviceClass = desc->bDeviceClass;
+            info.bDeviceSubClass = desc->bDeviceSubClass;
+            info.bDeviceProtocol = desc->bDeviceProtocol;
+            info.bConfigurationValue = configuration;
+            info.bNumConfigurations = desc->bNumConfigurations;
+            info.bNumInterfaces = device->usbConfigurationCount()>0 ? ((const tusb_desc_configuration_t*)configurationDescriptor())->bNumInterfaces : 0;
+            writeAll(&info, sizeof(info));
+        }
+
+        // class, subclass, protocol and padding of each interface with alternate setting 0 of the first configuration,
+        // which also provides bNumInterfaces
+        void writeInterfaceInfo() {
+            if (device->usbConfigurationCount()==0){
+                return;
+            }
+            const uint8_t *ptr = configurationDescriptor();
+            const uint8_t *end = ptr + configurationDescriptorLength();
+            while(ptr<end && ptr[0]>0){
+                if (ptr[1]==TUSB_DESC_INTERFACE && ((const tusb_desc_interface_t*)ptr)->bAlternateSetting==0){
+                    const tusb_desc_interface_t *itf = (const tusb_desc_interface_t*)ptr;
+                    uint8_t info[4] = {itf->bInterfaceClass, itf->bInterfaceSubClass, itf->bInterfaceProtocol, 0};
+                    writeAll(info, sizeof(info));
+                }
+                ptr += ptr[0];
+            }
+        }
+
+        bool writeRetSubmit(uint32_t seqnum, int32_t status, const uint8_t *data, int32_t len){
+            USBIPHeader ret;
+            memset(&ret, 0, sizeof(ret));
+            ret.command = htonl(USBIP_RET_SUBMIT);
+            ret.seqnum = htonl(seqnum);
+            ret.ret_submit.status = htonl(status);
+            ret.ret_submit.actual_length = htonl(len);
+            if (!writeAll(&ret, sizeof(ret))){
+                return false;
+            }
+            return data==nullptr || len==0 || writeAll(data, len);
+        }
+
+        bool processSubmit(USBIPHeader &header){
+            uint32_t seqnum = ntohl(header.seqnum);
+            uint8_t ep_num = ntohl(header.ep) & 0x0f;
+            bool is_in = ntohl(header.direction)==1;
+            int32_t length = ntohl(header.submit.transfer_buffer_length);
+            if (length<0){
+                return false;
+            }
+            uint8_t *data = nullptr;
+            if (!is_in && length>0){
+                data = new uint8_t[length];
+                if (!readAll(data, length)){
+                    delete[] data;
+                    return false;
+                }
+            }
+
+            if (ep_num==0){
+                bool ok = processControl(seqnum, (const tusb_control_request_t*)header.submit.setup, data, length);
+                delete[] data;
+                return ok;
+            }
+
+            uint8_t ep_addr = tu_edpt_addr(ep_num, is_in);
+            Endpoint &ep = endpoint(ep_addr);
+            if (ep.urb_count>=USBIP_MAX_URBS){
+                delete[] data;
+                return writeRetSubmit(seqnum, -EAGAIN, nullptr, 0);
+            }
+            Urb &urb = ep.urbs[ep.urb_count++];
+            urb.seqnum = seqnum;
+            urb.length = length;
+            urb.data = data;
+            process(ep_addr);
+            return true;
+        }
+
+        bool processUnlink(USBIPHeader &header){
+            uint32_t unlink_seqnum = ntohl(header.unlink.seqnum);
+            int32_t status = 0;
+            for (int dir=0;dir<2 && status==0;dir++){
+                for (int num=0;num<16 && status==0;num++){
+                    Endpoint &ep = endpoints[dir][num];
+                    for (int j=0;j<ep.urb_count;j++){
+                        if (ep.urbs[j].seqnum==unlink_seqnum){
+                            delete[] ep.urbs[j].data;
+                            removeUrb(ep, j);
+                            status = -ECONNRESET;
+                            break;
+                        }
+                    }
+                }
+            }
+            USBIPHeader ret;
+            memset(&ret, 0, sizeof(ret));
+            ret.command = htonl(USBIP_RET_UNLINK);
+            ret.seqnum = header.seqnum;
+            ret.ret_unlink.status = htonl(status);
+            return writeAll(&ret, sizeof(ret));
+        }
+
+        static void removeUrb(Endpoint &ep, int idx){
+            for (int j=idx;j<ep.urb_count-1;j++){
+                ep.urbs[j] = ep.urbs[j+1];
+            }
+            ep.urb_count--;
+        }
+
+        // matches the URBs of the host with the transfer of the device
+        void process(uint8_t ep_addr){
+            if (client_fd<0){
+                return;
+            }
+            Endpoint &ep = endpoint(ep_addr);
+            bool is_in = tu_edpt_dir(ep_addr)==TUSB_DIR_IN;
+            while(ep.urb_count>0){
+                Urb urb = ep.urbs[0];
+                if (usbd_edpt_stalled(0, ep_addr)){
+                    removeUrb(ep, 0);
+                    delete[] urb.data;
+                    writeRetSubmit(urb.seqnum, -EPIPE, nullptr, 0);
+                    continue;
+                }
+                if (!ep.active){
+                    break;
+                }
+                removeUrb(ep, 0);
+                int len = TU_MIN(urb.length, ep.len - ep.done);
+                if (is_in){
+                    writeRetSubmit(urb.seqnum, 0, ep.buffer + ep.done, len);
+                    ep.done += len;
+                    // we continue with the next URB if the transfer was bigger than the URB
+                    if (ep.done < ep.len){
+                        continue;
+                    }
+                } else {
+                    if (len>0){
+                        memcpy(ep.buffer + ep.done, urb.data, len);
+                    }
+                    ep.done += len;
+                    writeRetSubmit(urb.seqnum, 0, nullptr, len);
+                }
+                delete[] urb.data;
+                ep.active = false;
+                dcd_event_xfer_complete(0, ep_addr, ep.done, XFER_RESULT_SUCCESS, false);
+            }
+        }
+
+        // standard requests are answered from the descriptors, the others are forwarded to the control callback
+        bool processControl(uint32_t seqnum, const tusb_control_request_t *request, uint8_t *data, int32_t length){
+            int32_t len = 0;
+            bool ok = true;
+            USB_TRACE_SETUP(0, request);
+            if (request->bmRequestType_bit.type==TUSB_REQ_TYPE_STANDARD){
+                ok = processStandardRequest(request, len);
+            } else {
+                uint16_t cb_len = TU_MIN(length, (int32_t)sizeof(ep0_buffer));
+                if (data!=nullptr){
+                    memcpy(ep0_buffer, data, cb_len);
+                }
+                ok = USBStubDCD::instance().controlRequest(request, ep0_buffer, cb_len);
+                len = cb_len;
+            }
+            if (!ok){
+                return writeRetSubmit(seqnum, -EPIPE, nullptr, 0);
+            }
+            bool is_in = request->bmRequestType_bit.direction==TUSB_DIR_IN;
+            len = TU_MIN(len, (int32_t)request->wLength);
+            return writeRetSubmit(seqnum, 0, is_in ? ep0_buffer : nullptr, is_in ? len : length);
+        }
+
+        bool processStandardRequest(const tusb_control_request_t *request, int32_t &len){
+            switch(request->bRequest){
+                case TUSB_REQ_GET_DESCRIPTOR:
+                    return getDescriptor(request->wValue >> 8, request->wValue & 0xff, len);
+                case TUSB_REQ_SET_ADDRESS:
+                    dcd_set_address(0, request->wValue & 0x7f);
+                    return true;
+                case TUSB_REQ_SET_CONFIGURATION:
+                    configuration = request->wValue & 0xff;
+                    USBStubDCD::instance().setMounted(configuration!=0);
+                    USB_TIMELINE_SET_CONFIGURATION(configuration);
+                    return true;
+                case TUSB_REQ_GET_CONFIGURATION:
+                    ep0_buffer[0] = configuration;
+                    len = 1;
+                    return true;
+                case TUSB_REQ_GET_STATUS:
+                    ep0_buffer[0] = 0;
+                    ep0_buffer[1] = 0;
+                    if (request->bmRequestType_bit.recipient==TUSB_REQ_RCPT_ENDPOINT){
+                        ep0_buffer[0] = usbd_edpt_stalled(0, request->wIndex & 0xff) ? 1 : 0;
+                    }
+                    len = 2;
+                    return true;
+                case TUSB_REQ_GET_INTERFACE:
+                    ep0_buffer[0] = 0;
+                    len = 1;
+                    return true;
+                case TUSB_REQ_CLEAR_FEATURE:
+                case TUSB_REQ_SET_FEATURE:
+                    if (request->bmRequestType_bit.recipient==TUSB_REQ_RCPT_ENDPOINT){
+                        uint8_t ep_addr = request->wIndex & 0xff;
+                        if (request->bRequest==TUSB_REQ_CLEAR_FEATURE){
+                            usbd_edpt_clear_stall(0, ep_addr);
+                        } else {
+                            usbd_edpt_stall(0, ep_addr);
+                        }
+                    }
+                    return true;
+                case TUSB_REQ_SET_INTERFACE:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        bool getDescriptor(uint8_t type, uint8_t index, int32_t &len){
+            switch(type){
+                case TUSB_DESC_DEVICE:
+                    len = sizeof(tusb_desc_device_t);
+                    memcpy(ep0_buffer, device->deviceDescriptor(), len);
+                    return true;
+                case TUSB_DESC_CONFIGURATION: {
+                    if (index>=device->usbConfigurationCount()){
+                        return false;
+                    }
+                    // we do not provide a truncated copy with a wTotalLength which does not match
+                    len = configurationDescriptorLength(index);
+                    if (len>(int32_t)sizeof(ep0_buffer)){
+                        return false;
+                    }
+                    memcpy(ep0_buffer, configurationDescriptor(index), len);
+                    ((tusb_desc_configuration_t*)ep0_buffer)->wTotalLength = len;
+                    return true;
+                }
+                case TUSB_DESC_STRING: {
+                    if (index>USBStrings::instance(device->rhport()).size()){
+                        return false;
+                    }
+                    const uint16_t *str = device->string(index);
+                    if (str==nullptr){
+                        return false;
+                    }
+                    len = ((const uint8_t*)str)[0];
+                    memcpy(ep0_buffer, str, len);
+                    return true;
+                }
+                default:
+                    // e.g. the device qualifier of a full speed device
+                    return false;
+            }
+        }
+};
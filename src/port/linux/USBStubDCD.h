@@ -0,0 +1,420 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2019 Phil Schatzmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/**
+ * @brief Recording stub of the TinyUSB device controller driver (DCD) for the Linux host port. Nothing is
+ * sent anywhere: all calls are just recorded, so that tests can check what the class layers have submitted.
+ * The "host" side is simulated by calling complete() which is reported to the registered transfer callback
+ * in the next tud_task() - the same way as TinyUSB does it.
+ *
+ * This file is included by the tusb.h of the host port and is not supposed to be included directly.
+ */
+
+#pragma once
+#include "USBTrace.h"
+#include "USBLatency.h"
+#include "USBTimeline.h"
+#include <mutex>
+
+#ifndef USB_STUB_MAX_EVENTS
+#define USB_STUB_MAX_EVENTS 256
+#endif
+
+#ifndef USB_STUB_MAX_PENDING
+#define USB_STUB_MAX_PENDING 32
+#endif
+
+// number of device controllers (rhport): the same default as in USBDescriptor.h
+#ifndef USB_PORT_COUNT
+#define USB_PORT_COUNT 2
+#endif
+
+// Recorded activities
+enum USBStubEventType {StubInit, StubBusReset, StubSetAddress, StubEndpointOpen, StubTransfer, StubTransferComplete, StubStall, StubClearStall};
+
+/**
+ * @brief A single recorded activity of the stub device controller
+ */
+struct USBStubEvent {
+    USBStubEventType type;
+    uint8_t rhport;
+    uint8_t ep_addr;
+    uint16_t len;
+    uint8_t *buffer;
+};
+
+/**
+ * @brief Optional real I/O behind the stub (e.g. FunctionFS or USB/IP): the transfers are still recorded
+ * but they are also forwarded to the backend which reports the completion with dcd_event_xfer_complete().
+ */
+class USBStubBackend {
+    public:
+        virtual ~USBStubBackend() {}
+        // starts the transfer: the buffer must stay valid until the transfer has been completed
+        virtual bool xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes) = 0;
+        // stalls the endpoint
+        virtual void stall(uint8_t rhport, uint8_t ep_addr) {}
+};
+
+// Handler for class and vendor specific control requests: fill the buffer for IN requests and return false to stall
+typedef bool (*USBStubControlCallback)(const tusb_control_request_t *request, uint8_t *buffer, uint16_t &len);
+
+typedef void (*USBStubTransferCallback)(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes);
+
+// the events of the device controller as in TinyUSB's dcd.h
+typedef enum {
+    DCD_EVENT_INVALID = 0,
+    DCD_EVENT_BUS_RESET,
+    DCD_EVENT_UNPLUGGED,
+    DCD_EVENT_SOF,
+    DCD_EVENT_SUSPEND,
+    DCD_EVENT_RESUME,
+    DCD_EVENT_SETUP_RECEIVED,
+    DCD_EVENT_XFER_COMPLETE
+} dcd_eventid_t;
+
+// informs about a new event for tud_task() like TinyUSB's tud_event_hook_cb(): e.g. to wake up a run loop
+typedef void (*USBStubEventHook)(uint8_t rhport, uint32_t eventid, bool in_isr);
+
+/**
+ * @brief Device Controller Driver which records all requests. We keep the last USB_STUB_MAX_EVENTS events.
+ */
+class USBStubDCD {
+    public:
+        static USBStubDCD &instance() {
+            static USBStubDCD inst;
+            return inst;
+        }
+
+        // defines the speed which is reported by tud_speed_get()
+        void setSpeed(tusb_speed_t speed){
+            speed_ = speed;
+        }
+
+        tusb_speed_t speed() {
+            return speed_;
+        }
+
+        // defines the callback which is informed about completed transfers in tud_task()
+        void setTransferCallback(USBStubTransferCallback cb){
+            transfer_cb = cb;
+        }
+
+        // defines the hook which is called when a new event is queued for tud_task()
+        void setEventHook(USBStubEventHook hook){
+            event_hook = hook;
+        }
+
+        // reports an event to the hook
+        void notify(uint8_t rhport, uint32_t eventid, bool in_isr){
+            if (event_hook!=nullptr){
+                event_hook(rhport, eventid, in_isr);
+            }
+        }
+
+        // defines the handler for the class and vendor specific control requests which are received by a backend
+        void setControlCallback(USBStubControlCallback cb){
+            control_cb = cb;
+        }
+
+        USBStubControlCallback controlCallback() {
+            return control_cb;
+        }
+
+        // dispatches a class or vendor specific control request to the control callback: returns false to stall
+        bool controlRequest(const tusb_control_request_t *request, uint8_t *buffer, uint16_t &len){
+            if (control_cb==nullptr){
+                return false;
+            }
+            if (request->bmRequestType_bit.type==TUSB_REQ_TYPE_VENDOR){
+                USB_LATENCY_SCOPE(LatencyVendorRequest);
+                return control_cb(request, buffer, len);
+            }
+            USB_LATENCY_SCOPE(LatencyClassRequest);
+            return control_cb(request, buffer, len);
+        }
+
+        // forwards the transfers to the indicated backend: use nullptr to only record them
+        void setBackend(USBStubBackend *backend){
+            backend_ = backend;
+        }
+
+        USBStubBackend *backend() {
+            return backend_;
+        }
+
+        // simulates that the host has completed the transfer on the indicated endpoint: this can also be called from
+        // a different thread than tud_task() like an interrupt
+        bool complete(uint8_t ep_addr, uint32_t xferred_bytes, xfer_result_t result=XFER_RESULT_SUCCESS, uint8_t rhport=0){
+            {
+                std::lock_guard<std::mutex> lock(pending_mutex);
+                if (pending_count>=USB_STUB_MAX_PENDING){
+                    return false;
+                }
+                Pending &p = pending[(pending_start + pending_count) % USB_STUB_MAX_PENDING];
+                p.rhport = rhport;
+                p.ep_addr = ep_addr;
+                p.result = result;
+                p.xferred_bytes = xferred_bytes;
+                pending_count++;
+            }
+            notify(rhport, DCD_EVENT_XFER_COMPLETE, true);
+            return true;
+        }
+
+        // reports the pending transfer completions: called by tud_task()
+        void task() {
+            while(true){
+                Pending p;
+                {
+                    std::lock_guard<std::mutex> lock(pending_mutex);
+                    if (pending_count==0){
+                        break;
+                    }
+                    p = pending[pending_start];
+                    pending_start = (pending_start + 1) % USB_STUB_MAX_PENDING;
+                    pending_count--;
+                }
+                setBusy(p.ep_addr, false, p.rhport);
+                record(StubTransferComplete, p.rhport, p.ep_addr, p.xferred_bytes, nullptr);
+                if (transfer_cb!=nullptr){
+                    transfer_cb(p.rhport, p.ep_addr, p.result, p.xferred_bytes);
+                }
+            }
+        }
+
+        // records an activity
+        void record(USBStubEventType type, uint8_t rhport, uint8_t ep_addr, uint16_t len, uint8_t *buffer){
+            USBStubEvent &evt = events[total_count % USB_STUB_MAX_EVENTS];
+            evt.type = type;
+            evt.rhport = rhport;
+            evt.ep_addr = ep_addr;
+            evt.len = len;
+            evt.buffer = buffer;
+            total_count++;
+        }
+
+        // number of available recorded events
+        int eventCount() {
+            return total_count < USB_STUB_MAX_EVENTS ? total_count : USB_STUB_MAX_EVENTS;
+        }
+
+        // number of events which have been recorded since clear(): including the ones which are no longer available
+        int totalCount() {
+            return total_count;
+        }
+
+        // provides the recorded event: 0 is the oldest available one
+        USBStubEvent& event(int idx){
+            int start = total_count < USB_STUB_MAX_EVENTS ? 0 : total_count - USB_STUB_MAX_EVENTS;
+            return events[(start + idx) % USB_STUB_MAX_EVENTS];
+        }
+
+        // counts the recorded events of the indicated type
+        int count(USBStubEventType type){
+            int result = 0;
+            for (int j=0;j<eventCount();j++){
+                if (event(j).type==type) result++;
+            }
+            return result;
+        }
+
+        bool isBusy(uint8_t ep_addr, uint8_t rhport=0){
+            return busy[port(rhport)][tu_edpt_dir(ep_addr)][tu_edpt_number(ep_addr) & 0x0f];
+        }
+
+        void setBusy(uint8_t ep_addr, bool value, uint8_t rhport=0){
+            busy[port(rhport)][tu_edpt_dir(ep_addr)][tu_edpt_number(ep_addr) & 0x0f] = value;
+        }
+
+        bool isStalled(uint8_t ep_addr, uint8_t rhport=0){
+            return stalled[port(rhport)][tu_edpt_dir(ep_addr)][tu_edpt_number(ep_addr) & 0x0f];
+        }
+
+        void setStalled(uint8_t ep_addr, bool value, uint8_t rhport=0){
+            stalled[port(rhport)][tu_edpt_dir(ep_addr)][tu_edpt_number(ep_addr) & 0x0f] = value;
+        }
+
+        bool isMounted() {
+            return mounted;
+        }
+
+        void setMounted(bool value){
+            mounted = value;
+        }
+
+        uint8_t address() {
+            return address_;
+        }
+
+        void setAddress(uint8_t addr){
+            address_ = addr;
+        }
+
+        // removes all recorded events and pending completions
+        void clear() {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            total_count = 0;
+            pending_start = 0;
+            pending_count = 0;
+            memset(busy, 0, sizeof(busy));
+            memset(stalled, 0, sizeof(stalled));
+        }
+
+    protected:
+        struct Pending {
+            uint8_t rhport;
+            uint8_t ep_addr;
+            xfer_result_t result;
+            uint32_t xferred_bytes;
+        };
+
+        USBStubEvent events[USB_STUB_MAX_EVENTS];
+        int total_count = 0;
+        Pending pending[USB_STUB_MAX_PENDING];
+        int pending_start = 0;
+        int pending_count = 0;
+        bool busy[USB_PORT_COUNT][2][16] = {};
+        bool stalled[USB_PORT_COUNT][2][16] = {};
+        bool mounted = false;
+        uint8_t address_ = 0;
+        tusb_speed_t speed_ = TUD_OPT_HIGH_SPEED ? TUSB_SPEED_HIGH : TUSB_SPEED_FULL;
+        USBStubTransferCallback transfer_cb = nullptr;
+        USBStubControlCallback control_cb = nullptr;
+
+        // the endpoint state of an unknown port is kept with port 0 as in the descriptor objects
+        static uint8_t port(uint8_t rhport){
+            return rhport<USB_PORT_COUNT ? rhport : 0;
+        }
+        USBStubBackend *backend_ = nullptr;
+        USBStubEventHook event_hook = nullptr;
+        std::mutex pending_mutex;
+
+        USBStubDCD() {}
+};
+
+//--------------------------------------------------------------------
+// Device Controller Driver API
+//--------------------------------------------------------------------
+
+inline void dcd_init(uint8_t rhport){
+    USBStubDCD::instance().record(StubInit, rhport, 0, 0, nullptr);
+}
+
+inline void dcd_set_address(uint8_t rhport, uint8_t dev_addr){
+    USBStubDCD::instance().setAddress(dev_addr);
+    USBStubDCD::instance().record(StubSetAddress, rhport, 0, dev_addr, nullptr);
+    USB_TIMELINE_SET_ADDRESS(dev_addr);
+}
+
+inline bool dcd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const * desc_ep){
+    USBStubDCD::instance().record(StubEndpointOpen, rhport, desc_ep->bEndpointAddress, desc_ep->wMaxPacketSize.size, nullptr);
+    return true;
+}
+
+inline bool dcd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes){
+    // the trace is recorded by USBEndpoint::xfer() and completed() as on the device
+    USBStubDCD::instance().record(StubTransfer, rhport, ep_addr, total_bytes, buffer);
+    if (tu_edpt_number(ep_addr)!=0){
+        USB_TIMELINE_TRANSFER(ep_addr, total_bytes);
+    }
+    if (USBStubDCD::instance().backend()!=nullptr && !USBStubDCD::instance().backend()->xfer(rhport, ep_addr, buffer, total_bytes)){
+        return false;
+    }
+    USBStubDCD::instance().setBusy(ep_addr, true, rhport);
+    return true;
+}
+
+inline void dcd_edpt_stall(uint8_t rhport, uint8_t ep_addr){
+    USBStubDCD::instance().setStalled(ep_addr, true, rhport);
+    USBStubDCD::instance().record(StubStall, rhport, ep_addr, 0, nullptr);
+    if (USBStubDCD::instance().backend()!=nullptr){
+        USBStubDCD::instance().backend()->stall(rhport, ep_addr);
+    }
+}
+
+inline void dcd_edpt_clear_stall(uint8_t rhport, uint8_t ep_addr){
+    USBStubDCD::instance().setStalled(ep_addr, false, rhport);
+    USBStubDCD::instance().record(StubClearStall, rhport, ep_addr, 0, nullptr);
+}
+
+inline void dcd_event_bus_reset(uint8_t rhport, tusb_speed_t speed, bool in_isr){
+    USBStubDCD::instance().setSpeed(speed);
+    USBStubDCD::instance().setAddress(0);
+    USBStubDCD::instance().setMounted(false);
+    USBStubDCD::instance().record(StubBusReset, rhport, 0, 0, nullptr);
+    USB_TIMELINE_BUS_RESET();
+    USBStubDCD::instance().notify(rhport, DCD_EVENT_BUS_RESET, in_isr);
+}
+
+inline void dcd_event_xfer_complete(uint8_t rhport, uint8_t ep_addr, uint32_t xferred_bytes, uint8_t result, bool in_isr){
+    (void) in_isr;
+    USBStubDCD::instance().complete(ep_addr, xferred_bytes, (xfer_result_t) result, rhport);
+}
+
+//--------------------------------------------------------------------
+// Device Stack API
+//--------------------------------------------------------------------
+
+inline bool tusb_init() {
+    dcd_init(0);
+    return true;
+}
+
+inline void tud_task() {
+    USBStubDCD::instance().task();
+}
+
+inline tusb_speed_t tud_speed_get() {
+    return USBStubDCD::instance().speed();
+}
+
+inline bool tud_mounted() {
+    return USBStubDCD::instance().isMounted();
+}
+
+inline bool usbd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const * desc_ep){
+    return dcd_edpt_open(rhport, desc_ep);
+}
+
+inline bool usbd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes){
+    return dcd_edpt_xfer(rhport, ep_addr, buffer, total_bytes);
+}
+
+inline bool usbd_edpt_busy(uint8_t rhport, uint8_t ep_addr){
+    return USBStubDCD::instance().isBusy(ep_addr, rhport);
+}
+
+inline void usbd_edpt_stall(uint8_t rhport, uint8_t ep_addr){
+    dcd_edpt_stall(rhport, ep_addr);
+}
+
+inline void usbd_edpt_clear_stall(uint8_t rhport, uint8_t ep_addr){
+    dcd_edpt_clear_stall(rhport, ep_addr);
+}
+
+inline bool usbd_edpt_stalled(uint8_t rhport, uint8_t ep_addr){
+    return USBStubDCD::instance().isStalled(ep_addr, rhport);
+}
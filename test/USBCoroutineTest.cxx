@@ -0,0 +1,176 @@
+/**
+ * Test cases for USBCoroutine.h: this test is compiled with C++20
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBDescriptor.h"
+#include "USBTestDevice.h"
+#include "gtest/gtest.h"
+
+static USBConfiguration *setupDevice() {
+    return setupTestDevice(usb_test_vendor, sizeof(usb_test_vendor));
+}
+
+// last buffer which was submitted on the endpoint
+static uint8_t *lastBuffer(uint8_t ep_addr, uint16_t &len){
+    USBStubDCD &dcd = USBStubDCD::instance();
+    for (int j=dcd.eventCount()-1;j>=0;j--){
+        USBStubEvent &evt = dcd.event(j);
+        if (evt.type==StubTransfer && evt.ep_addr==ep_addr){
+            len = evt.len;
+            return evt.buffer;
+        }
+    }
+    return nullptr;
+}
+
+static int echo_count = 0;
+
+// receives packets and sends them back in upper case until an empty packet arrives
+static USBTask echo(USBEndpoint &out, USBEndpoint &in){
+    uint8_t buffer[64];
+    while(true){
+        USBTransferResult r = co_await out.read(buffer);
+        if (!r.ok() || r.bytes==0){
+            break;
+        }
+        for (uint32_t j=0;j<r.bytes;j++){
+            buffer[j] = toupper(buffer[j]);
+        }
+        r = co_await in.write(std::span<const uint8_t>(buffer, r.bytes));
+        if (!r.ok()){
+            break;
+        }
+        echo_count++;
+    }
+}
+
+TEST(USBCoroutineTests, Echo) {
+    USBConfiguration *config = setupDevice();
+    USBEndpoint &out = *config->usbEndpoint((uint8_t)0x01);
+    USBEndpoint &in = *config->usbEndpoint((uint8_t)0x81);
+    USBExecutor &executor = USBExecutor::instance();
+    USBCoroutinePool &pool = USBCoroutinePool::instance();
+    echo_count = 0;
+
+    ASSERT_TRUE(executor.spawn(echo(out, in)));
+    EXPECT_EQ(pool.usedCount(), 1);
+    EXPECT_EQ(executor.activeCount(), 1);
+    // the coroutine starts and waits for the OUT transfer
+    EXPECT_EQ(executor.task(), 1);
+    EXPECT_EQ(USBStubDCD::instance().count(StubTransfer), 1);
+
+    for (int j=0;j<3;j++){
+        uint16_t len;
+        uint8_t *buffer = lastBuffer(0x01, len);
+        ASSERT_TRUE(buffer!=nullptr);
+        EXPECT_EQ(len, 64);
+        // nothing happens before the host has sent the data
+        EXPECT_EQ(executor.task(), 0);
+        memcpy(buffer, "hello", 5);
+        USBStubDCD::instance().complete(0x01, 5);
+        EXPECT_EQ(executor.task(), 1);
+
+        // the IN transfer uses the same buffer without copy
+        uint16_t in_len;
+        EXPECT_EQ(lastBuffer(0x81, in_len), buffer);
+        EXPECT_EQ(in_len, 5);
+        EXPECT_EQ(memcmp(buffer, "HELLO", 5), 0);
+        USBStubDCD::instance().complete(0x81, 5);
+        EXPECT_EQ(executor.task(), 1);
+        EXPECT_EQ(echo_count, j+1);
+    }
+
+    // the empty packet ends the coroutine and releases the frame
+    USBStubDCD::instance().complete(0x01, 0);
+    executor.task();
+    EXPECT_EQ(executor.activeCount(), 0);
+    EXPECT_EQ(pool.usedCount(), 0);
+    USBStubDCD::instance().setTransferCallback(nullptr);
+    USBDevice::instance().clear();
+}
+
+static int yield_count = 0;
+
+static USBTask counter(int n){
+    for (int j=0;j<n;j++){
+        yield_count++;
+        co_await USBExecutor::instance().yield();
+    }
+}
+
+TEST(USBCoroutineTests, Pool) {
+    USBExecutor &executor = USBExecutor::instance();
+    USBCoroutinePool &pool = USBCoroutinePool::instance();
+    yield_count = 0;
+    for (int j=0;j<USB_COROUTINE_FRAMES;j++){
+        EXPECT_TRUE(executor.spawn(counter(2)));
+    }
+    // all frames are used
+    int failed = pool.failedCount();
+    EXPECT_FALSE(executor.spawn(counter(2)));
+    EXPECT_EQ(pool.failedCount(), failed + 1);
+
+    // each run resumes every coroutine once
+    EXPECT_EQ(executor.run(), USB_COROUTINE_FRAMES);
+    EXPECT_EQ(yield_count, USB_COROUTINE_FRAMES);
+    executor.run();
+    executor.run();
+    EXPECT_EQ(yield_count, 2 * USB_COROUTINE_FRAMES);
+    EXPECT_EQ(executor.activeCount(), 0);
+    EXPECT_EQ(pool.usedCount(), 0);
+
+    // a task which is not spawned releases its frame
+    {
+        USBTask task = counter(1);
+        EXPECT_TRUE((bool)task);
+        EXPECT_EQ(pool.usedCount(), 1);
+    }
+    EXPECT_EQ(pool.usedCount(), 0);
+}
+
+// a transfer which can not be submitted continues immediately with an error
+TEST(USBCoroutineTests, Busy) {
+    USBConfiguration *config = setupDevice();
+    USBEndpoint &in = *config->usbEndpoint((uint8_t)0x81);
+    static uint8_t data[] = {1, 2, 3};
+    in.xfer(data, sizeof(data));
+    static bool failed = false;
+    auto writer = [](USBEndpoint &ep) -> USBTask {
+        USBTransferResult r = co_await ep.write(data);
+        failed = !r.ok();
+    };
+    EXPECT_TRUE(USBExecutor::instance().spawn(writer(in)));
+    USBExecutor::instance().run();
+    EXPECT_TRUE(failed);
+    EXPECT_EQ(USBExecutor::instance().activeCount(), 0);
+    USBStubDCD::instance().complete(0x81, 3);
+    tud_task();
+    USBStubDCD::instance().setTransferCallback(nullptr);
+    USBDevice::instance().clear();
+}
+
+// a buffer which exceeds the 16 bit transfer length is not truncated but fails without submission
+TEST(USBCoroutineTests, TooLong) {
+    USBConfiguration *config = setupDevice();
+    USBEndpoint &in = *config->usbEndpoint((uint8_t)0x81);
+    static uint8_t data[0x10000];
+    static xfer_result_t result = XFER_RESULT_SUCCESS;
+    auto writer = [](USBEndpoint &ep) -> USBTask {
+        USBTransferResult r = co_await ep.write(data);
+        result = r.result;
+    };
+    EXPECT_TRUE(USBExecutor::instance().spawn(writer(in)));
+    USBExecutor::instance().run();
+    EXPECT_EQ(result, XFER_RESULT_FAILED);
+    EXPECT_EQ(USBExecutor::instance().activeCount(), 0);
+    EXPECT_EQ(USBStubDCD::instance().count(StubTransfer), 0);
+    USBStubDCD::instance().setTransferCallback(nullptr);
+    USBDevice::instance().clear();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,131 @@
+/**
+ * Test cases for USBDescriptorDiff.h
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBDescriptorDiff.h"
+#include "gtest/gtest.h"
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN + 9 + 9 + 7)
+
+// MIDI and a vendor interface with an alternate setting
+#define CONFIG_DESCRIPTOR(power, packet_size) \
+    TUD_CONFIG_DESCRIPTOR(1, 3, 0, CONFIG_TOTAL_LEN, 0, power), \
+    TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64), \
+    9, TUSB_DESC_INTERFACE, 2, 0, 0, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0, \
+    9, TUSB_DESC_INTERFACE, 2, 1, 1, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0, \
+    7, TUSB_DESC_ENDPOINT, 0x82, TUSB_XFER_ISOCHRONOUS, U16_TO_U8S_LE(packet_size), 1
+
+static const uint8_t desc_v1[] = {CONFIG_DESCRIPTOR(100, 256)};
+static const uint8_t desc_power[] = {CONFIG_DESCRIPTOR(500, 256)};
+static const uint8_t desc_packet[] = {CONFIG_DESCRIPTOR(100, 512)};
+
+TEST(USBDescriptorDiffTests, Identical) {
+    USBDescriptorDiff diff;
+    EXPECT_FALSE(diff.compare(desc_v1, sizeof(desc_v1), desc_v1, sizeof(desc_v1)));
+    EXPECT_TRUE(diff.sameLayout());
+    EXPECT_EQ(diff.patchCount(), 0);
+    EXPECT_FALSE(diff.needsReEnumeration());
+}
+
+TEST(USBDescriptorDiffTests, BytePatches) {
+    USBDescriptorDiff diff;
+    EXPECT_TRUE(diff.compare(desc_v1, sizeof(desc_v1), desc_power, sizeof(desc_power)));
+    EXPECT_TRUE(diff.sameLayout());
+    ASSERT_EQ(diff.patchCount(), 1);
+    EXPECT_EQ(diff.patch(0).offset, 8); // bMaxPower
+    EXPECT_EQ(diff.patch(0).len, 1);
+    EXPECT_EQ(diff.patch(0).data[0], 250);
+    ASSERT_EQ(diff.changeCount(), 1);
+    EXPECT_EQ(diff.change(0).kind, DiffModified);
+    EXPECT_EQ(diff.change(0).desc_type, TUSB_DESC_CONFIGURATION);
+    EXPECT_TRUE(diff.needsReEnumeration());
+    EXPECT_FALSE(diff.needsReEnumeration(false));
+
+    uint8_t target[sizeof(desc_v1)];
+    memcpy(target, desc_v1, sizeof(target));
+    EXPECT_TRUE(diff.apply(target, sizeof(target)));
+    EXPECT_EQ(memcmp(target, desc_power, sizeof(target)), 0);
+}
+
+// the patches are applied to the descriptor buffer: the parsed objects stay valid
+TEST(USBDescriptorDiffTests, UpdateInPlace) {
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(CONFIG_TOTAL_LEN);
+    USBConfiguration *config = device.setConfigurationDescriptor(desc_v1, sizeof(desc_v1), true);
+    USBEndpoint *ep = config->usbEndpoint((uint8_t)0x82);
+    ASSERT_TRUE(ep!=nullptr);
+    EXPECT_EQ(ep->descriptor()->wMaxPacketSize.size, 256);
+
+    USBDescriptorDiff diff;
+    EXPECT_TRUE(diff.update(desc_packet, sizeof(desc_packet)));
+    EXPECT_EQ(diff.patchBytes(), 1);
+    EXPECT_EQ(diff.change(0).desc_type, TUSB_DESC_ENDPOINT);
+    EXPECT_EQ(config->usbEndpoint((uint8_t)0x82), ep);
+    EXPECT_EQ(ep->descriptor()->wMaxPacketSize.size, 512);
+    EXPECT_EQ(memcmp(device.configurationDescriptor(0), desc_packet, sizeof(desc_packet)), 0);
+    device.clear();
+}
+
+TEST(USBDescriptorDiffTests, Structural) {
+    // the alternate setting gets a second endpoint
+    const uint8_t desc_v2[] = {
+        TUD_CONFIG_DESCRIPTOR(1, 3, 0, CONFIG_TOTAL_LEN + 7, 0, 100),
+        TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64),
+        9, TUSB_DESC_INTERFACE, 2, 0, 0, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0,
+        9, TUSB_DESC_INTERFACE, 2, 1, 2, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0,
+        7, TUSB_DESC_ENDPOINT, 0x02, TUSB_XFER_ISOCHRONOUS, U16_TO_U8S_LE(256), 1,
+        7, TUSB_DESC_ENDPOINT, 0x82, TUSB_XFER_ISOCHRONOUS, U16_TO_U8S_LE(256), 1
+    };
+    USBDescriptorDiff diff;
+    EXPECT_TRUE(diff.compare(desc_v1, sizeof(desc_v1), desc_v2, sizeof(desc_v2)));
+    EXPECT_FALSE(diff.sameLayout());
+    EXPECT_EQ(diff.patchCount(), 0);
+    EXPECT_TRUE(diff.needsReEnumeration());
+
+    // wTotalLength and bNumEndpoints have changed and the endpoint 0x02 was added
+    int modified = 0, added = 0;
+    for (int j=0;j<diff.changeCount();j++){
+        USBStructuralChange &c = diff.change(j);
+        if (c.kind==DiffModified) modified++;
+        if (c.kind==DiffAdded){
+            added++;
+            EXPECT_EQ(c.desc_type, TUSB_DESC_ENDPOINT);
+            EXPECT_EQ(desc_v2[c.new_offset+2], 0x02);
+        }
+    }
+    EXPECT_EQ(modified, 2);
+    EXPECT_EQ(added, 1);
+
+    uint8_t target[sizeof(desc_v1)];
+    memcpy(target, desc_v1, sizeof(target));
+    EXPECT_FALSE(diff.apply(target, sizeof(target)));
+
+    // the endpoint is removed again
+    EXPECT_TRUE(diff.compare(desc_v2, sizeof(desc_v2), desc_v1, sizeof(desc_v1)));
+    bool removed = false;
+    for (int j=0;j<diff.changeCount();j++){
+        removed |= diff.change(j).kind==DiffRemoved;
+    }
+    EXPECT_TRUE(removed);
+}
+
+// changed strings do not require a re-enumeration
+TEST(USBDescriptorDiffTests, Strings) {
+    const char* old_strings[] = {"TinyUSB", "Device", "123"};
+    const char* new_strings[] = {"TinyUSB", "Device V2", "123"};
+    USBDescriptorDiff diff;
+    EXPECT_FALSE(diff.compareStrings(old_strings, 3, old_strings, 3));
+    EXPECT_TRUE(diff.compareStrings(old_strings, 3, new_strings, 3));
+    ASSERT_EQ(diff.changeCount(), 1);
+    EXPECT_EQ(diff.change(0).kind, DiffString);
+    EXPECT_EQ(diff.change(0).old_offset, 2);
+    EXPECT_FALSE(diff.needsReEnumeration());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,96 @@
+/**
+ * Generator for random but valid configuration descriptors which is used by the scaling tests and benchmarks:
+ * interfaces with alternate settings, interface associations, class specific descriptors and endpoints.
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#pragma once
+#include "USBDescriptor.h"
+#include <vector>
+
+struct USBGeneratedDescriptor {
+    std::vector<uint8_t> data;
+    int interface_count = 0;  // interface descriptors including the alternate settings
+    int endpoint_count = 0;   // endpoint descriptors
+    uint8_t last_ep_addr = 0; // address of the last endpoint descriptor
+};
+
+class USBDescriptorGenerator {
+    public:
+        USBDescriptorGenerator(uint32_t seed=1){
+            state = seed==0 ? 1 : seed;
+        }
+
+        // generates a configuration descriptor with the indicated number of interfaces (max 255)
+        USBGeneratedDescriptor generate(int interfaces){
+            USBGeneratedDescriptor result;
+            std::vector<uint8_t> &out = result.data;
+            uint8_t header[] = {TUD_CONFIG_DESCRIPTOR(1, 0, 0, 0, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100)};
+            out.insert(out.end(), header, header+sizeof(header));
+            int next_out = 1;
+            int next_in = 1;
+            for (int itf=0; itf<interfaces; itf++){
+                uint8_t cls = random(4)==0 ? 0xff : 1 + random(14);
+                if (random(5)==0){
+                    uint8_t iad[] = {8, TUSB_DESC_INTERFACE_ASSOCIATION, (uint8_t)itf, 1, cls, 0, 0, 0};
+                    out.insert(out.end(), iad, iad+sizeof(iad));
+                }
+                // endpoints of this interface: the alternate settings use a part of them
+                uint8_t eps[3];
+                int ep_count = 0;
+                int wanted = random(4);
+                for (int j=0;j<wanted;j++){
+                    bool in = random(2)==0;
+                    int &next = in ? next_in : next_out;
+                    if (next<16){
+                        eps[ep_count++] = (in ? 0x80 : 0x00) | next++;
+                    }
+                }
+                int alt_count = random(4)==0 ? 2 + random(2) : 1;
+                for (int alt=0; alt<alt_count; alt++){
+                    int alt_eps = alt==0 ? ep_count : random(ep_count+1);
+                    uint8_t desc[] = {9, TUSB_DESC_INTERFACE, (uint8_t)itf, (uint8_t)alt, (uint8_t)alt_eps, cls, (uint8_t)random(3), (uint8_t)random(3), 0};
+                    out.insert(out.end(), desc, desc+sizeof(desc));
+                    result.interface_count++;
+                    if (random(2)==0){
+                        classSpecific(out, TUSB_DESC_CS_INTERFACE, 3 + random(8));
+                    }
+                    for (int j=0;j<alt_eps;j++){
+                        uint8_t xfer = 1 + random(3);
+                        uint16_t size = 8 << random(7);
+                        uint8_t ep[] = {7, TUSB_DESC_ENDPOINT, eps[j], xfer, U16_TO_U8S_LE(size), (uint8_t)(xfer==TUSB_XFER_BULK ? 0 : 1 + random(16))};
+                        out.insert(out.end(), ep, ep+sizeof(ep));
+                        result.endpoint_count++;
+                        result.last_ep_addr = eps[j];
+                        if (xfer==TUSB_XFER_ISOCHRONOUS){
+                            classSpecific(out, TUSB_DESC_CS_ENDPOINT, 7);
+                        }
+                    }
+                }
+            }
+            out[2] = out.size() & 0xff;
+            out[3] = out.size() >> 8;
+            out[4] = interfaces;
+            return result;
+        }
+
+    protected:
+        uint32_t state;
+
+        // xorshift: we want the same descriptors on all platforms
+        uint32_t random(uint32_t range){
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state % range;
+        }
+
+        void classSpecific(std::vector<uint8_t> &out, uint8_t type, int len){
+            out.push_back(len);
+            out.push_back(type);
+            for (int j=2;j<len;j++){
+                out.push_back(random(256));
+            }
+        }
+};
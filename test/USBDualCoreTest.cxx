@@ -0,0 +1,210 @@
+/**
+ * Test cases for USBDualCore.h: the application and the USB core are simulated with two threads
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBDualCore.h"
+#include "USBTestDevice.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+static void setupDevice() {
+    setupTestDevice(usb_test_vendor, sizeof(usb_test_vendor), USBRunLoop::transferCompletedCb);
+    USBStubDCD::instance().setEventHook(USBRunLoop::eventHook);
+    USBRunLoop::instance().unbindAll();
+    USBDualCore::instance().clear();
+}
+
+// USB core: the simulated host completes each submitted transfer - OUT transfers are filled with a counter
+static void usbCore(std::atomic<bool> *active){
+    USBDualCore &dual = USBDualCore::instance();
+    USBStubDCD &dcd = USBStubDCD::instance();
+    int handled = 0;
+    uint8_t value = 0;
+    while(active->load()){
+        dual.usbStep(5);
+        // the stub only keeps the last USB_STUB_MAX_EVENTS events
+        for (; handled<dcd.totalCount(); handled++){
+            USBStubEvent &evt = dcd.event(dcd.eventCount() - (dcd.totalCount() - handled));
+            if (evt.type==StubTransfer){
+                uint16_t len = evt.len;
+                if (tu_edpt_dir(evt.ep_addr)==TUSB_DIR_OUT){
+                    memset(evt.buffer, value++, len);
+                    len /= 2;
+                }
+                dcd.complete(evt.ep_addr, len);
+            }
+        }
+    }
+}
+
+TEST(USBDualCoreTests, Ring) {
+    static USBSpscRing<uint32_t, 8> ring;
+    const uint32_t count = 100000;
+    std::thread producer([](){
+        for (uint32_t j=0;j<count;j++){
+            while(!ring.push(j)) std::this_thread::yield();
+        }
+    });
+    uint32_t value, expected = 0;
+    while(expected<count){
+        if (ring.pop(value)){
+            ASSERT_EQ(value, expected);
+            expected++;
+        } else {
+            EXPECT_LE(ring.size(), ring.capacity());
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    EXPECT_TRUE(ring.empty());
+}
+
+TEST(USBDualCoreTests, ZeroCopy) {
+    setupDevice();
+    USBDualCore &dual = USBDualCore::instance();
+    std::atomic<bool> active{true};
+    std::thread usb(usbCore, &active);
+
+    static uint8_t rx[4][64];
+    static uint8_t tx[4][64];
+    for (int j=0;j<4;j++){
+        ASSERT_TRUE(dual.submit(0x01, rx[j], sizeof(rx[j]), (void*)(intptr_t)j));
+        memset(tx[j], 'a'+j, sizeof(tx[j]));
+        ASSERT_TRUE(dual.submit(0x81, tx[j], 10+j));
+    }
+
+    int rx_idx = 0, tx_idx = 0;
+    USBBufferDescriptor desc;
+    while(rx_idx + tx_idx < 8){
+        ASSERT_TRUE(dual.receive(desc, 1000));
+        EXPECT_EQ(desc.result, XFER_RESULT_SUCCESS);
+        if (desc.ep_addr==0x01){
+            // the same buffers are returned in the submitted order
+            EXPECT_EQ(desc.data, rx[rx_idx]);
+            EXPECT_EQ((intptr_t)desc.ref, rx_idx);
+            EXPECT_EQ(desc.len, 32u);
+            rx_idx++;
+        } else {
+            EXPECT_EQ(desc.data, tx[tx_idx]);
+            EXPECT_EQ(desc.len, (uint32_t)(10+tx_idx));
+            tx_idx++;
+        }
+    }
+    // the OUT data was written directly into the buffers of the application
+    for (int j=1;j<4;j++){
+        EXPECT_NE(rx[j][0], rx[j-1][0]);
+    }
+    EXPECT_FALSE(dual.receive(desc));
+
+    active = false;
+    dual.stop();
+    usb.join();
+    EXPECT_EQ(dual.submittedCount(), 8u);
+    EXPECT_EQ(dual.completedCount(), 8u);
+    EXPECT_EQ(dual.pendingCount(), 0);
+}
+
+TEST(USBDualCoreTests, Stream) {
+    setupDevice();
+    USBDualCore &dual = USBDualCore::instance();
+
+    // more buffers than slots and ring entries: the returned buffers are submitted again
+    static uint8_t buffers[USB_DUALCORE_RING_SIZE][64];
+    const int count = 1000;
+    int submitted = 0, received = 0;
+    for (; submitted<USB_DUALCORE_RING_SIZE; submitted++){
+        ASSERT_TRUE(dual.submit(0x81, buffers[submitted], 64, buffers[submitted]));
+    }
+    EXPECT_FALSE(dual.submit(0x81, buffers[0], 64));
+    std::atomic<bool> active{true};
+    std::thread usb(usbCore, &active);
+    USBBufferDescriptor desc;
+    while(received<count){
+        ASSERT_TRUE(dual.receive(desc, 1000));
+        EXPECT_EQ(desc.len, 64u);
+        received++;
+        if (submitted<count){
+            ASSERT_TRUE(dual.submit(0x81, desc.data, 64));
+            submitted++;
+        }
+    }
+
+    active = false;
+    dual.stop();
+    usb.join();
+    EXPECT_EQ(dual.completedCount(), (uint32_t)count);
+    EXPECT_EQ(dual.ringFullCount(), 1u);
+}
+
+TEST(USBDualCoreTests, UnknownEndpoint) {
+    setupDevice();
+    USBDualCore &dual = USBDualCore::instance();
+    uint8_t buffer[8];
+    ASSERT_TRUE(dual.submit(0x05, buffer, sizeof(buffer)));
+    dual.startTransfers();
+    USBBufferDescriptor desc;
+    ASSERT_TRUE(dual.receive(desc));
+    EXPECT_EQ(desc.result, XFER_RESULT_FAILED);
+    EXPECT_EQ(desc.len, 0u);
+}
+
+// the host does not accept any transfers, e.g. because the device is not mounted
+class RejectingBackend : public USBStubBackend {
+    public:
+        bool xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes) override {
+            return false;
+        }
+};
+
+TEST(USBDualCoreTests, FailedTransfer) {
+    setupDevice();
+    RejectingBackend backend;
+    USBStubDCD::instance().setBackend(&backend);
+    USBDualCore &dual = USBDualCore::instance();
+    uint8_t buffer[8];
+    ASSERT_TRUE(dual.submit(0x81, buffer, sizeof(buffer)));
+    dual.startTransfers();
+    USBStubDCD::instance().setBackend(nullptr);
+    USBBufferDescriptor desc;
+    ASSERT_TRUE(dual.receive(desc));
+    EXPECT_EQ(desc.result, XFER_RESULT_FAILED);
+    EXPECT_EQ(desc.len, 0u);
+    EXPECT_EQ(dual.pendingCount(), 0);
+}
+
+TEST(USBDualCoreTests, BusReset) {
+    setupDevice();
+    USBDualCore &dual = USBDualCore::instance();
+    uint8_t buffer[2][8];
+    ASSERT_TRUE(dual.submit(0x81, buffer[0], sizeof(buffer[0])));
+    ASSERT_TRUE(dual.submit(0x81, buffer[1], sizeof(buffer[1])));
+    dual.startTransfers();
+    USBBufferDescriptor desc;
+    EXPECT_FALSE(dual.receive(desc));
+    EXPECT_EQ(dual.pendingCount(), 2);
+
+    // the active transfer is returned and the next one is started
+    dual.busReset();
+    USBStubDCD::instance().clear();
+    dual.startTransfers();
+    ASSERT_TRUE(dual.receive(desc));
+    EXPECT_EQ(desc.data, buffer[0]);
+    EXPECT_EQ(desc.result, XFER_RESULT_FAILED);
+    EXPECT_EQ(dual.pendingCount(), 1);
+    dual.startTransfers();
+    EXPECT_TRUE(usbd_edpt_busy(0, 0x81));
+    USBStubDCD::instance().complete(0x81, 8);
+    tud_task();
+    dual.startTransfers();
+    ASSERT_TRUE(dual.receive(desc));
+    EXPECT_EQ(desc.data, buffer[1]);
+    EXPECT_EQ(desc.result, XFER_RESULT_SUCCESS);
+    EXPECT_EQ(desc.len, 8u);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,128 @@
+/**
+ * Test cases for USBEnumerationPlan.h
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBEnumerationPlan.h"
+#include "gtest/gtest.h"
+#include <string>
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN)
+
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, 2, 0, CONFIG_TOTAL_LEN, 0, 100),
+    TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64)
+};
+
+static void setupDevice(const char* serial) {
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(CONFIG_TOTAL_LEN);
+    device.idVendor(0xCafe).idProduct(0x0001).manufacturer("TinyUSB").product("TinyUSB Device").serialNumber(serial);
+    device.setConfigurationDescriptor(desc_configuration, sizeof(desc_configuration), false);
+}
+
+TEST(USBEnumerationPlanTests, LargestPacketSize0) {
+    EXPECT_EQ(USBEnumerationPlanner::largestPacketSize0(), CFG_TUD_ENDPOINT0_SIZE);
+    EXPECT_EQ(USBEnumerationPlanner::largestPacketSize0(8), 8);
+    EXPECT_EQ(USBEnumerationPlanner::largestPacketSize0(32), 32);
+    EXPECT_EQ(USBEnumerationPlanner::largestPacketSize0(40), 32);
+    EXPECT_EQ(USBEnumerationPlanner::largestPacketSize0(4), 8);
+
+    setupDevice("123456");
+    USBDevice &device = USBDevice::instance();
+    EXPECT_EQ(USBEnumerationPlanner::selectPacketSize0(device, 16), 16);
+    EXPECT_EQ(device.descriptor()->bMaxPacketSize0, 16);
+    USBEnumerationPlanner::selectPacketSize0(device);
+    EXPECT_EQ(device.descriptor()->bMaxPacketSize0, CFG_TUD_ENDPOINT0_SIZE);
+    device.clear();
+}
+
+TEST(USBEnumerationPlanTests, Plan64) {
+    setupDevice("123456");
+    USBEnumerationPlanner planner;
+    // device (64), SET_ADDRESS, device, configuration (9), configuration, languages, 3 strings, SET_CONFIGURATION
+    EXPECT_EQ(planner.plan(USBDevice::instance(), 64), 10);
+    EXPECT_EQ(planner.controlTransfers(), 10);
+    EXPECT_EQ(planner.packetSize0(), 64);
+    EXPECT_EQ(planner.step(1).request, TUSB_REQ_SET_ADDRESS);
+    EXPECT_EQ(planner.step(4).desc_type, TUSB_DESC_CONFIGURATION);
+    EXPECT_EQ(planner.step(4).len, CONFIG_TOTAL_LEN);
+    EXPECT_EQ(planner.step(4).packets, USBEnumerationPlanner::packets(CONFIG_TOTAL_LEN, 64));
+    EXPECT_EQ(planner.step(9).request, TUSB_REQ_SET_CONFIGURATION);
+    // every other data stage fits into a single packet
+    EXPECT_EQ(planner.dataPackets(), 7 + USBEnumerationPlanner::packets(CONFIG_TOTAL_LEN, 64));
+    EXPECT_EQ(planner.totalPackets(), planner.dataPackets() + 20);
+    USBDevice::instance().clear();
+}
+
+TEST(USBEnumerationPlanTests, Plan8) {
+    // "12345678" results in an 18 byte string descriptor
+    setupDevice("12345678");
+    USBEnumerationPlanner planner;
+    planner.plan(USBDevice::instance(), 8);
+    USBEnumerationStep &manufacturer = planner.step(6);
+    USBEnumerationStep &product = planner.step(7);
+    USBEnumerationStep &serial = planner.step(8);
+    EXPECT_EQ(manufacturer.desc_type, TUSB_DESC_STRING);
+    EXPECT_EQ(manufacturer.len, 16);
+    EXPECT_TRUE(manufacturer.zlp);
+    EXPECT_EQ(manufacturer.packets, 3);
+    EXPECT_EQ(product.len, 30);
+    EXPECT_EQ(product.packets, 4);
+    EXPECT_FALSE(product.near_boundary);
+    EXPECT_EQ(serial.len, 18);
+    EXPECT_EQ(serial.packets, 3);
+    EXPECT_TRUE(serial.near_boundary);
+    // the device descriptor has a fixed size and is not reported
+    EXPECT_FALSE(planner.step(2).near_boundary);
+    EXPECT_EQ(planner.warningCount(), 1 + USBEnumerationPlanner::nearBoundary(CONFIG_TOTAL_LEN, 8));
+
+    // the bigger packet size saves packets
+    USBEnumerationPlanner planner64;
+    planner64.plan(USBDevice::instance(), 64);
+    EXPECT_EQ(planner64.controlTransfers(), planner.controlTransfers());
+    EXPECT_LT(planner64.dataPackets(), planner.dataPackets());
+
+    std::string output;
+    planner.report([&output](const char* line){ output += line; output += "\n"; });
+    EXPECT_NE(output.find("bMaxPacketSize0: 8"), std::string::npos);
+    EXPECT_NE(output.find("WARNING"), std::string::npos);
+    EXPECT_NE(output.find("control transfers: 10"), std::string::npos);
+    USBDevice::instance().clear();
+}
+
+// a configuration which needs more than 255 packets at EP0=8
+TEST(USBEnumerationPlanTests, LargeConfiguration) {
+    const int total_len = TUD_CONFIG_DESC_LEN + 9 + 12 * 250;
+    static uint8_t desc[total_len];
+    const uint8_t header[] = {
+        TUD_CONFIG_DESCRIPTOR(1, 1, 0, total_len, 0, 100),
+        9, TUSB_DESC_INTERFACE, 0, 0, 0, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0
+    };
+    memcpy(desc, header, sizeof(header));
+    for (int pos=sizeof(header); pos<total_len; pos+=250){
+        desc[pos] = 250;
+        desc[pos+1] = TUSB_DESC_CS_INTERFACE;
+    }
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(total_len);
+    device.idVendor(0xCafe).idProduct(0x0001);
+    device.setConfigurationDescriptor(desc, sizeof(desc), false);
+
+    USBEnumerationPlanner planner;
+    planner.plan(device, 8);
+    USBEnumerationStep &config = planner.step(4);
+    EXPECT_EQ(config.desc_type, TUSB_DESC_CONFIGURATION);
+    EXPECT_EQ(config.len, total_len);
+    EXPECT_EQ(config.packets, USBEnumerationPlanner::packets(total_len, 8));
+    EXPECT_GT(config.packets, 255);
+    device.clear();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,94 @@
+/**
+ * Test cases for USBFunctionFS.h - We check the conversion of the descriptors into the FunctionFS format.
+ * 
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ * 
+ */
+#include "USBDescriptor.h"
+#include "USBFunctionFS.h"
+#include "USBTestDevice.h"
+#include "gtest/gtest.h"
+
+static uint32_t le32(Vector<uint8_t> &data, int pos){
+    uint8_t *ptr = data.data()+pos;
+    return ptr[0] | ptr[1]<<8 | ptr[2]<<16 | ptr[3]<<24;
+}
+
+static void setupMidi() {
+    setupTestDevice(usb_test_midi, sizeof(usb_test_midi));
+    USBDevice::instance().idVendor(0xCafe).idProduct(0x0001).bcdDevice(0x0100).manufacturer("TinyUSB").product("TinyUSB Device").serialNumber("123456");
+}
+
+TEST(USBFunctionFSTests, Descriptors) {
+    setupMidi();
+    Vector<uint8_t> blob;
+    int len = USBFunctionFS::descriptors(USBDevice::instance(), blob);
+
+    // the configuration descriptor is not part of the function
+    int desc_len = USB_TEST_MIDI_LEN - TUD_CONFIG_DESC_LEN;
+    EXPECT_EQ(len, 20 + 2 * desc_len);
+    EXPECT_EQ(le32(blob, 0), FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+    EXPECT_EQ(le32(blob, 4), len);
+    EXPECT_EQ(le32(blob, 8), FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC);
+    // 4 interface, 2 header, 4 jacks, 2 x (endpoint + cs endpoint)
+    EXPECT_EQ(le32(blob, 12), 12);
+    EXPECT_EQ(le32(blob, 16), 12);
+
+    // first descriptor is the audio control interface
+    EXPECT_EQ(blob[20], 9);
+    EXPECT_EQ(blob[21], TUSB_DESC_INTERFACE);
+
+    // full speed uses 64 bytes and high speed 512 bytes for the bulk endpoints
+    int fs_ep = -1, hs_ep = -1;
+    for (int pos=20; pos<len; pos+=blob[pos]){
+        if (blob[pos+1]==TUSB_DESC_ENDPOINT){
+            if (pos < 20 + desc_len && fs_ep<0) fs_ep = pos;
+            if (pos >= 20 + desc_len && hs_ep<0) hs_ep = pos;
+        }
+    }
+    ASSERT_GT(fs_ep, 0);
+    ASSERT_GT(hs_ep, 0);
+    EXPECT_EQ(blob[fs_ep+4] | blob[fs_ep+5]<<8, 64);
+    EXPECT_EQ(blob[hs_ep+4] | blob[hs_ep+5]<<8, 512);
+}
+
+// each configuration is converted on its own
+TEST(USBFunctionFSTests, MultipleConfigurations) {
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(256);
+    device.createConfiguration()->createInterface()->createEndpoint(true, Bulk);
+    USBInterface *itf = device.createConfiguration()->createInterface();
+    itf->createEndpoint(true, Bulk);
+    itf->createEndpoint(false, Bulk);
+
+    Vector<uint8_t> blob;
+    int len = USBFunctionFS::descriptors(device, blob, 0);
+    EXPECT_EQ(len, 20 + 2 * (9 + 7));
+    EXPECT_EQ(le32(blob, 12), 2);
+    len = USBFunctionFS::descriptors(device, blob, 1);
+    EXPECT_EQ(len, 20 + 2 * (9 + 7 + 7));
+    EXPECT_EQ(le32(blob, 12), 3);
+    EXPECT_EQ(USBFunctionFS::descriptors(device, blob, 2), 0);
+    device.clear();
+}
+
+TEST(USBFunctionFSTests, Strings) {
+    setupMidi();
+    Vector<uint8_t> blob;
+    int len = USBFunctionFS::strings(USBStrings::instance(), blob);
+
+    const char expected[] = "TinyUSB\0TinyUSB Device\0" "123456";
+    EXPECT_EQ(len, 16 + 2 + sizeof(expected));
+    EXPECT_EQ(le32(blob, 0), FUNCTIONFS_STRINGS_MAGIC);
+    EXPECT_EQ(le32(blob, 4), len);
+    EXPECT_EQ(le32(blob, 8), 3);
+    EXPECT_EQ(le32(blob, 12), 1);
+    EXPECT_EQ(blob[16] | blob[17]<<8, DEFAULT_LANGUAGE);
+    EXPECT_TRUE(memcmp(blob.data()+18, expected, sizeof(expected))==0);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,149 @@
+/**
+ * Test cases for USBHostCache.h and USBHash.h
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBHostCache.h"
+#include "gtest/gtest.h"
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN)
+
+static const uint8_t desc_midi[] = {
+    TUD_CONFIG_DESCRIPTOR(1, 2, 0, CONFIG_TOTAL_LEN, 0, 100),
+    TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64)
+};
+
+static const uint8_t desc_midi_v2[] = {
+    TUD_CONFIG_DESCRIPTOR(1, 2, 0, CONFIG_TOTAL_LEN, 0, 100),
+    TUD_MIDI_DESCRIPTOR(0, 0, 0x02, 0x82, 64)
+};
+
+// check value of the CRC32 specification
+TEST(USBHostCacheTests, Crc32) {
+    EXPECT_EQ(USBHash::crc32("123456789", 9), 0xCBF43926u);
+    EXPECT_EQ(USBHash::crc32("", 0), 0u);
+    // processing in blocks gives the same result
+    uint32_t crc = USBHash::crc32("1234", 4);
+    EXPECT_EQ(USBHash::crc32("56789", 5, crc), 0xCBF43926u);
+}
+
+TEST(USBHostCacheTests, HitAndMiss) {
+    USBDescriptorCache cache;
+    EXPECT_TRUE(cache.find(0xCafe, 0x0001, 0x0100, desc_midi, sizeof(desc_midi))==nullptr);
+    USBDescriptorCacheEntry *entry = cache.insert(0xCafe, 0x0001, 0x0100, desc_midi, sizeof(desc_midi));
+    ASSERT_TRUE(entry!=nullptr);
+    entry->drivers = 0x04;
+    EXPECT_EQ(entry->view().usbInterfaceCount(), 2);
+    EXPECT_EQ(cache.bytes(), entry->size());
+
+    // the cached view does not depend on the data of the caller
+    uint8_t data[sizeof(desc_midi)];
+    memcpy(data, desc_midi, sizeof(data));
+    USBDescriptorCacheEntry *found = cache.find(0xCafe, 0x0001, 0x0100, data, sizeof(data));
+    memset(data, 0, sizeof(data));
+    ASSERT_EQ(found, entry);
+    EXPECT_EQ(found->drivers, 0x04u);
+    EXPECT_EQ(found->view().findInterface(TUSB_CLASS_AUDIO, AUDIO_SUBCLASS_MIDI_STREAMING)->bInterfaceNumber(), 1);
+
+    // a different bcdDevice or a changed descriptor is a different device
+    EXPECT_TRUE(cache.find(0xCafe, 0x0001, 0x0101, desc_midi, sizeof(desc_midi))==nullptr);
+    EXPECT_TRUE(cache.find(0xCafe, 0x0001, 0x0100, desc_midi_v2, sizeof(desc_midi_v2))==nullptr);
+
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 3u);
+    cache.resetCounters();
+    EXPECT_EQ(cache.hits(), 0u);
+}
+
+TEST(USBHostCacheTests, Budget) {
+    USBDescriptorCache cache(0);
+    EXPECT_TRUE(cache.insert(0xCafe, 1, 0x0100, desc_midi, sizeof(desc_midi))==nullptr);
+
+    // room for 2 entries
+    size_t entry_size = sizeof(USBDescriptorCacheEntry) + sizeof(desc_midi);
+    USBDescriptorCache lru(2 * entry_size + 10);
+    ASSERT_TRUE(lru.insert(0xCafe, 1, 0x0100, desc_midi, sizeof(desc_midi))!=nullptr);
+    ASSERT_TRUE(lru.insert(0xCafe, 2, 0x0100, desc_midi, sizeof(desc_midi))!=nullptr);
+    // device 1 is used again, so device 2 is the least recently used
+    EXPECT_TRUE(lru.find(0xCafe, 1, 0x0100, desc_midi, sizeof(desc_midi))!=nullptr);
+    ASSERT_TRUE(lru.insert(0xCafe, 3, 0x0100, desc_midi, sizeof(desc_midi))!=nullptr);
+    EXPECT_EQ(lru.size(), 2);
+    EXPECT_EQ(lru.evictions(), 1u);
+    EXPECT_LE(lru.bytes(), lru.budget());
+    EXPECT_TRUE(lru.find(0xCafe, 2, 0x0100, desc_midi, sizeof(desc_midi))==nullptr);
+    EXPECT_TRUE(lru.find(0xCafe, 1, 0x0100, desc_midi, sizeof(desc_midi))!=nullptr);
+    EXPECT_TRUE(lru.find(0xCafe, 3, 0x0100, desc_midi, sizeof(desc_midi))!=nullptr);
+
+    // inserting the same device again replaces the entry
+    ASSERT_TRUE(lru.insert(0xCafe, 3, 0x0100, desc_midi, sizeof(desc_midi))!=nullptr);
+    EXPECT_EQ(lru.size(), 2);
+
+    lru.clear();
+    EXPECT_EQ(lru.size(), 0);
+    EXPECT_EQ(lru.bytes(), 0u);
+}
+
+// changes the last 4 bytes so that the CRC32 of the data is the indicated value
+static void forgeCrc32(uint8_t *data, int len, uint32_t crc){
+    uint32_t table[256];
+    for (uint32_t j=0;j<256;j++){
+        uint32_t value = j;
+        for (int bit=0;bit<8;bit++){
+            value = (value & 1) ? (value >> 1) ^ 0xedb88320 : value >> 1;
+        }
+        table[j] = value;
+    }
+    // walk back from the wanted register: the top byte of each table entry is unique
+    uint32_t reg = ~crc;
+    for (int step=0;step<4;step++){
+        uint32_t idx = 0;
+        while((table[idx] >> 24) != (reg >> 24)){
+            idx++;
+        }
+        reg = ((reg ^ table[idx]) << 8) | idx;
+    }
+    reg ^= ~USBHash::crc32(data, len-4);
+    for (int j=0;j<4;j++){
+        data[len-4+j] = reg >> (8*j);
+    }
+}
+
+TEST(USBHostCacheTests, Collision) {
+    // a vendor specific descriptor at the end provides the bytes to force the same CRC32
+    uint8_t original[sizeof(desc_midi)+6];
+    memcpy(original, desc_midi, sizeof(desc_midi));
+    const uint8_t vendor[] = {6, 0x41, 1, 2, 3, 4};
+    memcpy(original+sizeof(desc_midi), vendor, sizeof(vendor));
+    original[2] = sizeof(original);
+    uint8_t forged[sizeof(original)];
+    memcpy(forged, original, sizeof(forged));
+    forged[6] = 1; // iConfiguration
+    forgeCrc32(forged, sizeof(forged), USBHash::crc32(original, sizeof(original)));
+    ASSERT_EQ(USBHash::crc32(forged, sizeof(forged)), USBHash::crc32(original, sizeof(original)));
+    ASSERT_NE(memcmp(forged, original, sizeof(forged)), 0);
+
+    USBDescriptorCache cache;
+    USBDescriptorCacheEntry *entry = cache.insert(0xCafe, 1, 0x0100, original, sizeof(original));
+    ASSERT_TRUE(entry!=nullptr);
+    EXPECT_TRUE(cache.find(0xCafe, 1, 0x0100, forged, sizeof(forged))==nullptr);
+    // both descriptors are cached side by side
+    USBDescriptorCacheEntry *other = cache.insert(0xCafe, 1, 0x0100, forged, sizeof(forged));
+    ASSERT_TRUE(other!=nullptr);
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_EQ(cache.find(0xCafe, 1, 0x0100, original, sizeof(original)), entry);
+    EXPECT_EQ(cache.find(0xCafe, 1, 0x0100, forged, sizeof(forged)), other);
+}
+
+TEST(USBHostCacheTests, Invalid) {
+    USBDescriptorCache cache;
+    EXPECT_TRUE(cache.insert(0xCafe, 1, 0x0100, desc_midi, sizeof(desc_midi)-1)==nullptr);
+    EXPECT_TRUE(cache.insert(0xCafe, 1, 0x0100, nullptr, 0)==nullptr);
+    EXPECT_EQ(cache.size(), 0);
+    EXPECT_EQ(cache.bytes(), 0u);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,116 @@
+/**
+ * Test cases for USBHostView.h - the views are built over the descriptors of an attached device without any heap
+ * allocation.
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBHostView.h"
+#include "USBHeapAccounting.h"
+#include "gtest/gtest.h"
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MIDI_DESC_LEN + 9 + 9 + 7 + 7)
+
+// CDC (interfaces 0,1), MIDI (2,3) and a vendor interface (4) with an alternate setting
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, 5, 0, CONFIG_TOTAL_LEN, 0, 100),
+    TUD_CDC_DESCRIPTOR(0, 0, 0x81, 8, 0x02, 0x82, 64),
+    TUD_MIDI_DESCRIPTOR(2, 0, 0x03, 0x83, 64),
+    9, TUSB_DESC_INTERFACE, 4, 0, 0, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0,
+    9, TUSB_DESC_INTERFACE, 4, 1, 2, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0,
+    7, TUSB_DESC_ENDPOINT, 0x84, TUSB_XFER_ISOCHRONOUS, U16_TO_U8S_LE(512), 1,
+    7, TUSB_DESC_ENDPOINT, 0x04, TUSB_XFER_ISOCHRONOUS, U16_TO_U8S_LE(512), 1,
+};
+
+TEST(USBHostViewTests, Structure) {
+    size_t allocations = USBHeapAccounting::instance().allocations();
+    USBConfigurationView view;
+    ASSERT_TRUE(view.begin(desc_configuration, sizeof(desc_configuration)));
+    EXPECT_EQ(USBHeapAccounting::instance().allocations(), allocations);
+    EXPECT_TRUE(view);
+    EXPECT_EQ(view.descriptor()->bNumInterfaces, 5);
+    EXPECT_EQ(view.usbInterfaceCount(), 6);
+    EXPECT_EQ(view.usbEndpointCount(), 7);
+
+    // the interface length covers the class specific descriptors up to the next interface
+    const USBInterfaceView *cdc = view.usbInterface(0);
+    EXPECT_EQ(cdc->usbEndpointCount(), 1);
+    EXPECT_EQ(cdc->length(), 9 + 5 + 5 + 4 + 5 + 7);
+    EXPECT_EQ(cdc->association()->bFirstInterface, 0);
+    EXPECT_EQ(view.usbInterface(1)->association(), cdc->association());
+    EXPECT_TRUE(view.usbInterface(2)->association()==nullptr);
+    EXPECT_TRUE(cdc->findClassDescriptor(TUSB_DESC_CS_INTERFACE, CDC_FUNC_DESC_UNION)!=nullptr);
+    EXPECT_TRUE(cdc->findClassDescriptor(TUSB_DESC_CS_INTERFACE, 0x7f)==nullptr);
+    EXPECT_EQ(cdc->usbEndpoint(0)->address(), 0x81);
+    EXPECT_TRUE(cdc->usbEndpoint(1)==nullptr);
+
+    // alternate settings
+    EXPECT_EQ(view.usbInterface(4, 0)->usbEndpointCount(), 0);
+    EXPECT_EQ(view.usbInterface(4, 1)->usbEndpointCount(), 2);
+    EXPECT_TRUE(view.usbInterface(4, 2)==nullptr);
+}
+
+TEST(USBHostViewTests, Lookup) {
+    USBConfigurationView view;
+    ASSERT_TRUE(view.begin(desc_configuration, sizeof(desc_configuration)));
+
+    EXPECT_TRUE(view.hasClass(TUSB_CLASS_CDC));
+    EXPECT_TRUE(view.hasClass(TUSB_CLASS_AUDIO));
+    EXPECT_FALSE(view.hasClass(TUSB_CLASS_HID));
+    EXPECT_TRUE(view.findInterface(TUSB_CLASS_HID)==nullptr);
+
+    const USBInterfaceView *acm = view.findInterface(TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL);
+    ASSERT_TRUE(acm!=nullptr);
+    EXPECT_EQ(acm->bInterfaceNumber(), 0);
+    EXPECT_TRUE(view.findInterface(TUSB_CLASS_CDC, CDC_COMM_SUBCLASS_ABSTRACT_CONTROL_MODEL, 1)==nullptr);
+    EXPECT_EQ(acm->findEndpoint(TUSB_DIR_IN, TUSB_XFER_INTERRUPT)->address(), 0x81);
+    EXPECT_TRUE(acm->findEndpoint(TUSB_DIR_IN, TUSB_XFER_BULK)==nullptr);
+
+    const USBInterfaceView *midi = view.findInterface(TUSB_CLASS_AUDIO, AUDIO_SUBCLASS_MIDI_STREAMING);
+    ASSERT_TRUE(midi!=nullptr);
+    EXPECT_EQ(midi->bInterfaceNumber(), 3);
+    EXPECT_EQ(midi->findEndpoint(TUSB_DIR_OUT, TUSB_XFER_BULK)->address(), 0x03);
+
+    // iterate all audio interfaces
+    int count = 0;
+    for (const USBInterfaceView *itf = view.findInterface(TUSB_CLASS_AUDIO); itf!=nullptr; itf = view.findInterface(TUSB_CLASS_AUDIO, USB_VIEW_ANY, USB_VIEW_ANY, itf)){
+        count++;
+    }
+    EXPECT_EQ(count, 2);
+
+    // endpoints by address and type
+    EXPECT_EQ(view.usbEndpoint(0x82)->transferType(), TUSB_XFER_BULK);
+    EXPECT_EQ(view.usbEndpoint(0x84)->wMaxPacketSize(), 512);
+    EXPECT_TRUE(view.usbEndpoint(0x85)==nullptr);
+    EXPECT_EQ(view.findEndpoint(TUSB_DIR_OUT, TUSB_XFER_ISOCHRONOUS)->address(), 0x04);
+}
+
+TEST(USBHostViewTests, Invalid) {
+    USBConfigurationView view;
+    EXPECT_FALSE(view.begin(desc_configuration, sizeof(desc_configuration)-1));
+    EXPECT_FALSE(view);
+    EXPECT_FALSE(view.begin(nullptr, 0));
+
+    // without validation we accept an inconsistent bNumInterfaces
+    uint8_t data[sizeof(desc_configuration)];
+    memcpy(data, desc_configuration, sizeof(data));
+    data[4] = 4;
+    EXPECT_FALSE(view.begin(data, sizeof(data)));
+    EXPECT_TRUE(view.begin(data, sizeof(data), false));
+    EXPECT_EQ(view.usbInterfaceCount(), 6);
+
+    // a truncated interface is skipped together with its endpoints
+    const uint8_t truncated[] = {
+        9, TUSB_DESC_CONFIGURATION, 21, 0, 1, 1, 0, 0x80, 50,
+        5, TUSB_DESC_INTERFACE, 0, 0, 1,
+        7, TUSB_DESC_ENDPOINT, 0x81, TUSB_XFER_BULK, 64, 0, 0,
+    };
+    EXPECT_TRUE(view.begin(truncated, sizeof(truncated), false));
+    EXPECT_EQ(view.usbInterfaceCount(), 0);
+    EXPECT_TRUE(view.usbEndpoint(0x81)==nullptr);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
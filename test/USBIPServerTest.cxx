@@ -0,0 +1,232 @@
+/**
+ * Test cases for USBIPServer.h - We act as vhci client on localhost and check the replies of the server.
+ * 
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ * 
+ */
+#include "USBDescriptor.h"
+#include "USBIPServer.h"
+#include "USBTestDevice.h"
+#include "gtest/gtest.h"
+
+#define EPNUM_MIDI   0x01
+
+static int completed_ep = 0;
+static int completed_bytes = 0;
+
+static void setupMidi() {
+    setupTestDevice(usb_test_midi, sizeof(usb_test_midi), [](uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+        completed_ep = ep_addr;
+        completed_bytes = xferred_bytes;
+    });
+    USBDevice::instance().idVendor(0xCafe).idProduct(0x0001).bcdDevice(0x0100).manufacturer("TinyUSB").product("TinyUSB Device").serialNumber("123456");
+}
+
+static int connectClient(USBIPServer &server){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server.port());
+    EXPECT_EQ(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    server.poll(100); // accept
+    return fd;
+}
+
+// the client and the server run in the same thread, so we need to give the server the chance to reply
+static bool receive(USBIPServer &server, int fd, void* data, int len){
+    uint8_t *ptr = (uint8_t*)data;
+    for (int j=0; j<100 && len>0; j++){
+        server.poll(10);
+        int n = recv(fd, ptr, len, MSG_DONTWAIT);
+        if (n>0){
+            ptr += n;
+            len -= n;
+        }
+    }
+    return len==0;
+}
+
+static void import(USBIPServer &server, int fd){
+    uint8_t req[40] = {0x01, 0x11, 0x80, 0x03};
+    strcpy((char*)req+8, USBIP_BUS_ID);
+    send(fd, req, sizeof(req), 0);
+    uint8_t reply[8];
+    USBIPDeviceInfo info;
+    ASSERT_TRUE(receive(server, fd, reply, sizeof(reply)));
+    ASSERT_TRUE(receive(server, fd, &info, sizeof(info)));
+    EXPECT_EQ(reply[3], 0x03);
+    EXPECT_EQ(ntohs(info.idVendor), 0xCafe);
+    EXPECT_TRUE(server.isAttached());
+}
+
+static void submit(int fd, uint32_t seqnum, uint8_t ep, bool in, int len, const uint8_t setup[8]=nullptr){
+    USBIPHeader cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.command = htonl(USBIP_CMD_SUBMIT);
+    cmd.seqnum = htonl(seqnum);
+    cmd.direction = htonl(in ? 1 : 0);
+    cmd.ep = htonl(ep);
+    cmd.submit.transfer_buffer_length = htonl(len);
+    if (setup!=nullptr){
+        memcpy(cmd.submit.setup, setup, 8);
+    }
+    send(fd, &cmd, sizeof(cmd), 0);
+}
+
+TEST(USBIPServerTests, DeviceList) {
+    setupMidi();
+    USBIPServer &server = USBIPServer::instance();
+    ASSERT_TRUE(server.begin(0));
+    int fd = connectClient(server);
+
+    uint8_t req[8] = {0x01, 0x11, 0x80, 0x05, 0, 0, 0, 0};
+    send(fd, req, sizeof(req), 0);
+    uint8_t reply[12];
+    USBIPDeviceInfo info;
+    uint8_t interfaces[2][4];
+    ASSERT_TRUE(receive(server, fd, reply, sizeof(reply)));
+    ASSERT_TRUE(receive(server, fd, &info, sizeof(info)));
+    ASSERT_TRUE(receive(server, fd, interfaces, sizeof(interfaces)));
+    EXPECT_EQ(reply[3], 0x05);
+    EXPECT_EQ(reply[11], 1); // 1 device
+    EXPECT_STREQ(info.busid, USBIP_BUS_ID);
+    EXPECT_EQ(ntohs(info.idVendor), 0xCafe);
+    EXPECT_EQ(info.bNumInterfaces, 2);
+    EXPECT_EQ(interfaces[0][0], TUSB_CLASS_AUDIO);
+    EXPECT_EQ(interfaces[1][1], AUDIO_SUBCLASS_MIDI_STREAMING);
+
+    close(fd);
+    server.end();
+}
+
+TEST(USBIPServerTests, GetDescriptors) {
+    setupMidi();
+    USBIPServer &server = USBIPServer::instance();
+    ASSERT_TRUE(server.begin(0));
+    int fd = connectClient(server);
+    import(server, fd);
+
+    // device descriptor
+    const uint8_t get_device[8] = {0x80, TUSB_REQ_GET_DESCRIPTOR, 0, TUSB_DESC_DEVICE, 0, 0, 64, 0};
+    submit(fd, 1, 0, true, 64, get_device);
+    USBIPHeader ret;
+    tusb_desc_device_t desc;
+    ASSERT_TRUE(receive(server, fd, &ret, sizeof(ret)));
+    EXPECT_EQ(ntohl(ret.command), USBIP_RET_SUBMIT);
+    EXPECT_EQ(ntohl(ret.seqnum), 1);
+    EXPECT_EQ((int)ntohl(ret.ret_submit.actual_length), (int)sizeof(desc));
+    ASSERT_TRUE(receive(server, fd, &desc, sizeof(desc)));
+    EXPECT_EQ(desc.idVendor, 0xCafe);
+
+    // configuration descriptor is limited by wLength
+    const uint8_t get_config[8] = {0x80, TUSB_REQ_GET_DESCRIPTOR, 0, TUSB_DESC_CONFIGURATION, 0, 0, 9, 0};
+    submit(fd, 2, 0, true, 9, get_config);
+    tusb_desc_configuration_t config;
+    ASSERT_TRUE(receive(server, fd, &ret, sizeof(ret)));
+    ASSERT_TRUE(receive(server, fd, &config, sizeof(config)));
+    EXPECT_EQ(config.wTotalLength, USB_TEST_MIDI_LEN);
+
+    // unsupported descriptor stalls
+    const uint8_t get_qualifier[8] = {0x80, TUSB_REQ_GET_DESCRIPTOR, 0, TUSB_DESC_DEVICE_QUALIFIER, 0, 0, 10, 0};
+    submit(fd, 3, 0, true, 10, get_qualifier);
+    ASSERT_TRUE(receive(server, fd, &ret, sizeof(ret)));
+    EXPECT_EQ((int)ntohl(ret.ret_submit.status), -EPIPE);
+
+    close(fd);
+    server.end();
+}
+
+// each configuration is served with its own wTotalLength and the device list only describes the first one
+TEST(USBIPServerTests, MultipleConfigurations) {
+    setupMidi();
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(256);
+    device.idVendor(0xCafe).idProduct(0x0002);
+    device.createConfiguration()->createInterface()->bInterfaceClass(TUSB_CLASS_VENDOR_SPECIFIC).createEndpoint(true, Bulk);
+    USBInterface *itf = device.createConfiguration()->createInterface();
+    itf->bInterfaceClass(TUSB_CLASS_CDC_DATA);
+    itf->createEndpoint(true, Bulk);
+    itf->createEndpoint(false, Bulk);
+    USBIPServer &server = USBIPServer::instance();
+    ASSERT_TRUE(server.begin(0));
+
+    int fd = connectClient(server);
+    uint8_t req[8] = {0x01, 0x11, 0x80, 0x05, 0, 0, 0, 0};
+    send(fd, req, sizeof(req), 0);
+    uint8_t reply[12];
+    USBIPDeviceInfo info;
+    uint8_t interface[4];
+    ASSERT_TRUE(receive(server, fd, reply, sizeof(reply)));
+    ASSERT_TRUE(receive(server, fd, &info, sizeof(info)));
+    ASSERT_TRUE(receive(server, fd, interface, sizeof(interface)));
+    EXPECT_EQ(info.bNumConfigurations, 2);
+    EXPECT_EQ(info.bNumInterfaces, 1);
+    EXPECT_EQ(interface[0], TUSB_CLASS_VENDOR_SPECIFIC);
+    // nothing follows the interfaces of the first configuration
+    EXPECT_FALSE(receive(server, fd, interface, 1));
+    close(fd);
+
+    fd = connectClient(server);
+    import(server, fd);
+    const int lengths[2] = {9 + 9 + 7, 9 + 9 + 7 + 7};
+    for (uint8_t idx=0; idx<2; idx++){
+        const uint8_t get_config[8] = {0x80, TUSB_REQ_GET_DESCRIPTOR, idx, TUSB_DESC_CONFIGURATION, 0, 0, 255, 0};
+        submit(fd, 1+idx, 0, true, 255, get_config);
+        USBIPHeader ret;
+        uint8_t config[255];
+        ASSERT_TRUE(receive(server, fd, &ret, sizeof(ret)));
+        ASSERT_EQ((int)ntohl(ret.ret_submit.actual_length), lengths[idx]);
+        ASSERT_TRUE(receive(server, fd, config, lengths[idx]));
+        EXPECT_EQ(((tusb_desc_configuration_t*)config)->wTotalLength, lengths[idx]);
+        EXPECT_EQ(((tusb_desc_configuration_t*)config)->bConfigurationValue, idx+1);
+        EXPECT_TRUE(USBConfiguration::validate(config, lengths[idx])==nullptr);
+    }
+    close(fd);
+    server.end();
+}
+
+TEST(USBIPServerTests, BulkTransfer) {
+    setupMidi();
+    USBIPServer &server = USBIPServer::instance();
+    ASSERT_TRUE(server.begin(0));
+    int fd = connectClient(server);
+    import(server, fd);
+
+    // IN: the host is waiting before the device provides the data
+    submit(fd, 10, EPNUM_MIDI, true, 64);
+    server.poll(10);
+    uint8_t packet[4] = {0x09, 0x90, 60, 127};
+    EXPECT_TRUE(usbd_edpt_xfer(0, 0x80 | EPNUM_MIDI, packet, sizeof(packet)));
+    USBIPHeader ret;
+    uint8_t data[4];
+    ASSERT_TRUE(receive(server, fd, &ret, sizeof(ret)));
+    ASSERT_TRUE(receive(server, fd, data, sizeof(data)));
+    EXPECT_EQ(ntohl(ret.seqnum), 10);
+    EXPECT_TRUE(memcmp(data, packet, sizeof(packet))==0);
+    tud_task();
+    EXPECT_EQ(completed_ep, 0x80 | EPNUM_MIDI);
+    EXPECT_EQ(completed_bytes, 4);
+
+    // OUT: the device is waiting before the host sends the data
+    uint8_t buffer[64];
+    EXPECT_TRUE(usbd_edpt_xfer(0, EPNUM_MIDI, buffer, sizeof(buffer)));
+    submit(fd, 11, EPNUM_MIDI, false, sizeof(packet));
+    send(fd, packet, sizeof(packet), 0);
+    ASSERT_TRUE(receive(server, fd, &ret, sizeof(ret)));
+    EXPECT_EQ((int)ntohl(ret.ret_submit.actual_length), 4);
+    tud_task();
+    EXPECT_EQ(completed_ep, EPNUM_MIDI);
+    EXPECT_EQ(completed_bytes, 4);
+    EXPECT_TRUE(memcmp(buffer, packet, sizeof(packet))==0);
+
+    close(fd);
+    server.end();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
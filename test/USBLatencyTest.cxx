@@ -0,0 +1,104 @@
+/**
+ * Test cases for USBLatency.h - this test is compiled with USB_LATENCY and uses a simulated clock
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include <stdint.h>
+static uint64_t fake_time = 0;
+static uint64_t fake_step = 0;
+#define USB_CLOCK_MICROS() (fake_time += fake_step)
+
+#include "USBDescriptor.h"
+#include "USBTestDevice.h"
+#include "gtest/gtest.h"
+
+static void setupVendor() {
+    setupTestDevice(usb_test_vendor, sizeof(usb_test_vendor));
+    USBDevice::instance().idVendor(0xCafe).idProduct(0x0001).bcdDevice(0x0100).manufacturer("TinyUSB");
+    USBLatency::instance().reset();
+    for (int j=0;j<LatencyTypeCount;j++){
+        USBLatency::instance().setBudget((USBLatencyType)j, 0);
+    }
+    fake_step = 0;
+}
+
+TEST(USBLatencyTests, Histogram) {
+    USBLatencyHistogram histogram;
+    EXPECT_EQ(USBLatencyHistogram::bucketIndex(0), 0);
+    EXPECT_EQ(USBLatencyHistogram::bucketIndex(1), 1);
+    EXPECT_EQ(USBLatencyHistogram::bucketIndex(3), 2);
+    EXPECT_EQ(USBLatencyHistogram::bucketIndex(4), 3);
+    EXPECT_EQ(USBLatencyHistogram::bucketIndex(UINT32_MAX), USB_LATENCY_BUCKETS-1);
+    EXPECT_EQ(USBLatencyHistogram::bucketLimit(3), 7);
+
+    for (int j=0;j<99;j++){
+        histogram.record(5);
+    }
+    histogram.record(1000);
+    EXPECT_EQ(histogram.count(), 100);
+    EXPECT_EQ(histogram.bucket(3), 99);
+    EXPECT_EQ(histogram.max(), 1000);
+    EXPECT_EQ(histogram.percentile(50), 7);
+    EXPECT_EQ(histogram.percentile(99), 7);
+    EXPECT_EQ(histogram.percentile(100), 1000);
+}
+
+TEST(USBLatencyTests, DescriptorCallbacks) {
+    setupVendor();
+    USBDevice &device = USBDevice::instance();
+    fake_step = 100;
+    device.deviceDescriptor();
+    device.configurationDescriptor(0);
+    device.string(1);
+    device.string(0);
+
+    USBLatency &latency = USBLatency::instance();
+    EXPECT_EQ(latency.histogram(LatencyDeviceDescriptor).count(), 1);
+    EXPECT_EQ(latency.histogram(LatencyConfigurationDescriptor).count(), 1);
+    EXPECT_EQ(latency.histogram(LatencyStringDescriptor).count(), 2);
+    EXPECT_EQ(latency.histogram(LatencyStringDescriptor).max(), 100);
+    EXPECT_EQ(latency.histogram(LatencyClassRequest).count(), 0);
+}
+
+static bool slowVendorRequest(const tusb_control_request_t *request, uint8_t *buffer, uint16_t &len){
+    // e.g. reading from a slow EEPROM
+    fake_time += request->wValue;
+    return true;
+}
+
+// the budgets are checked for the requests which are dispatched by the host simulator
+TEST(USBLatencyTests, Budget) {
+    setupVendor();
+    USBLatency &latency = USBLatency::instance();
+    latency.setBudget(LatencyVendorRequest, 1000);
+    USBStubDCD::instance().setControlCallback(slowVendorRequest);
+
+    tusb_control_request_t request = {};
+    request.bmRequestType_bit.type = TUSB_REQ_TYPE_VENDOR;
+    request.bmRequestType_bit.direction = TUSB_DIR_IN;
+    uint8_t buffer[64];
+    uint16_t len = sizeof(buffer);
+
+    request.wValue = 500;
+    EXPECT_TRUE(USBStubDCD::instance().controlRequest(&request, buffer, len));
+    EXPECT_TRUE(latency.isWithinBudget());
+
+    request.wValue = 5000;
+    EXPECT_TRUE(USBStubDCD::instance().controlRequest(&request, buffer, len));
+    EXPECT_FALSE(latency.isWithinBudget());
+    EXPECT_EQ(latency.violationCount(LatencyVendorRequest), 1);
+    EXPECT_EQ(latency.histogram(LatencyVendorRequest).count(), 2);
+    EXPECT_EQ(latency.histogram(LatencyVendorRequest).max(), 5000);
+    EXPECT_EQ(latency.histogram(LatencyClassRequest).count(), 0);
+
+    latency.reset();
+    EXPECT_TRUE(latency.isWithinBudget());
+    EXPECT_EQ(latency.budget(LatencyVendorRequest), 1000);
+    USBStubDCD::instance().setControlCallback(nullptr);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,136 @@
+/**
+ * Test cases for USBPersonality.h - personalities are frozen from USBDevice definitions, deduplicated and selected
+ * at boot.
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBPersonality.h"
+#include "gtest/gtest.h"
+#include <string>
+
+#define MIDI_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN)
+#define CDC_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN)
+
+static void defineMidi(USBDevice &device){
+    device.clear();
+    device.descriptorTotalSize(MIDI_TOTAL_LEN);
+    device.idVendor(0xCafe).idProduct(0x0001).bcdDevice(0x0100).manufacturer("TinyUSB").product("MIDI").serialNumber("123456");
+    USBConfiguration *config = device.setConfigurationDescriptor(TUD_CONFIG_DESCRIPTOR(1, 2, 0, MIDI_TOTAL_LEN, 0, 100));
+    config->addDescriptor(TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64));
+}
+
+static void defineCdc(USBDevice &device, const char* product){
+    device.clear();
+    device.descriptorTotalSize(CDC_TOTAL_LEN);
+    device.idVendor(0xCafe).idProduct(0x0002).bcdDevice(0x0100).manufacturer("TinyUSB").product(product).serialNumber("123456");
+    USBConfiguration *config = device.setConfigurationDescriptor(TUD_CONFIG_DESCRIPTOR(1, 2, 0, CDC_TOTAL_LEN, 0, 100));
+    config->addDescriptor(TUD_CDC_DESCRIPTOR(0, 0, 0x81, 8, 0x02, 0x82, 64));
+}
+
+// compares the selected personality with the current USBDevice definition
+static void expectSame(USBDevice &device){
+    USBPersonalities &p = USBPersonalities::instance();
+    EXPECT_EQ(memcmp(p.deviceDescriptor(), device.descriptor(), sizeof(tusb_desc_device_t)), 0);
+    int len = USBConfigurationDescriptorData::instance().totalSize();
+    EXPECT_EQ(memcmp(p.configurationDescriptor(0), device.configurationDescriptor(0), len), 0);
+    for (int j=0;j<=USBStrings::instance().size();j++){
+        const uint16_t *str = p.string(j);
+        ASSERT_TRUE(str!=nullptr);
+        EXPECT_EQ(memcmp(str, device.string(j), ((const uint8_t*)str)[0]), 0) << "string " << j;
+    }
+    EXPECT_TRUE(p.string(USBStrings::instance().size()+1)==nullptr);
+}
+
+TEST(USBPersonalityTests, Deduplication) {
+    USBDevice &device = USBDevice::instance();
+    USBPersonalityBuilder builder;
+    defineMidi(device);
+    EXPECT_EQ(builder.add(device), 0);
+    defineCdc(device, "CDC");
+    EXPECT_EQ(builder.add(device), 1);
+    defineCdc(device, "CDC Debug");
+    EXPECT_EQ(builder.add(device), 2);
+    EXPECT_EQ(builder.personalityCount(), 3);
+
+    // device: midi, cdc | config: midi, cdc | strings: language, manufacturer, serial, 3 products
+    EXPECT_EQ(builder.blobCount(), 2 + 2 + 6);
+    EXPECT_LT(builder.storedBytes(), builder.rawBytes());
+
+    const USBPersonality *table = builder.table();
+    EXPECT_EQ(table[1].device, table[2].device);
+    EXPECT_EQ(table[1].configurations, table[2].configurations);
+    EXPECT_NE(table[0].configurations[0], table[1].configurations[0]);
+    EXPECT_EQ(table[0].strings[1], table[2].strings[1]);
+    EXPECT_NE(table[1].strings, table[2].strings);
+
+    // the selection just sets a pointer: the descriptors are identical to the original definitions
+    USBPersonalities &p = USBPersonalities::instance();
+    EXPECT_FALSE(p.select(table, 3, 3));
+    ASSERT_TRUE(p.select(table, 3, 0));
+    EXPECT_EQ(p.selected(), table);
+    defineMidi(device);
+    expectSame(device);
+    ASSERT_TRUE(p.select(table, 3, 2));
+    defineCdc(device, "CDC Debug");
+    expectSame(device);
+    EXPECT_TRUE(p.configurationDescriptor(1)==nullptr);
+}
+
+// each configuration is stored as separate descriptor which is shared with the other personalities
+TEST(USBPersonalityTests, MultipleConfigurations) {
+    USBDevice &device = USBDevice::instance();
+    USBPersonalityBuilder builder;
+    defineMidi(device);
+    builder.add(device);
+
+    static const uint8_t midi[] = {
+        TUD_CONFIG_DESCRIPTOR(1, 2, 0, MIDI_TOTAL_LEN, 0, 100),
+        TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64)
+    };
+    static const uint8_t cdc[] = {
+        TUD_CONFIG_DESCRIPTOR(2, 2, 0, CDC_TOTAL_LEN, 0, 100),
+        TUD_CDC_DESCRIPTOR(0, 0, 0x81, 8, 0x02, 0x82, 64)
+    };
+    device.clear();
+    device.descriptorTotalSize(MIDI_TOTAL_LEN + CDC_TOTAL_LEN);
+    device.idVendor(0xCafe).idProduct(0x0003).bcdDevice(0x0100).manufacturer("TinyUSB").product("MIDI or CDC");
+    device.singleConfiguration()->setConfigurationDescriptor(midi, sizeof(midi), true);
+    device.createConfiguration()->setConfigurationDescriptor(cdc, sizeof(cdc), true);
+    EXPECT_EQ(builder.add(device), 1);
+
+    const USBPersonality *table = builder.table();
+    EXPECT_EQ(table[0].configuration_count, 1);
+    ASSERT_EQ(table[1].configuration_count, 2);
+    EXPECT_EQ(table[0].configurations[0], table[1].configurations[0]);
+
+    USBPersonalities &p = USBPersonalities::instance();
+    ASSERT_TRUE(p.select(table, 2, 1));
+    EXPECT_EQ(memcmp(p.configurationDescriptor(0), midi, sizeof(midi)), 0);
+    EXPECT_EQ(memcmp(p.configurationDescriptor(1), cdc, sizeof(cdc)), 0);
+    EXPECT_TRUE(p.configurationDescriptor(2)==nullptr);
+    EXPECT_TRUE(p.configurationDescriptor(-1)==nullptr);
+}
+
+TEST(USBPersonalityTests, GenerateSource) {
+    USBDevice &device = USBDevice::instance();
+    USBPersonalityBuilder builder;
+    defineMidi(device);
+    builder.add(device);
+    defineCdc(device, "CDC");
+    builder.add(device);
+
+    std::string source;
+    builder.write([&source](const char* line){ source += line; source += "\n"; }, "boards");
+    EXPECT_NE(source.find("extern const USBPersonality boards[] = {"), std::string::npos);
+    EXPECT_NE(source.find("extern const int boards_count = 2;"), std::string::npos);
+    EXPECT_NE(source.find("alignas(4) static const uint8_t boards_desc0[18] = {"), std::string::npos);
+    EXPECT_NE(source.find("static const uint16_t* const boards_strings1[] = {"), std::string::npos);
+    EXPECT_NE(source.find("static const uint8_t* const boards_configurations1[] = {"), std::string::npos);
+    EXPECT_NE(source.find("    {boards_desc0, boards_configurations0, 1, boards_strings0, 4},"), std::string::npos);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+/**
+ * Test cases for USBProfile.h - this test is compiled with USB_PROFILE
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBDescriptor.h"
+#include "gtest/gtest.h"
+
+#define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_VENDOR_DESC_LEN)
+
+TEST(USBProfileTests, HookPoints) {
+    USBProfileRecorder &profiler = USBProfileRecorder::instance();
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    profiler.clear();
+
+    device.idVendor(0xCafe).idProduct(0x0001).bcdDevice(0x0100).manufacturer("TinyUSB");
+    USBConfiguration* config = device.setConfigurationDescriptor(TUD_CONFIG_DESCRIPTOR(1, 1, 0, CONFIG_TOTAL_LEN, 0, 100));
+    config->addDescriptor(TUD_VENDOR_DESCRIPTOR(0, 0, 0x01, 0x81, 64));
+    EXPECT_EQ(profiler.count(ProfileDescriptorBuild), 2);
+
+    device.deviceDescriptor();
+    device.configurationDescriptor(0);
+    device.string(1);
+    config->configurationDescriptorExt();
+    config->findDescriptor(TUSB_DESC_ENDPOINT, 0);
+    EXPECT_EQ(profiler.count(ProfileDeviceDescriptor), 1);
+    EXPECT_EQ(profiler.count(ProfileConfigurationDescriptor), 1);
+    EXPECT_EQ(profiler.count(ProfileStringDescriptor), 1);
+    EXPECT_EQ(profiler.count(ProfileStringEncoding), 1);
+    EXPECT_EQ(profiler.count(ProfileFinalize), 1);
+    EXPECT_EQ(profiler.count(ProfileFindDescriptor), 1);
+    EXPECT_EQ(profiler.size(), 8);
+
+    profiler.clear();
+    EXPECT_EQ(profiler.size(), 0);
+}
+
+TEST(USBProfileTests, Overflow) {
+    USBProfileRecorder &profiler = USBProfileRecorder::instance();
+    profiler.clear();
+    for (int j=0;j<USB_PROFILE_SIZE+10;j++){
+        profiler.record(ProfileTransferSubmit, j, 1);
+    }
+    EXPECT_EQ(profiler.totalCount(), USB_PROFILE_SIZE+10);
+    EXPECT_EQ(profiler.size(), USB_PROFILE_SIZE);
+    EXPECT_EQ(profiler.get(0).start, 10);
+    EXPECT_EQ(profiler.get(USB_PROFILE_SIZE-1).start, USB_PROFILE_SIZE+9);
+}
+
+// a user defined profiler e.g. based on a cycle counter
+struct CountingProfiler {
+    static uint32_t begins;
+    static uint32_t ends;
+    static uint32_t begin(USBProfilePoint point) { return ++begins; }
+    static void end(USBProfilePoint point, uint32_t start) { ends += start; }
+};
+uint32_t CountingProfiler::begins = 0;
+uint32_t CountingProfiler::ends = 0;
+
+TEST(USBProfileTests, CustomProfiler) {
+    {
+        USBProfileScope<CountingProfiler> scope(ProfileFinalize);
+        EXPECT_EQ(CountingProfiler::begins, 1);
+        EXPECT_EQ(CountingProfiler::ends, 0);
+    }
+    EXPECT_EQ(CountingProfiler::ends, 1);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
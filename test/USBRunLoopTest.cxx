@@ -0,0 +1,191 @@
+/**
+ * Test cases for USBRunLoop.h: a second thread simulates the interrupt of the device controller
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBRunLoop.h"
+#include "USBTestDevice.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+static USBConfiguration *setupDevice() {
+    USBConfiguration *config = setupTestDevice(usb_test_vendor, sizeof(usb_test_vendor), USBRunLoop::transferCompletedCb);
+    USBStubDCD::instance().setEventHook(USBRunLoop::eventHook);
+    USBRunLoop &loop = USBRunLoop::instance();
+    loop.unbindAll();
+    loop.resetStats();
+    // consume a left over signal
+    loop.wait(0);
+    loop.resetStats();
+    return config;
+}
+
+static int received_count = 0;
+static uint32_t received_bytes = 0;
+
+static void received(USBEndpoint &ep, xfer_result_t result, uint32_t xferred_bytes, void *ref){
+    received_count++;
+    received_bytes += xferred_bytes;
+    if (ref!=nullptr && received_count==*(int*)ref){
+        USBRunLoop::instance().stop();
+    }
+}
+
+TEST(USBRunLoopTests, Timeout) {
+    setupDevice();
+    USBRunLoop &loop = USBRunLoop::instance();
+    EXPECT_EQ(loop.step(10), 0);
+    USBRunLoopStats stats;
+    loop.stats(stats);
+    EXPECT_EQ(stats.wakeups, 0u);
+    EXPECT_EQ(stats.timeouts, 1u);
+    EXPECT_EQ(stats.latency_max_us, 0u);
+}
+
+// a signal between begin() and the first wait is not lost
+TEST(USBRunLoopTests, SignalBeforeWait) {
+    setupDevice();
+    USBRunLoop &loop = USBRunLoop::instance();
+    loop.begin();
+    loop.signal(true);
+    EXPECT_TRUE(loop.wait(0));
+    EXPECT_FALSE(loop.wait(0));
+}
+
+TEST(USBRunLoopTests, Dispatch) {
+    USBConfiguration *config = setupDevice();
+    USBEndpoint &out = *config->usbEndpoint((uint8_t)0x01);
+    USBRunLoop &loop = USBRunLoop::instance();
+    received_count = 0;
+    received_bytes = 0;
+    ASSERT_TRUE(loop.bind(out, received));
+
+    // the transfer completes in the "interrupt" while the loop sleeps
+    std::thread isr([](){
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        USBStubDCD::instance().complete(0x01, 10);
+    });
+    EXPECT_EQ(loop.step(1000), 1);
+    isr.join();
+    EXPECT_EQ(received_count, 1);
+    EXPECT_EQ(received_bytes, 10u);
+
+    // the IN endpoint is not bound and is forwarded to the device
+    USBStubDCD::instance().complete(0x81, 5);
+    EXPECT_EQ(loop.step(1000), 1);
+    EXPECT_EQ(received_count, 1);
+
+    // a signal without any transfer
+    loop.signal();
+    EXPECT_EQ(loop.step(1000), 0);
+
+    USBRunLoopStats stats;
+    loop.stats(stats);
+    EXPECT_EQ(stats.wakeups, 3u);
+    EXPECT_EQ(stats.timeouts, 0u);
+    EXPECT_EQ(stats.spurious, 1u);
+    EXPECT_EQ(stats.dispatched, 1u);
+    EXPECT_EQ(stats.unbound, 1u);
+    EXPECT_LE(stats.latency_min_us, stats.latency_avg_us);
+    EXPECT_LE(stats.latency_avg_us, stats.latency_max_us);
+
+    // removing the binding
+    EXPECT_TRUE(loop.bind(out, nullptr));
+    USBStubDCD::instance().complete(0x01, 3);
+    loop.step(1000);
+    EXPECT_EQ(received_count, 1);
+}
+
+TEST(USBRunLoopTests, Run) {
+    USBConfiguration *config = setupDevice();
+    USBEndpoint &out = *config->usbEndpoint((uint8_t)0x01);
+    USBRunLoop &loop = USBRunLoop::instance();
+    received_count = 0;
+    received_bytes = 0;
+    int expected = 50;
+    ASSERT_TRUE(loop.bind(out, received, &expected));
+
+    std::thread isr([expected](){
+        for (int j=0;j<expected;j++){
+            // we must not overflow the pending completions of the stub
+            while(!USBStubDCD::instance().complete(0x01, 1)){
+                std::this_thread::yield();
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    // the callback stops the loop after the last transfer
+    loop.run();
+    isr.join();
+    EXPECT_EQ(received_count, expected);
+
+    USBRunLoopStats stats;
+    loop.stats(stats);
+    EXPECT_EQ(stats.dispatched, (uint32_t)expected);
+    EXPECT_GT(stats.wakeups, 0u);
+    EXPECT_LE(stats.wakeups, (uint32_t)expected + 1);
+}
+
+static USBEndpoint *received_ep = nullptr;
+
+static void receivedEndpoint(USBEndpoint &ep, xfer_result_t result, uint32_t xferred_bytes, void *ref){
+    received_ep = &ep;
+}
+
+// the binding is by address: it survives the redefinition of the device and never uses a deleted endpoint
+TEST(USBRunLoopTests, Redefine) {
+    USBConfiguration *config = setupDevice();
+    USBRunLoop &loop = USBRunLoop::instance();
+    ASSERT_TRUE(loop.bind(*config->usbEndpoint((uint8_t)0x01), receivedEndpoint));
+
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(USB_TEST_VENDOR_LEN);
+    config = device.setConfigurationDescriptor(usb_test_vendor, sizeof(usb_test_vendor), true);
+    received_ep = nullptr;
+    USBStubDCD::instance().complete(0x01, 4);
+    EXPECT_EQ(loop.step(1000), 1);
+    EXPECT_EQ(received_ep, config->usbEndpoint((uint8_t)0x01));
+
+    // without the endpoint the transfer is forwarded to the device
+    device.clear();
+    received_ep = nullptr;
+    USBStubDCD::instance().complete(0x01, 4);
+    EXPECT_EQ(loop.step(1000), 1);
+    EXPECT_TRUE(received_ep==nullptr);
+    USBRunLoopStats stats;
+    loop.stats(stats);
+    EXPECT_EQ(stats.dispatched, 1u);
+    EXPECT_EQ(stats.unbound, 1u);
+    loop.unbindAll();
+}
+
+TEST(USBRunLoopTests, BindCapacity) {
+    USBConfiguration *config = setupDevice();
+    USBRunLoop &loop = USBRunLoop::instance();
+    USBEndpoint &out = *config->usbEndpoint((uint8_t)0x01);
+    // binding the same endpoint again replaces the callback
+    for (int j=0;j<USB_RUNLOOP_BINDINGS+1;j++){
+        EXPECT_TRUE(loop.bind(out, received));
+    }
+    // additional endpoints of the interface
+    static tusb_desc_endpoint_t desc[USB_RUNLOOP_BINDINGS];
+    USBEndpoint *eps[USB_RUNLOOP_BINDINGS];
+    for (int j=0;j<USB_RUNLOOP_BINDINGS;j++){
+        desc[j] = {sizeof(tusb_desc_endpoint_t), TUSB_DESC_ENDPOINT, (uint8_t)(0x02+j), {TUSB_XFER_BULK, 0, 0}, 64, 0};
+        eps[j] = &config->usbInterface(0)->createEndpoint(&desc[j]);
+    }
+    for (int j=0;j<USB_RUNLOOP_BINDINGS-1;j++){
+        EXPECT_TRUE(loop.bind(*eps[j], received));
+    }
+    EXPECT_FALSE(loop.bind(*eps[USB_RUNLOOP_BINDINGS-1], received));
+    loop.unbindAll();
+    EXPECT_TRUE(loop.bind(*eps[USB_RUNLOOP_BINDINGS-1], received));
+    loop.unbindAll();
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,211 @@
+/**
+ * Scaling test: random configuration descriptors of increasing size are parsed and validated. We record the time
+ * and the heap usage per size and check that both grow linearly with the size of the descriptor.
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBDescriptor.h"
+#include "USBDescriptorGenerator.h"
+#include "USBHeapAccounting.h"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <random>
+
+struct ScalingResult {
+    int interfaces;
+    int trees;
+    double bytes;       // average descriptor size
+    double time_us;     // average time to parse and validate a descriptor
+    double peak_heap;   // average peak heap while the descriptor is in use
+};
+
+// parses and validates the indicated number of random descriptors
+static ScalingResult measure(int interfaces, int trees){
+    USBDevice &device = USBDevice::instance();
+    USBDescriptorGenerator generator(interfaces);
+    ScalingResult result = {interfaces, trees, 0, 0, 0};
+    for (int j=0;j<trees;j++){
+        USBGeneratedDescriptor desc = generator.generate(interfaces);
+        int len = desc.data.size();
+        device.clear();
+        USBHeapAccounting &heap = USBHeapAccounting::instance();
+        size_t heap_start = heap.current();
+        heap.resetPeak();
+
+        auto start = std::chrono::steady_clock::now();
+        device.descriptorTotalSize(len);
+        USBConfiguration *config = device.setConfigurationDescriptor(desc.data.data(), len, true);
+        const char* error = config->validate();
+        uint8_t *last_ep = config->findDescriptor(TUSB_DESC_ENDPOINT, desc.endpoint_count-1);
+        auto end = std::chrono::steady_clock::now();
+
+        result.bytes += len;
+        result.time_us += std::chrono::duration<double, std::micro>(end - start).count();
+        result.peak_heap += heap.peak() - heap_start;
+
+        // round trip: the parsing must not change the descriptor
+        EXPECT_TRUE(error==nullptr) << error;
+        EXPECT_EQ(memcmp(device.configurationDescriptor(0), desc.data.data(), len), 0);
+        EXPECT_EQ(config->usbInterfaceCount(), desc.interface_count);
+        int endpoints = 0;
+        for (int i=0;i<config->usbInterfaceCount();i++){
+            endpoints += config->usbInterface(i)->usbEndpointCount();
+        }
+        EXPECT_EQ(endpoints, desc.endpoint_count);
+        EXPECT_EQ(last_ep!=nullptr, desc.endpoint_count>0);
+        if (last_ep!=nullptr){
+            EXPECT_EQ(((tusb_desc_endpoint_t*)last_ep)->bEndpointAddress, desc.last_ep_addr);
+        }
+    }
+    device.clear();
+    result.bytes /= trees;
+    result.time_us /= trees;
+    result.peak_heap /= trees;
+    return result;
+}
+
+// the validation detects inconsistent descriptors
+TEST(USBScalingTests, Validate) {
+    USBDescriptorGenerator generator(7);
+    USBGeneratedDescriptor desc = generator.generate(10);
+    std::vector<uint8_t> data = desc.data;
+    EXPECT_TRUE(USBConfiguration::validate(data.data(), data.size())==nullptr);
+    EXPECT_STREQ(USBConfiguration::validate(data.data(), data.size()-1), "wTotalLength does not match");
+    data[4]++;
+    EXPECT_STREQ(USBConfiguration::validate(data.data(), data.size()), "bNumInterfaces does not match");
+    data = desc.data;
+    data[9+0] = 0xff; // first descriptor exceeds the total length
+    EXPECT_STREQ(USBConfiguration::validate(data.data(), data.size()), "descriptor exceeds wTotalLength");
+}
+
+// builds a random configuration with the API: returns the number of endpoints
+static int buildConfiguration(USBConfiguration *config, std::minstd_rand &rnd, int interfaces){
+    int endpoints = 0;
+    int used[2] = {0, 0};
+    for (int j=0;j<interfaces;j++){
+        USBInterface *itf = config->createInterface();
+        itf->bInterfaceClass(0xff);
+        int wanted = rnd() % 4;
+        for (int i=0;i<wanted;i++){
+            bool in = rnd() % 2;
+            if (used[in]<15){
+                itf->createEndpoint(in, rnd() % 2 ? Bulk : Interrupt);
+                used[in]++;
+                endpoints++;
+            }
+        }
+    }
+    return endpoints;
+}
+
+// the descriptors which are built with the API are valid and survive a round trip through the parser
+TEST(USBScalingTests, BuilderRoundTrip) {
+    USBDevice &device = USBDevice::instance();
+    std::minstd_rand rnd(7);
+    for (int tree=0; tree<200; tree++){
+        device.clear();
+        device.descriptorTotalSize(4096);
+        int interfaces = 1 + rnd() % 16;
+        USBConfiguration *config = device.createConfiguration();
+        int endpoints = buildConfiguration(config, rnd, interfaces);
+        const char *error = config->validate();
+        ASSERT_TRUE(error==nullptr) << error;
+        int len = config->totalSize();
+        EXPECT_EQ(len, (int)(sizeof(tusb_desc_configuration_t) + interfaces * sizeof(tusb_desc_interface_t) + endpoints * sizeof(tusb_desc_endpoint_t)));
+        EXPECT_EQ(((tusb_desc_configuration_t*)config->configurationDescriptor())->bConfigurationValue, 1);
+        std::vector<uint8_t> blob(config->configurationDescriptor(), config->configurationDescriptor() + len);
+
+        device.clear();
+        device.descriptorTotalSize(len);
+        USBConfiguration *parsed = device.setConfigurationDescriptor(blob.data(), len, true);
+        EXPECT_TRUE(parsed->validate()==nullptr);
+        EXPECT_EQ(memcmp(device.configurationDescriptor(0), blob.data(), len), 0);
+        EXPECT_EQ(parsed->usbInterfaceCount(), interfaces);
+        int parsed_endpoints = 0;
+        for (int i=0;i<parsed->usbInterfaceCount();i++){
+            parsed_endpoints += parsed->usbInterface(i)->usbEndpointCount();
+        }
+        EXPECT_EQ(parsed_endpoints, endpoints);
+    }
+    device.clear();
+}
+
+// each configuration of a device is provided and validated separately
+TEST(USBScalingTests, MultipleConfigurations) {
+    USBDevice &device = USBDevice::instance();
+    USBDescriptorGenerator generator(11);
+    for (int tree=0; tree<100; tree++){
+        int count = 2 + tree % 3;
+        std::vector<USBGeneratedDescriptor> descs;
+        int total = 0;
+        for (int j=0;j<count;j++){
+            descs.push_back(generator.generate(1 + tree % 20));
+            total += descs[j].data.size();
+        }
+        device.clear();
+        device.descriptorTotalSize(total + 1);
+        for (int j=0;j<count;j++){
+            USBConfiguration *config = j==0 ? device.singleConfiguration() : device.createConfiguration();
+            config->setConfigurationDescriptor(descs[j].data.data(), descs[j].data.size(), true);
+        }
+        ASSERT_EQ(device.usbConfigurationCount(), count);
+        EXPECT_EQ(device.deviceDescriptor()->bNumConfigurations, count);
+        for (int j=0;j<count;j++){
+            int len = descs[j].data.size();
+            EXPECT_EQ(memcmp(device.configurationDescriptor(j), descs[j].data.data(), len), 0);
+            const char *error = device.usbConfiguration(j)->validate();
+            EXPECT_TRUE(error==nullptr) << error;
+            EXPECT_EQ(device.usbConfiguration(j)->usbInterfaceCount(), descs[j].interface_count);
+        }
+    }
+
+    // configurations which are built with the API one after the other
+    std::minstd_rand rnd(3);
+    for (int tree=0; tree<50; tree++){
+        device.clear();
+        device.descriptorTotalSize(8192);
+        int count = 2 + tree % 3;
+        int endpoints[4];
+        for (int j=0;j<count;j++){
+            endpoints[j] = buildConfiguration(device.createConfiguration(), rnd, 1 + rnd() % 8);
+        }
+        for (int j=0;j<count;j++){
+            USBConfiguration *config = device.usbConfiguration(j);
+            const char *error = config->validate();
+            ASSERT_TRUE(error==nullptr) << error;
+            const tusb_desc_configuration_t *desc = (const tusb_desc_configuration_t*) device.configurationDescriptor(j);
+            EXPECT_EQ(desc->bConfigurationValue, j+1);
+            EXPECT_EQ(desc->wTotalLength, sizeof(tusb_desc_configuration_t) + config->usbInterfaceCount() * sizeof(tusb_desc_interface_t) + endpoints[j] * sizeof(tusb_desc_endpoint_t));
+        }
+    }
+    device.clear();
+}
+
+TEST(USBScalingTests, LinearScaling) {
+    const int sizes[] = {4, 16, 64, 128, 255};
+    ScalingResult results[5];
+    printf("interfaces   bytes  time us  us/kB  peak heap  heap/byte\n");
+    for (int j=0;j<5;j++){
+        // we take the best of 3 runs to reduce the noise
+        ScalingResult best = measure(sizes[j], 2000 / sizes[j] + 10);
+        for (int run=0; run<2; run++){
+            ScalingResult r = measure(sizes[j], 2000 / sizes[j] + 10);
+            if (r.time_us<best.time_us) best = r;
+        }
+        results[j] = best;
+        printf("%10d %7.0f %8.2f %6.2f %10.0f %10.2f\n", best.interfaces, best.bytes, best.time_us, best.time_us * 1024 / best.bytes, best.peak_heap, best.peak_heap / best.bytes);
+    }
+    // the cost per byte of the biggest descriptors must stay in the range of the small ones
+    double time_per_byte_small = results[1].time_us / results[1].bytes;
+    double time_per_byte_big = results[4].time_us / results[4].bytes;
+    EXPECT_LT(time_per_byte_big, 4 * time_per_byte_small + 0.01);
+    double heap_per_byte_small = results[1].peak_heap / results[1].bytes;
+    double heap_per_byte_big = results[4].peak_heap / results[4].bytes;
+    EXPECT_LT(heap_per_byte_big, 2 * heap_per_byte_small);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,137 @@
+/**
+ * Test cases for USBSnapshot.h
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include "USBSnapshot.h"
+#include "USBTestDevice.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+static USBConfiguration *setupDevice() {
+    USBConfiguration *config = setupTestDevice(usb_test_midi, sizeof(usb_test_midi));
+    USBDevice::instance().idVendor(0xCafe).idProduct(0x0001).manufacturer("TinyUSB").product("TinyUSB Device");
+    return config;
+}
+
+TEST(USBSnapshotTests, Publish) {
+    USBSnapshots &snapshots = USBSnapshots::instance();
+    USBConfiguration *config = setupDevice();
+    USBDescriptorSnapshot *snapshot = snapshots.publish();
+    EXPECT_EQ(snapshots.current(), snapshot);
+    EXPECT_EQ(((const tusb_desc_device_t*)snapshots.deviceDescriptor())->idVendor, 0xCafe);
+    EXPECT_EQ(memcmp(snapshots.configurationDescriptor(0), usb_test_midi, sizeof(usb_test_midi)), 0);
+    EXPECT_EQ(snapshots.configurationDescriptor(1), nullptr);
+    EXPECT_EQ(snapshot->stringCount(), 3);
+    EXPECT_EQ(snapshots.string(0)[1], DEFAULT_LANGUAGE);
+    EXPECT_EQ(((const uint8_t*)snapshots.string(2))[0], 2 + 2*14);
+    EXPECT_EQ(snapshots.string(2)[1], 'T');
+    EXPECT_EQ(snapshots.string(3), nullptr);
+
+    // changes of the device are not visible before they are published
+    const uint8_t *old_config = snapshots.configurationDescriptor(0);
+    config->bMaxPower(250);
+    USBDevice::instance().manufacturer("Changed");
+    EXPECT_EQ(snapshots.configurationDescriptor(0)[8], 50);
+    EXPECT_EQ(snapshot->stringCount(), 3);
+
+    uint32_t generation = snapshot->generation();
+    USBDescriptorSnapshot *next = snapshots.publish();
+    EXPECT_EQ(next->generation(), generation + 1);
+    EXPECT_EQ(snapshots.configurationDescriptor(0)[8], 125);
+    EXPECT_EQ(snapshots.current()->stringCount(), 4);
+
+    // the old snapshot stays valid until the next bus reset
+    EXPECT_EQ(snapshots.retiredCount(), 1);
+    EXPECT_EQ(snapshots.reclaim(), 0);
+    EXPECT_EQ(old_config[8], 50);
+    snapshots.busReset();
+    EXPECT_EQ(snapshots.reclaim(), 1);
+    EXPECT_EQ(snapshots.retiredCount(), 0);
+
+    // snapshots which are replaced after the reset need another one
+    snapshots.publish();
+    snapshots.busReset();
+    snapshots.publish();
+    EXPECT_EQ(snapshots.retiredCount(), 1);
+    snapshots.busReset();
+    snapshots.reclaim();
+    EXPECT_EQ(snapshots.retiredCount(), 0);
+    USBDevice::instance().clear();
+}
+
+// each configuration of the builder API is copied with its own wTotalLength
+TEST(USBSnapshotTests, MultipleConfigurations) {
+    USBSnapshots &snapshots = USBSnapshots::instance();
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(256);
+    device.createConfiguration()->createInterface()->createEndpoint(true, Bulk);
+    USBInterface *itf = device.createConfiguration()->createInterface();
+    itf->createEndpoint(true, Bulk);
+    itf->createEndpoint(false, Bulk);
+    snapshots.publish();
+
+    const int len[] = {9 + 9 + 7, 9 + 9 + 7 + 7};
+    for (int j=0;j<2;j++){
+        const uint8_t *config = snapshots.configurationDescriptor(j);
+        ASSERT_TRUE(config!=nullptr);
+        EXPECT_EQ(config[1], TUSB_DESC_CONFIGURATION);
+        EXPECT_EQ(config[2] | config[3]<<8, len[j]);
+        EXPECT_EQ(config[5], j + 1);
+        EXPECT_EQ(USBConfiguration::validate(config, len[j]), nullptr);
+    }
+    EXPECT_EQ(snapshots.configurationDescriptor(2), nullptr);
+    snapshots.busReset();
+    snapshots.reclaim();
+    device.clear();
+}
+
+// the writer rebuilds the device while the reader only sees complete snapshots
+TEST(USBSnapshotTests, Concurrent) {
+    USBSnapshots &snapshots = USBSnapshots::instance();
+    setupDevice();
+    snapshots.publish();
+    std::atomic<bool> done{false};
+    std::atomic<int> errors{0};
+    std::atomic<int> reads{0};
+
+    std::thread reader([&](){
+        while(!done.load()){
+            const uint8_t *config = snapshots.configurationDescriptor(0);
+            const tusb_desc_device_t *device = (const tusb_desc_device_t*)snapshots.deviceDescriptor();
+            // the power is 100 or 200 mA and the product id matches it
+            uint8_t power = config[8];
+            if (memcmp(config+9, usb_test_midi+9, sizeof(usb_test_midi)-9)!=0 || (power!=50 && power!=100)){
+                errors++;
+            }
+            if (device->idProduct!=0x0001 && device->idProduct!=0x0002){
+                errors++;
+            }
+            if (++reads % 64 == 0){
+                snapshots.busReset();
+            }
+        }
+    });
+
+    for (int j=0;j<2000;j++){
+        USBConfiguration *config = setupDevice();
+        config->bMaxPower(j%2 ? 200 : 100);
+        USBDevice::instance().idProduct(j%2 ? 0x0002 : 0x0001);
+        snapshots.publish();
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(errors.load(), 0);
+    EXPECT_GT(reads.load(), 0);
+    snapshots.busReset();
+    snapshots.reclaim();
+    EXPECT_EQ(snapshots.retiredCount(), 0);
+    USBDevice::instance().clear();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -245,8 +245,401 @@ TEST(USBTests, Strings) {
 
 }
 
-int main() {
-  ::testing::InitGoogleTest();
+#ifdef TINYUSB_CPP_HOST_PORT
+
+static int completed_bytes = 0;
+
+// Make sure that the stub device controller records the transfers and reports the completion in tud_task
+TEST(USBTests, HostPortStubDCD) {
+    USBStubDCD &dcd = USBStubDCD::instance();
+    dcd.clear();
+    dcd.setTransferCallback([](uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+        completed_bytes += xferred_bytes;
+    });
+
+    uint8_t buffer[64];
+    EXPECT_TRUE(usbd_edpt_xfer(0, 0x81, buffer, sizeof(buffer)));
+    EXPECT_TRUE(usbd_edpt_busy(0, 0x81));
+    EXPECT_EQ(dcd.count(StubTransfer), 1);
+    EXPECT_EQ(dcd.event(0).len, sizeof(buffer));
+
+    // the completion is only reported in tud_task
+    dcd.complete(0x81, 64);
+    EXPECT_EQ(completed_bytes, 0);
+    tud_task();
+    EXPECT_EQ(completed_bytes, 64);
+    EXPECT_FALSE(usbd_edpt_busy(0, 0x81));
+    EXPECT_EQ(dcd.count(StubTransferComplete), 1);
+
+    dcd.setTransferCallback(nullptr);
+}
+
+static USBConfiguration *stats_config = nullptr;
+
+// Make sure that the endpoint statistics count the transfers which are reported back to the configuration
+TEST(USBTests, EndpointStatistics) {
+    USBDevice device = USBDevice::instance();
+    device.clear();
+    device.setConfigurationDescriptor(desc_fs_configuration, sizeof(desc_fs_configuration), true);
+    stats_config = device.usbConfiguration(0);
+    USBEndpoint *ep_in = stats_config->usbEndpoint(0x81);
+    ASSERT_TRUE(ep_in!=nullptr);
+    EXPECT_TRUE(stats_config->usbEndpoint(0x01)!=nullptr);
+    EXPECT_TRUE(stats_config->usbEndpoint(0x82)==nullptr);
+    EXPECT_TRUE(ep_in->stats()==nullptr);
+    stats_config->enableStats();
+
+    USBStubDCD &dcd = USBStubDCD::instance();
+    dcd.clear();
+    dcd.setTransferCallback([](uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes){
+        stats_config->transferCompleted(ep_addr, result, xferred_bytes);
+    });
+
+    uint8_t buffer[64];
+    // full, short and zero length transfers
+    EXPECT_TRUE(ep_in->xfer(buffer, 64));
+    EXPECT_FALSE(ep_in->xfer(buffer, 64));
+    dcd.complete(0x81, 64);
+    tud_task();
+    EXPECT_TRUE(ep_in->xfer(buffer, 64));
+    dcd.complete(0x81, 10);
+    tud_task();
+    EXPECT_TRUE(ep_in->xfer(buffer, 0));
+    dcd.complete(0x81, 0);
+    tud_task();
+    // failed transfers are only counted as errors
+    EXPECT_TRUE(ep_in->xfer(buffer, 64));
+    dcd.complete(0x81, 0, XFER_RESULT_FAILED);
+    tud_task();
+    ep_in->stall();
+
+    Vector<USBEndpointStatistics> stats;
+    EXPECT_EQ(stats_config->stats(stats), 2);
+    USBEndpointStatistics &in = stats[0].ep_addr==0x81 ? stats[0] : stats[1];
+    EXPECT_EQ(in.ep_addr, 0x81);
+    EXPECT_EQ(in.bytes, 74);
+    EXPECT_EQ(in.transfers, 3);
+    EXPECT_EQ(in.short_packets, 1);
+    EXPECT_EQ(in.zlps, 1);
+    EXPECT_EQ(in.stalls, 1);
+    EXPECT_EQ(in.queue_full, 1);
+    EXPECT_EQ(in.errors, 1);
+    EXPECT_LE(in.latency_min_us, in.latency_avg_us);
+    EXPECT_LE(in.latency_avg_us, in.latency_max_us);
+
+    stats_config->resetStats();
+    stats_config->stats(stats);
+    EXPECT_EQ(stats[0].transfers, 0);
+    EXPECT_EQ(stats[1].bytes, 0);
+
+    usbd_edpt_clear_stall(0, 0x81);
+    dcd.setTransferCallback(nullptr);
+}
+
+#endif
+
+// The hash only changes with the content of the descriptors and can be folded into bcdDevice and the serial number
+TEST(USBTests, DescriptorHash) {
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(CONFIG_TOTAL_LEN);
+    device.idVendor(0xCafe).idProduct(0x0001).bcdDevice(0x0100).manufacturer("TinyUSB").product("TinyUSB Device").serialNumber("123456");
+    device.setConfigurationDescriptor(desc_fs_configuration, sizeof(desc_fs_configuration), false);
+    uint32_t hash = device.descriptorHash();
+    EXPECT_EQ(device.descriptorHash(), hash);
+
+    // bcdDevice is not part of the hash: the minor version is replaced by 2 decimal digits of the hash
+    device.bcdDeviceFromHash();
+    EXPECT_EQ(device.descriptor()->bcdDevice >> 8, 0x01);
+    EXPECT_EQ(device.descriptor()->bcdDevice & 0xff, ((hash / 10 % 10) << 4) | (hash % 10));
+    EXPECT_EQ(device.descriptorHash(), hash);
+
+    // the hash is appended to the serial number only once
+    char expected[32];
+    snprintf(expected, sizeof(expected), "123456-%08X", (unsigned) hash);
+    device.serialNumberWithHash();
+    EXPECT_STREQ(USBStrings::instance().get(device.descriptor()->iSerialNumber), expected);
+    device.serialNumberWithHash();
+    EXPECT_STREQ(USBStrings::instance().get(device.descriptor()->iSerialNumber), expected);
+    EXPECT_EQ(device.descriptorHash(), hash);
+
+    // without serial number the hash is defined as serial number: this does not change the hash
+    device.clear();
+    device.descriptorTotalSize(CONFIG_TOTAL_LEN);
+    device.bcdDevice(0x0100);
+    device.manufacturer("TinyUSB").product("TinyUSB Device");
+    device.setConfigurationDescriptor(desc_fs_configuration, sizeof(desc_fs_configuration), false);
+    uint32_t no_serial_hash = device.descriptorHash();
+    snprintf(expected, sizeof(expected), "%08X", (unsigned) no_serial_hash);
+    device.serialNumberWithHash();
+    EXPECT_STREQ(USBStrings::instance().get(device.descriptor()->iSerialNumber), expected);
+    device.serialNumberWithHash();
+    EXPECT_STREQ(USBStrings::instance().get(device.descriptor()->iSerialNumber), expected);
+    device.bcdDeviceFromHash();
+    EXPECT_EQ(device.descriptor()->bcdDevice & 0xff, ((no_serial_hash / 10 % 10) << 4) | (no_serial_hash % 10));
+    EXPECT_EQ(device.descriptorHash(), no_serial_hash);
+
+    // a changed configuration results in a new hash
+    device.clear();
+    device.descriptorTotalSize(CONFIG_TOTAL_LEN);
+    device.manufacturer("TinyUSB").product("TinyUSB Device");
+    uint8_t changed[sizeof(desc_fs_configuration)];
+    memcpy(changed, desc_fs_configuration, sizeof(changed));
+    changed[8] = 25; // bMaxPower
+    device.setConfigurationDescriptor(changed, sizeof(changed), false);
+    EXPECT_NE(device.descriptorHash(), hash);
+}
+
+// The size optimized emission strips the optional strings and the redundant descriptors
+TEST(USBTests, EmitMinimal) {
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    uint8_t s_cfg = USBStrings::instance().add("Config");
+    uint8_t s_itf = USBStrings::instance().add("Vendor Interface");
+    const int total_len = TUD_CONFIG_DESC_LEN + 8 + 9 + 5 + 5 + 7 + TUD_MIDI_DESC_LEN;
+    const uint8_t desc[] = {
+        TUD_CONFIG_DESCRIPTOR(1, 3, s_cfg, total_len, 0, 100),
+        // IAD for a single interface
+        8, TUSB_DESC_INTERFACE_ASSOCIATION, 0, 1, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, s_itf,
+        9, TUSB_DESC_INTERFACE, 0, 0, 1, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, s_itf,
+        5, TUSB_DESC_CS_INTERFACE, 1, 2, 3,
+        5, TUSB_DESC_CS_INTERFACE, 1, 2, 3,
+        7, TUSB_DESC_ENDPOINT, 0x81, TUSB_XFER_BULK, U16_TO_U8S_LE(64), 0,
+        // audio class: copied unchanged
+        TUD_MIDI_DESCRIPTOR(1, 0, 0x02, 0x82, 64)
+    };
+    device.descriptorTotalSize(total_len);
+    USBConfiguration *config = device.setConfigurationDescriptor(desc, sizeof(desc), true);
+
+    uint8_t out[sizeof(desc)];
+    USBEmitReport report;
+    int len = config->emit(out, sizeof(out), EmitMinimal, &report);
+    EXPECT_EQ(len, total_len - 13);
+    EXPECT_EQ(report.original_bytes, total_len);
+    EXPECT_EQ(report.emitted_bytes, len);
+    EXPECT_EQ(report.savedBytes(), 13);
+    EXPECT_EQ(report.stripped_descriptors, 2);
+    EXPECT_EQ(report.stripped_strings, 2);
+    EXPECT_EQ(report.string_bytes, (2 + 2*6) + (2 + 2*16));
+    EXPECT_EQ(report.savedPackets(8), USBEmitReport::packets(total_len, 8) - USBEmitReport::packets(len, 8));
+    EXPECT_GE(report.savedPackets(8), 1);
+    EXPECT_EQ(USBConfiguration::validate(out, len), nullptr);
+    EXPECT_EQ(((tusb_desc_configuration_t*)out)->iConfiguration, 0);
+    EXPECT_EQ(out[TUD_CONFIG_DESC_LEN+1], TUSB_DESC_INTERFACE);
+    EXPECT_EQ(((tusb_desc_interface_t*)(out+TUD_CONFIG_DESC_LEN))->iInterface, 0);
+    EXPECT_EQ(memcmp(out + len - TUD_MIDI_DESC_LEN, desc + total_len - TUD_MIDI_DESC_LEN, TUD_MIDI_DESC_LEN), 0);
+
+    // the strings are kept: only the redundant descriptors are removed
+    len = config->emit(out, sizeof(out), EmitStripRedundant, &report);
+    EXPECT_EQ(report.savedBytes(), 13);
+    EXPECT_EQ(report.stripped_strings, 0);
+    EXPECT_EQ(((tusb_desc_configuration_t*)out)->iConfiguration, s_cfg);
+
+    // unchanged copy
+    len = config->emit(out, sizeof(out), EmitAll, &report);
+    EXPECT_EQ(len, total_len);
+    EXPECT_EQ(report.savedBytes(), 0);
+    EXPECT_EQ(memcmp(out, desc, len), 0);
+
+    // the output buffer is too small
+    EXPECT_EQ(config->emit(out, 9), 0);
+
+    // identical class specific endpoint descriptors of different endpoints are kept
+    const int ep_total_len = TUD_CONFIG_DESC_LEN + 9 + 2 * (7 + 4);
+    const uint8_t ep_desc[] = {
+        TUD_CONFIG_DESCRIPTOR(1, 1, 0, ep_total_len, 0, 100),
+        9, TUSB_DESC_INTERFACE, 0, 0, 2, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0,
+        7, TUSB_DESC_ENDPOINT, 0x81, TUSB_XFER_BULK, U16_TO_U8S_LE(64), 0,
+        4, TUSB_DESC_CS_ENDPOINT, 1, 2,
+        7, TUSB_DESC_ENDPOINT, 0x02, TUSB_XFER_BULK, U16_TO_U8S_LE(64), 0,
+        4, TUSB_DESC_CS_ENDPOINT, 1, 2,
+    };
+    len = USBConfiguration::emit(ep_desc, sizeof(ep_desc), out, sizeof(out), EmitStripRedundant, &report);
+    EXPECT_EQ(len, ep_total_len);
+    EXPECT_EQ(report.stripped_descriptors, 0);
+    EXPECT_EQ(memcmp(out, ep_desc, len), 0);
+    device.clear();
+}
+
+static int provider_calls = 0;
+static const char* provider_value = "ABC123";
+
+static int serialProvider(char *buffer, int max_len){
+    provider_calls++;
+    strncpy(buffer, provider_value, max_len);
+    return strlen(provider_value);
+}
+
+// The hash of a built tree does not depend on the first request and does not call the providers
+TEST(USBTests, DescriptorHashBuilder) {
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(256);
+    provider_calls = 0;
+    provider_value = "ABC123";
+    device.idVendor(0xCafe).idProduct(0x0001).manufacturer("TinyUSB").serialNumber(serialProvider);
+    device.createConfiguration()->createInterface()->createEndpoint(true, Bulk);
+    USBInterface *itf = device.createConfiguration()->createInterface();
+    itf->createEndpoint(true, Bulk);
+    itf->createEndpoint(false, Bulk);
+    uint32_t hash = device.descriptorHash();
+    device.configurationDescriptor(0);
+    device.configurationDescriptor(1);
+    EXPECT_EQ(device.descriptorHash(), hash);
+    EXPECT_EQ(provider_calls, 0);
+
+    // the provided serial number is copied before the provider is replaced
+    char expected[32];
+    snprintf(expected, sizeof(expected), "ABC123-%08X", (unsigned) hash);
+    device.serialNumberWithHash();
+    EXPECT_EQ(provider_calls, 1);
+    EXPECT_FALSE(USBStrings::instance().isDynamic(device.descriptor()->iSerialNumber));
+    EXPECT_STREQ(USBStrings::instance().get(device.descriptor()->iSerialNumber), expected);
+    device.serialNumberWithHash();
+    EXPECT_STREQ(USBStrings::instance().get(device.descriptor()->iSerialNumber), expected);
+    EXPECT_EQ(device.descriptorHash(), hash);
+
+    // an additional dynamic string is part of the hash, but not its content
+    USBStrings::instance().add(serialProvider);
+    uint32_t dynamic_hash = device.descriptorHash();
+    EXPECT_NE(dynamic_hash, hash);
+    provider_value = "XYZ";
+    USBStrings::instance().invalidate(0);
+    EXPECT_EQ(device.descriptorHash(), dynamic_hash);
+    EXPECT_EQ(provider_calls, 1);
+    device.clear();
+}
+
+// Dynamic strings are requested from the provider at most once until they are invalidated
+TEST(USBTests, StringProvider) {
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    provider_calls = 0;
+    provider_value = "ABC123";
+    device.manufacturer("TinyUSB").serialNumber(serialProvider);
+    uint8_t idx = device.descriptor()->iSerialNumber;
+    USBStrings &strings = USBStrings::instance();
+    EXPECT_TRUE(strings.isDynamic(idx));
+    EXPECT_FALSE(strings.isDynamic(device.descriptor()->iManufacturer));
+    EXPECT_EQ(provider_calls, 0);
+
+    strings.finalize();
+    EXPECT_EQ(provider_calls, 1);
+    const uint16_t *str = device.string(idx);
+    EXPECT_EQ(((const uint8_t*)str)[0], 2 + 2*6);
+    EXPECT_EQ(((const uint8_t*)str)[1], TUSB_DESC_STRING);
+    EXPECT_EQ(str[1], 'A');
+    EXPECT_EQ(str[6], '3');
+    EXPECT_STREQ(strings.get(idx), "ABC123");
+    // the static strings still use the shared buffer: the cached encoding is not overwritten
+    device.string(device.descriptor()->iManufacturer);
+    EXPECT_EQ(device.string(idx)[1], 'A');
+    strings.finalize();
+    EXPECT_EQ(provider_calls, 1);
+
+    // the new value is only requested when it is needed
+    provider_value = "XYZ";
+    strings.invalidate(idx);
+    EXPECT_EQ(provider_calls, 1);
+    str = device.string(idx);
+    EXPECT_EQ(provider_calls, 2);
+    EXPECT_EQ(((const uint8_t*)str)[0], 2 + 2*3);
+    EXPECT_STREQ(strings.get(idx), "XYZ");
+
+    // values are limited to USB_STRING_MAX_LEN characters
+    provider_value = "0123456789012345678901234567890123456789";
+    strings.invalidate();
+    EXPECT_EQ(strlen(strings.get(idx)), USB_STRING_MAX_LEN);
+    EXPECT_EQ(((const uint8_t*)device.string(idx))[0], 2 + 2*USB_STRING_MAX_LEN);
+
+    // a static string replaces the provider
+    strings.set(idx, "static");
+    EXPECT_FALSE(strings.isDynamic(idx));
+    EXPECT_STREQ(strings.get(idx), "static");
+    EXPECT_EQ(provider_calls, 3);
+    device.clear();
+}
+
+// Each device controller has its own device, strings and descriptor buffer
+TEST(USBTests, PerPort) {
+    ASSERT_GE(USB_PORT_COUNT, 2);
+    USBDevice &dev0 = USBDevice::instance(0);
+    USBDevice &dev1 = USBDevice::instance(1);
+    EXPECT_EQ(&dev0, &USBDevice::instance());
+    EXPECT_NE(&dev0, &dev1);
+    EXPECT_EQ(dev1.rhport(), 1);
+    dev0.clear();
+    dev1.clear();
+
+    const uint8_t desc_midi[] = {
+        TUD_CONFIG_DESCRIPTOR(1, 2, 0, TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN, 0, 100),
+        TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64)
+    };
+    const uint8_t desc_cdc[] = {
+        TUD_CONFIG_DESCRIPTOR(1, 2, 0, TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN, 0, 100),
+        TUD_CDC_DESCRIPTOR(0, 0, 0x81, 8, 0x02, 0x82, 64)
+    };
+    dev0.descriptorTotalSize(sizeof(desc_midi));
+    dev0.idVendor(0xCafe).idProduct(0x0001).manufacturer("Port0").product("MIDI");
+    USBConfiguration *config0 = dev0.setConfigurationDescriptor(desc_midi, sizeof(desc_midi), true);
+    dev1.descriptorTotalSize(sizeof(desc_cdc));
+    dev1.idVendor(0xCafe).idProduct(0x0002).manufacturer("Port1").product("CDC").serialNumber("1");
+    USBConfiguration *config1 = dev1.setConfigurationDescriptor(desc_cdc, sizeof(desc_cdc), true);
+
+    EXPECT_EQ(((const tusb_desc_device_t*)USBDevice::deviceDescriptorCb(0))->idProduct, 0x0001);
+    EXPECT_EQ(((const tusb_desc_device_t*)USBDevice::deviceDescriptorCb(1))->idProduct, 0x0002);
+    EXPECT_EQ(memcmp(USBDevice::configurationDescriptorCb(0, 0), desc_midi, sizeof(desc_midi)), 0);
+    EXPECT_EQ(memcmp(USBDevice::configurationDescriptorCb(1, 0), desc_cdc, sizeof(desc_cdc)), 0);
+    EXPECT_EQ(USBDevice::configurationDescriptorCb(1, 1), nullptr);
+    EXPECT_STREQ(USBStrings::instance(0).get(1), "Port0");
+    EXPECT_STREQ(USBStrings::instance(1).get(1), "Port1");
+    EXPECT_EQ(USBStrings::instance(0).size(), 2);
+    EXPECT_EQ(USBStrings::instance(1).size(), 3);
+    EXPECT_EQ(USBDevice::stringCb(1, 2, DEFAULT_LANGUAGE)[1], 'C');
+
+    // the objects know their port
+    EXPECT_EQ(config1->rhport(), 1);
+    EXPECT_EQ(config1->usbInterface(0)->rhport(), 1);
+    USBEndpoint *ep1 = config1->usbEndpoint((uint8_t)0x82);
+    ASSERT_TRUE(ep1!=nullptr);
+    EXPECT_EQ(ep1->rhport(), 1);
+    EXPECT_EQ(config0->usbEndpoint((uint8_t)0x82), nullptr);
+    EXPECT_EQ(config1->findDescriptor(TUSB_DESC_INTERFACE_ASSOCIATION, 0), USBDevice::configurationDescriptorCb(1, 0) + TUD_CONFIG_DESC_LEN);
+
+    // the completed transfers are dispatched by port
+    ep1->enableStats();
+    USBDevice::transferCompletedCb(0, 0x82, XFER_RESULT_SUCCESS, 64);
+    USBEndpointStatistics snapshot;
+    ep1->stats()->snapshot(snapshot);
+    EXPECT_EQ(snapshot.transfers, 0);
+    USBDevice::transferCompletedCb(1, 0x82, XFER_RESULT_SUCCESS, 64);
+    ep1->stats()->snapshot(snapshot);
+    EXPECT_EQ(snapshot.transfers, 1);
+
+    // the busy and stall state of the endpoints is kept by port
+    USBStubDCD::instance().clear();
+    uint8_t buffer[64];
+    ASSERT_TRUE(ep1->xfer(buffer, sizeof(buffer)));
+    EXPECT_TRUE(usbd_edpt_busy(1, 0x82));
+    EXPECT_FALSE(usbd_edpt_busy(0, 0x82));
+    usbd_edpt_stall(0, 0x01);
+    EXPECT_TRUE(usbd_edpt_stalled(0, 0x01));
+    EXPECT_FALSE(usbd_edpt_stalled(1, 0x01));
+    USBStubDCD::instance().complete(0x82, 64, XFER_RESULT_SUCCESS, 1);
+    tud_task();
+    EXPECT_FALSE(usbd_edpt_busy(1, 0x82));
+    USBStubDCD::instance().clear();
+
+    // clearing one port does not change the other
+    dev1.clear();
+    EXPECT_EQ(USBStrings::instance(1).size(), 0);
+    EXPECT_EQ(USBStrings::instance(0).size(), 2);
+    EXPECT_EQ(memcmp(USBDevice::configurationDescriptorCb(0, 0), desc_midi, sizeof(desc_midi)), 0);
+    dev0.clear();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }
 
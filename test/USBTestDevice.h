@@ -0,0 +1,38 @@
+/**
+ * Device setup which is shared by the tests on the host stub: a single parsed configuration with a vendor or a
+ * MIDI interface. The feature specific wiring (run loop, trace, strings...) stays in the tests.
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#pragma once
+#include "USBDescriptor.h"
+
+// vendor interface with the bulk endpoints 0x01 and 0x81
+#define USB_TEST_VENDOR_LEN (TUD_CONFIG_DESC_LEN + TUD_VENDOR_DESC_LEN)
+
+static const uint8_t usb_test_vendor[] = {
+    TUD_CONFIG_DESCRIPTOR(1, 1, 0, USB_TEST_VENDOR_LEN, 0, 100),
+    TUD_VENDOR_DESCRIPTOR(0, 0, 0x01, 0x81, 64)
+};
+
+// MIDI interface with the bulk endpoints 0x01 and 0x81
+#define USB_TEST_MIDI_LEN (TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN)
+
+static const uint8_t usb_test_midi[] = {
+    TUD_CONFIG_DESCRIPTOR(1, 2, 0, USB_TEST_MIDI_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
+    TUD_MIDI_DESCRIPTOR(0, 0, 0x01, 0x81, 64)
+};
+
+// clears the device and the stub and defines the configuration descriptor: it is parsed, so that the endpoints are
+// available. The completed transfers of the stub are reported to transfer_cb
+inline USBConfiguration *setupTestDevice(const uint8_t *desc, int len, USBStubTransferCallback transfer_cb=USBDevice::transferCompletedCb){
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.descriptorTotalSize(len);
+    USBConfiguration *config = device.setConfigurationDescriptor(desc, len, true);
+    USBStubDCD &dcd = USBStubDCD::instance();
+    dcd.clear();
+    dcd.setTransferCallback(transfer_cb);
+    return config;
+}
@@ -0,0 +1,90 @@
+/**
+ * Test cases for USBTimeline.h - this test is compiled with USB_TIMELINE and uses a simulated clock
+ *
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ *
+ */
+#include <stdint.h>
+static uint64_t fake_time = 0;
+#define USB_CLOCK_MICROS() (fake_time)
+
+#include "USBDescriptor.h"
+#include "gtest/gtest.h"
+#include <string>
+
+#define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_VENDOR_DESC_LEN)
+
+// simulates the requests of a typical host
+static void enumerate() {
+    USBDevice &device = USBDevice::instance();
+    device.clear();
+    device.idVendor(0xCafe).idProduct(0x0001).bcdDevice(0x0100).manufacturer("TinyUSB").product("TinyUSB Device");
+    USBConfiguration* config = device.setConfigurationDescriptor(TUD_CONFIG_DESCRIPTOR(1, 1, 0, CONFIG_TOTAL_LEN, 0, 100));
+    config->addDescriptor(TUD_VENDOR_DESCRIPTOR(0, 0, 0x01, 0x81, 64));
+    USBStubDCD::instance().clear();
+
+    fake_time = 1000000;
+    dcd_event_bus_reset(0, TUSB_SPEED_FULL, false);
+    fake_time += 100;
+    device.deviceDescriptor();
+    fake_time += 50;
+    dcd_set_address(0, 5);
+    fake_time += 2000;
+    device.deviceDescriptor();
+    fake_time += 100;
+    device.configurationDescriptor(0);
+    fake_time += 100;
+    device.configurationDescriptor(0);
+    fake_time += 100;
+    device.string(0);
+    fake_time += 100;
+    device.string(2);
+    fake_time += 100;
+    device.string(2);
+    fake_time += 100;
+    USB_TIMELINE_SET_CONFIGURATION(1);
+    fake_time += 500;
+    uint8_t buffer[64];
+    usbd_edpt_xfer(0, 0x81, buffer, sizeof(buffer));
+    fake_time += 500;
+    usbd_edpt_xfer(0, 0x01, buffer, sizeof(buffer));
+}
+
+TEST(USBTimelineTests, Events) {
+    enumerate();
+    USBTimeline &timeline = USBTimeline::instance();
+    ASSERT_EQ(timeline.size(), 11);
+    EXPECT_EQ(timeline.event(0).type, TimelineBusReset);
+    EXPECT_EQ(timeline.event(0).time_us, 0);
+    EXPECT_EQ(timeline.event(2).type, TimelineSetAddress);
+    EXPECT_EQ(timeline.event(2).index, 5);
+    EXPECT_EQ(timeline.event(4).type, TimelineGetDescriptor);
+    EXPECT_EQ(timeline.event(4).desc_type, TUSB_DESC_CONFIGURATION);
+    EXPECT_EQ(timeline.event(4).len, CONFIG_TOTAL_LEN);
+    EXPECT_EQ(timeline.event(10).type, TimelineFirstTransfer);
+    EXPECT_EQ(timeline.event(10).index, 0x81);
+
+    EXPECT_EQ(timeline.time(TimelineSetAddress), 150);
+    EXPECT_EQ(timeline.time(TimelineSetConfiguration), 2750);
+    EXPECT_EQ(timeline.time(TimelineFirstTransfer), 3250);
+    EXPECT_EQ(timeline.descriptorCount(), 7);
+    EXPECT_EQ(timeline.descriptorCount(TUSB_DESC_STRING), 3);
+    EXPECT_EQ(timeline.repeatedCount(), 3);
+    EXPECT_EQ(timeline.repeatedCount(TUSB_DESC_STRING), 1);
+}
+
+TEST(USBTimelineTests, Report) {
+    enumerate();
+    std::string report;
+    USBTimeline::instance().report([&report](const char* line){ report += line; report += "\n"; });
+    EXPECT_NE(report.find("SET_ADDRESS 5"), std::string::npos);
+    EXPECT_NE(report.find("GET_DESCRIPTOR string[2] 30 bytes (repeated)"), std::string::npos);
+    EXPECT_NE(report.find("configured: 2.750 ms, first transfer: 3.250 ms"), std::string::npos);
+    EXPECT_NE(report.find("descriptor requests: 7 (3 repeated)"), std::string::npos);
+    EXPECT_NE(report.find("longest gap: 2.000 ms before GET_DESCRIPTOR device[0]"), std::string::npos);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,198 @@
+/**
+ * Test cases for USBTrace.h - this test is compiled with USB_TRACE
+ * 
+ * @copyright Copyright Phil Schatzmann (c) 2021
+ * 
+ */
+#include "USBDescriptor.h"
+#include "USBTestDevice.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+static void setupVendor() {
+    setupTestDevice(usb_test_vendor, sizeof(usb_test_vendor));
+    USBDevice::instance().idVendor(0xCafe).idProduct(0x0001).bcdDevice(0x0100).manufacturer("TinyUSB");
+    USBTrace::instance().clear();
+}
+
+TEST(USBTraceTests, Record) {
+    setupVendor();
+    USBDevice &device = USBDevice::instance();
+    device.deviceDescriptor();
+    device.configurationDescriptor(0);
+    device.string(1);
+
+    // the transfers are recorded by the endpoint and not again by the stub
+    USBEndpoint *ep = device.usbConfiguration(0)->usbEndpoint((uint8_t)0x81);
+    ASSERT_TRUE(ep!=nullptr);
+    USBStubDCD::instance().setTransferCallback(USBDevice::transferCompletedCb);
+    uint8_t buffer[64];
+    ASSERT_TRUE(ep->xfer(buffer, sizeof(buffer)));
+    USBStubDCD::instance().complete(0x81, 10);
+    tud_task();
+
+    ASSERT_EQ(USBTrace::instance().size(), 5);
+    USBTraceRecord rec;
+    ASSERT_TRUE(USBTrace::instance().get(0, rec));
+    EXPECT_EQ(rec.type, TraceDescriptor);
+    EXPECT_EQ(rec.desc_type, TUSB_DESC_DEVICE);
+    EXPECT_EQ(rec.len, sizeof(tusb_desc_device_t));
+    ASSERT_TRUE(USBTrace::instance().get(1, rec));
+    EXPECT_EQ(rec.desc_type, TUSB_DESC_CONFIGURATION);
+    EXPECT_EQ(rec.len, USB_TEST_VENDOR_LEN);
+    ASSERT_TRUE(USBTrace::instance().get(2, rec));
+    EXPECT_EQ(rec.desc_type, TUSB_DESC_STRING);
+    EXPECT_EQ(rec.len, 2 + 2*strlen("TinyUSB"));
+    ASSERT_TRUE(USBTrace::instance().get(3, rec));
+    EXPECT_EQ(rec.type, TraceSubmit);
+    EXPECT_EQ(rec.len, sizeof(buffer));
+    uint64_t submit_ts = rec.timestamp_us;
+    ASSERT_TRUE(USBTrace::instance().get(4, rec));
+    EXPECT_EQ(rec.type, TraceComplete);
+    EXPECT_EQ(rec.ep_addr, 0x81);
+    EXPECT_EQ(rec.len, 10);
+    EXPECT_GE(rec.timestamp_us, submit_ts);
+}
+
+TEST(USBTraceTests, Overflow) {
+    setupVendor();
+    for (int j=0;j<USB_TRACE_SIZE+10;j++){
+        USB_TRACE_SUBMIT(0, 0x81, j);
+    }
+    EXPECT_EQ(USBTrace::instance().size(), USB_TRACE_SIZE);
+    EXPECT_EQ(USBTrace::instance().totalCount(), USB_TRACE_SIZE+10);
+    USBTraceRecord rec;
+    ASSERT_TRUE(USBTrace::instance().get(0, rec));
+    EXPECT_EQ(rec.len, 10); // oldest available
+}
+
+TEST(USBTraceTests, Pcap) {
+    setupVendor();
+    tusb_control_request_t request = {};
+    request.bmRequestType = 0x80;
+    request.bRequest = TUSB_REQ_GET_DESCRIPTOR;
+    request.wValue = TUSB_DESC_DEVICE << 8;
+    request.wLength = 64;
+    USB_TRACE_SETUP(0, &request);
+    uint8_t buffer[64];
+    USBDevice::instance().usbConfiguration(0)->usbEndpoint((uint8_t)0x81)->xfer(buffer, sizeof(buffer));
+
+    Vector<uint8_t> pcap;
+    int count = USBTrace::instance().writePcap([&pcap](const uint8_t *data, size_t len){
+        for (size_t j=0;j<len;j++) pcap.append(data[j]);
+    });
+    EXPECT_EQ(count, 2);
+    ASSERT_EQ(pcap.size(), 24 + 2 * (16 + 64));
+
+    uint32_t value;
+    memcpy(&value, pcap.data(), 4);
+    EXPECT_EQ(value, 0xa1b2c3d4);
+    memcpy(&value, pcap.data()+20, 4);
+    EXPECT_EQ(value, 220); // LINKTYPE_USB_LINUX_MMAPPED
+
+    // setup packet
+    uint8_t *mon = pcap.data() + 24 + 16;
+    EXPECT_EQ(mon[8], 'S');
+    EXPECT_EQ(mon[9], 2); // control
+    EXPECT_EQ(mon[14], 0); // setup present
+    EXPECT_TRUE(memcmp(mon+40, &request, 8)==0);
+
+    // bulk submission
+    mon = pcap.data() + 24 + 2*16 + 64;
+    EXPECT_EQ(mon[8], 'S');
+    EXPECT_EQ(mon[9], 3); // bulk
+    EXPECT_EQ(mon[10], 0x81);
+    memcpy(&value, mon+32, 4);
+    EXPECT_EQ(value, sizeof(buffer));
+}
+
+TEST(USBTraceTests, Status) {
+    setupVendor();
+    USBEndpoint *ep = USBDevice::instance().usbConfiguration(0)->usbEndpoint((uint8_t)0x81);
+    ep->completed(XFER_RESULT_SUCCESS, 1);
+    ep->completed(XFER_RESULT_STALLED, 0);
+    ep->completed(XFER_RESULT_FAILED, 0);
+
+    Vector<uint8_t> pcap;
+    EXPECT_EQ(USBTrace::instance().writePcap([&pcap](const uint8_t *data, size_t len){
+        for (size_t j=0;j<len;j++) pcap.append(data[j]);
+    }), 3);
+    // usbmon expects a negative errno
+    int32_t expected[] = {0, -EPIPE, -EPROTO};
+    for (int j=0;j<3;j++){
+        uint8_t *mon = pcap.data() + 24 + j*(16 + 64) + 16;
+        EXPECT_EQ(mon[8], 'C');
+        int32_t status;
+        memcpy(&status, mon+28, 4);
+        EXPECT_EQ(status, expected[j]);
+    }
+}
+
+// the transfer type is taken from the descriptors of the port which has recorded the transfer
+TEST(USBTraceTests, PerPort) {
+    setupVendor();
+    // vendor interface with a single interrupt IN endpoint
+    const uint8_t desc_interrupt[] = {
+        TUD_CONFIG_DESCRIPTOR(1, 1, 0, TUD_CONFIG_DESC_LEN + 9 + 7, 0, 100),
+        9, TUSB_DESC_INTERFACE, 0, 0, 1, TUSB_CLASS_VENDOR_SPECIFIC, 0, 0, 0,
+        7, TUSB_DESC_ENDPOINT, 0x81, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(16), 10
+    };
+    USBDevice &dev1 = USBDevice::instance(1);
+    dev1.clear();
+    dev1.descriptorTotalSize(sizeof(desc_interrupt));
+    dev1.setConfigurationDescriptor(desc_interrupt, sizeof(desc_interrupt), true);
+    uint8_t buffer[16];
+    ASSERT_TRUE(USBDevice::instance(0).usbConfiguration(0)->usbEndpoint((uint8_t)0x81)->xfer(buffer, sizeof(buffer)));
+    ASSERT_TRUE(dev1.usbConfiguration(0)->usbEndpoint((uint8_t)0x81)->xfer(buffer, sizeof(buffer)));
+
+    Vector<uint8_t> pcap;
+    EXPECT_EQ(USBTrace::instance().writePcap([&pcap](const uint8_t *data, size_t len){
+        for (size_t j=0;j<len;j++) pcap.append(data[j]);
+    }), 2);
+    uint8_t *mon = pcap.data() + 24 + 16;
+    EXPECT_EQ(mon[9], 3); // bulk on port 0
+    EXPECT_EQ(mon[12], 1);
+    mon += 16 + 64;
+    EXPECT_EQ(mon[9], 1); // interrupt on port 1
+    EXPECT_EQ(mon[12], 2);
+    dev1.clear();
+    USBStubDCD::instance().clear();
+}
+
+// a reader which overlaps with the writer never gets a torn record
+TEST(USBTraceTests, Concurrent) {
+    USBTrace &trace = USBTrace::instance();
+    trace.clear();
+    std::atomic<bool> done{false};
+    std::thread writer([&](){
+        for (uint32_t j=0;j<20000;j++){
+            uint8_t setup[8];
+            memset(setup, j & 0xff, sizeof(setup));
+            trace.record(TraceSetup, j & 0x7f, j, 0, setup);
+        }
+        done = true;
+    });
+    int checked = 0;
+    // the last pass runs after the writer has finished, so it sees complete records even on a fast writer
+    while(true){
+        bool finished = done;
+        USBTraceRecord rec;
+        for (int j=0;j<trace.size();j++){
+            if (trace.get(j, rec)){
+                ASSERT_EQ(rec.ep_addr, rec.len & 0x7f);
+                ASSERT_EQ(rec.setup[0], rec.len & 0xff);
+                ASSERT_EQ(rec.setup[7], rec.len & 0xff);
+                checked++;
+            }
+        }
+        if (finished) break;
+    }
+    writer.join();
+    EXPECT_GT(checked, 0);
+    trace.clear();
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}